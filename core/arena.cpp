@@ -0,0 +1,138 @@
+#include "arena.h"
+#include "macros.h"
+#include "memory.h"
+#include <cassert>
+
+static inline uintptr_t align_up(uintptr_t p, size_t alignment) {
+    return (p + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+}
+
+Arena::Arena(size_t p_block_size):
+    _block(nullptr),
+    _cursor(nullptr),
+    _end(nullptr),
+    _block_size(p_block_size),
+    _previous_blocks_used(0),
+    _alloc_count(0),
+    _peak_bytes(0) {
+}
+
+Arena::~Arena() {
+    free_blocks();
+}
+
+void *Arena::alloc(size_t p_size, size_t p_alignment) {
+    assert((p_alignment & (p_alignment - 1)) == 0);
+
+    uintptr_t p = align_up(reinterpret_cast<uintptr_t>(_cursor), p_alignment);
+
+    if (_block == nullptr || p + p_size > reinterpret_cast<uintptr_t>(_end)) {
+        if (!add_block(p_size + p_alignment)) {
+            return nullptr;
+        }
+        p = align_up(reinterpret_cast<uintptr_t>(_cursor), p_alignment);
+    }
+
+    _cursor = reinterpret_cast<uint8_t*>(p + p_size);
+    ++_alloc_count;
+
+    size_t used = get_used_bytes();
+    if (used > _peak_bytes) {
+        _peak_bytes = used;
+    }
+
+    return reinterpret_cast<void*>(p);
+}
+
+bool Arena::resize_last(void *p_ptr, size_t p_old_size, size_t p_new_size) {
+    uint8_t *p = static_cast<uint8_t*>(p_ptr);
+
+    if (p + p_old_size != _cursor || p_new_size > static_cast<size_t>(_end - p)) {
+        return false;
+    }
+
+    _cursor = p + p_new_size;
+
+    size_t used = get_used_bytes();
+    if (used > _peak_bytes) {
+        _peak_bytes = used;
+    }
+
+    return true;
+}
+
+void Arena::reset() {
+
+    if (_block != nullptr && _block->previous != nullptr) {
+        // Replace all blocks with one large enough for what the last cycle needed
+        size_t capacity = get_capacity();
+        free_blocks();
+        // If it fails, the arena stays empty and the next allocation tries again
+        add_block(capacity);
+
+    } else if (_block != nullptr) {
+        _cursor = get_data(_block);
+    }
+
+    _previous_blocks_used = 0;
+    _alloc_count = 0;
+}
+
+size_t Arena::get_used_bytes() const {
+    return _block == nullptr ? 0 : _previous_blocks_used + (_cursor - get_data(_block));
+}
+
+size_t Arena::get_capacity() const {
+    size_t capacity = 0;
+    for (Block *b = _block; b != nullptr; b = b->previous) {
+        capacity += b->capacity;
+    }
+    return capacity;
+}
+
+bool Arena::add_block(size_t p_min_capacity) {
+
+    size_t capacity = p_min_capacity > _block_size ? p_min_capacity : _block_size;
+
+    void *mem;
+    {
+        // Blocks themselves come from the heap, even if this arena is the current one
+        ArenaScope heap_scope(nullptr);
+        mem = memalloc(BLOCK_HEADER_SIZE + capacity);
+    }
+    ERR_FAIL_COND_V(mem == nullptr, false);
+
+    Block *block = static_cast<Block*>(mem);
+    block->previous = _block;
+    block->capacity = capacity;
+
+    if (_block != nullptr) {
+        _previous_blocks_used += _cursor - get_data(_block);
+    }
+
+    _block = block;
+    _cursor = get_data(block);
+    _end = _cursor + capacity;
+    return true;
+}
+
+void Arena::free_blocks() {
+    Block *b = _block;
+    while (b != nullptr) {
+        Block *previous = b->previous;
+        memfree(b);
+        b = previous;
+    }
+    _block = nullptr;
+    _cursor = nullptr;
+    _end = nullptr;
+    _previous_blocks_used = 0;
+}
+
+ArenaScope::ArenaScope(Arena *p_arena): _previous(Memory::get_current_arena()) {
+    Memory::set_current_arena(p_arena);
+}
+
+ArenaScope::~ArenaScope() {
+    Memory::set_current_arena(_previous);
+}
@@ -0,0 +1,81 @@
+#ifndef HEADER_ARENA_H
+#define HEADER_ARENA_H
+
+#include "types.h"
+
+// Linear allocator: allocating bumps a pointer, and everything is freed at once with reset().
+// Not thread-safe, each thread should use its own.
+//
+// Containers use it through ArenaScope. Their blocks must not be used or freed after the arena is reset,
+// so anything outliving the scope must not be allocated inside it, including data handed to other threads
+// like deferred log records. Such allocations can go back to the heap with a nested ArenaScope(nullptr).
+class Arena {
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+    static const size_t DEFAULT_ALIGNMENT = 16;
+
+    explicit Arena(size_t p_block_size = DEFAULT_BLOCK_SIZE);
+    ~Arena();
+
+    // Alignment must be a power of two. Returns null if a new block was needed and couldn't be allocated.
+    void *alloc(size_t p_size, size_t p_alignment = DEFAULT_ALIGNMENT);
+
+    // Grows or shrinks the last allocation in place. Returns false if it isn't the last, or doesn't fit.
+    bool resize_last(void *p_ptr, size_t p_old_size, size_t p_new_size);
+
+    // Frees all allocations. Memory is kept, and if several blocks were needed,
+    // they are replaced by a single one so the next cycle doesn't have to allocate.
+    void reset();
+
+    // Since the last reset
+    size_t get_used_bytes() const;
+    size_t get_alloc_count() const { return _alloc_count; }
+
+    size_t get_peak_bytes() const { return _peak_bytes; }
+    size_t get_capacity() const;
+
+private:
+    Arena(const Arena &);
+    void operator=(const Arena &);
+
+    struct Block {
+        Block *previous;
+        size_t capacity;
+    };
+
+    static inline uint8_t *get_data(Block *p_block) {
+        return reinterpret_cast<uint8_t*>(p_block) + BLOCK_HEADER_SIZE;
+    }
+
+    bool add_block(size_t p_min_capacity);
+    void free_blocks();
+
+    static const size_t BLOCK_HEADER_SIZE = (sizeof(Block) + DEFAULT_ALIGNMENT - 1) & ~(DEFAULT_ALIGNMENT - 1);
+
+    Block *_block;
+    uint8_t *_cursor;
+    uint8_t *_end;
+    size_t _block_size;
+    // Bytes used in blocks before the current one
+    size_t _previous_blocks_used;
+    size_t _alloc_count;
+    size_t _peak_bytes;
+};
+
+// Routes allocations of the current thread to an arena while alive, including those of Vector and String.
+// Blocks keep their origin: heap blocks are still reallocated and freed on the heap,
+// and freeing an arena block does nothing.
+// Scopes can be nested, and a null arena goes back to the heap.
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena *p_arena);
+    ~ArenaScope();
+
+private:
+    ArenaScope(const ArenaScope &);
+    void operator=(const ArenaScope &);
+
+    Arena *_previous;
+};
+
+#endif // HEADER_ARENA_H
@@ -0,0 +1,609 @@
+#include "async_io.h"
+#include "log.h"
+#include "macros.h"
+
+#ifdef _WIN32
+#include "utf8.h"
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#define ASYNC_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef ASYNC_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Not defined by older C libraries. They are the same on all architectures.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+#endif
+
+// Reads larger than this are split, some kernels fail beyond
+static const size_t MAX_READ_CHUNK = 0x7ffff000;
+
+static bool read_at(const AsyncIO::Read &p_read, size_t &out_bytes_read);
+
+#ifdef ASYNC_IO_URING
+
+// Zero identifies the wake-up read, other values are requests
+static const uint64_t WAKE_USER_DATA = 0;
+
+static inline uint32_t load_acquire(const uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(uint32_t *p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// Rings shared with the kernel. Head and tail indices are written by one side and read by the other.
+struct AsyncIO::Uring {
+    int ring_fd;
+    // Written by submit() to wake the I/O thread, which always has a read pending on it
+    int event_fd;
+    uint64_t event_value;
+    uint32_t entries;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    io_uring_sqe *sqes;
+
+    void *cq_ring;
+    size_t cq_ring_size;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    io_uring_cqe *cqes;
+
+    // The caller makes sure there is room, by not having more reads in flight than entries
+    io_uring_sqe &get_sqe() {
+        uint32_t tail = *sq_tail;
+        assert(tail - load_acquire(sq_head) < entries);
+        uint32_t index = tail & sq_mask;
+        sq_array[index] = index;
+        io_uring_sqe &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        store_release(sq_tail, tail + 1);
+        return sqe;
+    }
+
+    void prepare_read(int fd, void *dst, size_t size, uint64_t offset, uint64_t user_data) {
+        io_uring_sqe &sqe = get_sqe();
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.off = offset;
+        sqe.addr = reinterpret_cast<uintptr_t>(dst);
+        sqe.len = static_cast<uint32_t>(size < MAX_READ_CHUNK ? size : MAX_READ_CHUNK);
+        sqe.user_data = user_data;
+    }
+
+    // Reads what remains of the request
+    void prepare_read(Request &r) {
+        prepare_read(r.fd, static_cast<uint8_t*>(r.read.destination) + r.bytes_read,
+            r.read.size - r.bytes_read, r.read.offset + r.bytes_read, reinterpret_cast<uintptr_t>(&r));
+    }
+};
+
+static bool is_read_supported(int ring_fd) {
+    const size_t op_count = 256;
+    size_t probe_size = sizeof(io_uring_probe) + op_count * sizeof(io_uring_probe_op);
+    io_uring_probe *probe = static_cast<io_uring_probe*>(memalloc(probe_size));
+    memset(probe, 0, probe_size);
+
+    // The probe itself requires Linux 5.6, like reads without iovecs
+    bool supported = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, op_count) >= 0
+        && probe->last_op >= IORING_OP_READ
+        && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+
+    memfree(probe);
+    return supported;
+}
+
+bool AsyncIO::start_uring(uint32_t p_queue_depth) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // Room for the wake-up read and at least one file read
+    if (p_queue_depth < 2) {
+        p_queue_depth = 2;
+    }
+
+    // Fails on old kernels, or when disabled by sysctl or seccomp
+    int ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, p_queue_depth, &params));
+    if (ring_fd < 0) {
+        return false;
+    }
+
+    if (!is_read_supported(ring_fd)) {
+        close(ring_fd);
+        return false;
+    }
+
+    Uring *u = static_cast<Uring*>(memalloc(sizeof(Uring)));
+    memset(u, 0, sizeof(Uring));
+    u->ring_fd = ring_fd;
+    u->event_fd = -1;
+    u->entries = params.sq_entries;
+
+    u->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    u->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && u->cq_ring_size > u->sq_ring_size) {
+        u->sq_ring_size = u->cq_ring_size;
+    }
+
+    u->sq_ring = mmap(nullptr, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring_fd, IORING_OFF_SQ_RING);
+    u->cq_ring = single_mmap ? u->sq_ring : mmap(nullptr, u->cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    u->event_fd = eventfd(0, EFD_CLOEXEC);
+
+    _uring = u;
+
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || sqes == MAP_FAILED || u->event_fd == -1) {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+        }
+        stop_uring();
+        return false;
+    }
+
+    uint8_t *sq = static_cast<uint8_t*>(u->sq_ring);
+    u->sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    u->sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    u->sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    u->sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    u->sqes = static_cast<io_uring_sqe*>(sqes);
+
+    uint8_t *cq = static_cast<uint8_t*>(u->cq_ring);
+    u->cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    u->cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    u->cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    u->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    _threads.push_back(std::thread(&AsyncIO::uring_loop, this));
+    return true;
+}
+
+void AsyncIO::stop_uring() {
+    Uring *u = _uring;
+    if (u == nullptr) {
+        return;
+    }
+    if (u->sqes != nullptr) {
+        munmap(u->sqes, u->entries * sizeof(io_uring_sqe));
+    }
+    if (u->cq_ring != MAP_FAILED && u->cq_ring != nullptr && u->cq_ring != u->sq_ring) {
+        munmap(u->cq_ring, u->cq_ring_size);
+    }
+    if (u->sq_ring != MAP_FAILED && u->sq_ring != nullptr) {
+        munmap(u->sq_ring, u->sq_ring_size);
+    }
+    if (u->event_fd != -1) {
+        close(u->event_fd);
+    }
+    close(u->ring_fd);
+    memfree(u);
+    _uring = nullptr;
+}
+
+void AsyncIO::wake_uring() {
+    uint64_t one = 1;
+    ssize_t written = write(_uring->event_fd, &one, sizeof(one));
+    (void)written;
+}
+
+void AsyncIO::uring_loop() {
+    Uring &u = *_uring;
+
+    // Reads in flight, including the wake-up read
+    uint32_t in_flight = 0;
+    bool wake_pending = false;
+    // Prepared but not submitted to the kernel yet
+    uint32_t to_submit = 0;
+
+    Vector<Request*> batch;
+    batch.reserve(u.entries);
+
+    while (true) {
+        batch.clear();
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            // One entry is kept for the wake-up read, which is already counted while pending
+            const uint32_t reserved = in_flight + (wake_pending ? 0 : 1);
+            while (!_queue.is_empty() && reserved + batch.size() < u.entries) {
+                batch.push_back(_queue.front());
+                _queue.pop_front();
+            }
+            stopping = _stopping && _queue.is_empty();
+        }
+
+        if (stopping && batch.size() == 0 && in_flight == (wake_pending ? 1u : 0u)) {
+            break;
+        }
+
+        if (!wake_pending) {
+            u.prepare_read(u.event_fd, &u.event_value, sizeof(u.event_value), 0, WAKE_USER_DATA);
+            wake_pending = true;
+            ++in_flight;
+            ++to_submit;
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Request &r = *batch[i];
+            // Opening blocks this thread, not the owner
+            r.fd = open(r.read.path, O_RDONLY | O_CLOEXEC);
+            if (r.fd == -1) {
+                complete(r, STATUS_FAILED);
+                continue;
+            }
+            u.prepare_read(r);
+            ++in_flight;
+            ++to_submit;
+        }
+
+        // Sleeps until a read completes, which includes the wake-up read
+        int submitted = static_cast<int>(syscall(__NR_io_uring_enter, u.ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+        const bool failed = submitted < 0;
+        if (failed) {
+            // EBUSY means the completion queue is full, retrying before reaping it would spin forever
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                LOG_ERROR("io_uring_enter failed with errno ", errno, ", falling back to blocking reads");
+                fall_back_from_uring();
+                return;
+            }
+            submitted = 0;
+        }
+        to_submit -= static_cast<uint32_t>(submitted);
+
+        uint32_t head = *u.cq_head;
+        uint32_t tail = load_acquire(u.cq_tail);
+
+        if (failed && head == tail) {
+            // Out of kernel resources with nothing to reap, other threads may free some
+            std::this_thread::yield();
+        }
+
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = u.cqes[head & u.cq_mask];
+
+            if (cqe.user_data == WAKE_USER_DATA) {
+                wake_pending = false;
+                --in_flight;
+                continue;
+            }
+
+            Request &r = *reinterpret_cast<Request*>(static_cast<uintptr_t>(cqe.user_data));
+
+            if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+                u.prepare_read(r);
+                ++to_submit;
+                continue;
+            }
+
+            if (cqe.res > 0) {
+                r.bytes_read += cqe.res;
+                // Short reads are continued, until the end of the file
+                if (r.bytes_read < r.read.size) {
+                    u.prepare_read(r);
+                    ++to_submit;
+                    continue;
+                }
+            }
+
+            --in_flight;
+            close(r.fd);
+            r.fd = -1;
+            complete(r, cqe.res < 0 ? STATUS_FAILED : STATUS_DONE);
+        }
+
+        store_release(u.cq_head, head);
+    }
+}
+
+// Called by the io_uring thread once the ring can't be used anymore.
+// Requests given to it are read again with blocking reads, then the thread serves the queue like the pool.
+void AsyncIO::fall_back_from_uring() {
+    Vector<Request*> unfinished;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // Only requests this thread opened have a file descriptor, queued ones don't yet
+        for (Pool<Request>::Iterator it = _requests.begin(); it != _requests.end(); ++it) {
+            if (it->status == STATUS_PENDING && it->fd != -1) {
+                unfinished.push_back(&*it);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < unfinished.size(); ++i) {
+        Request &r = *unfinished[i];
+        close(r.fd);
+        r.fd = -1;
+        // The kernel may still finish reads it accepted, it writes the same bytes
+        size_t bytes_read;
+        bool ok = read_at(r.read, bytes_read);
+        r.bytes_read = bytes_read;
+        complete(r, ok ? STATUS_DONE : STATUS_FAILED);
+    }
+
+    thread_loop();
+}
+
+#else
+
+bool AsyncIO::start_uring(uint32_t p_queue_depth) {
+    (void)p_queue_depth;
+    return false;
+}
+
+void AsyncIO::stop_uring() {}
+void AsyncIO::wake_uring() {}
+void AsyncIO::uring_loop() {}
+void AsyncIO::fall_back_from_uring() {}
+
+#endif // ASYNC_IO_URING
+
+// Blocking read used by the thread pool. Returns false on error.
+static bool read_at(const AsyncIO::Read &p_read, size_t &out_bytes_read) {
+    out_bytes_read = 0;
+    uint8_t *dst = static_cast<uint8_t*>(p_read.destination);
+
+#ifdef _WIN32
+    size_t len = strlen(p_read.path);
+    Vector<wchar_t> wpath;
+    wpath.resize_no_init(UTF8::to_wide(p_read.path, len, nullptr) + 1);
+    UTF8::to_wide(p_read.path, len, wpath.data());
+
+    HANDLE file = CreateFileW(wpath.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    bool ok = true;
+    while (out_bytes_read < p_read.size) {
+        uint64_t offset = p_read.offset + out_bytes_read;
+        size_t remaining = p_read.size - out_bytes_read;
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD count = 0;
+        if (!ReadFile(file, dst + out_bytes_read, static_cast<DWORD>(remaining < MAX_READ_CHUNK ? remaining : MAX_READ_CHUNK),
+                &count, &overlapped)) {
+            // Reading past the end is not an error
+            ok = GetLastError() == ERROR_HANDLE_EOF;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+        out_bytes_read += count;
+    }
+
+    CloseHandle(file);
+    return ok;
+#else
+    int fd = open(p_read.path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    bool ok = true;
+    while (out_bytes_read < p_read.size) {
+        size_t remaining = p_read.size - out_bytes_read;
+        ssize_t count = pread(fd, dst + out_bytes_read, remaining < MAX_READ_CHUNK ? remaining : MAX_READ_CHUNK,
+            p_read.offset + out_bytes_read);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+        out_bytes_read += count;
+    }
+
+    close(fd);
+    return ok;
+#endif
+}
+
+void AsyncIO::thread_loop() {
+    while (true) {
+        Request *r;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_queue.is_empty() && !_stopping) {
+                _queue_condition.wait(lock);
+            }
+            if (_queue.is_empty()) {
+                break;
+            }
+            r = _queue.front();
+            _queue.pop_front();
+        }
+
+        size_t bytes_read;
+        bool ok = read_at(r->read, bytes_read);
+        r->bytes_read = bytes_read;
+        complete(*r, ok ? STATUS_DONE : STATUS_FAILED);
+    }
+}
+
+AsyncIO::AsyncIO(uint32_t p_thread_count, uint32_t p_queue_depth):
+    _backend(BACKEND_THREADS), _pending_count(0), _stopping(false), _uring(nullptr) {
+
+    if (start_uring(p_queue_depth)) {
+        _backend = BACKEND_IO_URING;
+        return;
+    }
+
+    if (p_thread_count == 0) {
+        p_thread_count = 1;
+    }
+    for (uint32_t i = 0; i < p_thread_count; ++i) {
+        _threads.push_back(std::thread(&AsyncIO::thread_loop, this));
+    }
+}
+
+AsyncIO::~AsyncIO() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _queue_condition.notify_all();
+    if (_uring != nullptr) {
+        wake_uring();
+    }
+
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        _threads[i].join();
+    }
+
+    stop_uring();
+}
+
+// Called by I/O threads
+void AsyncIO::complete(Request &p_request, Status p_status) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    p_request.status = p_status;
+    _completed.push_back(&p_request);
+    --_pending_count;
+    _completion_condition.notify_all();
+}
+
+void AsyncIO::submit(const Read *p_reads, size_t p_count, Handle *out_handles) {
+    if (p_count == 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < p_count; ++i) {
+            Handle h = _requests.create();
+            Request &r = *_requests.get(h);
+            r.read = p_reads[i];
+            r.handle = h;
+            r.status = STATUS_PENDING;
+            r.bytes_read = 0;
+            r.fd = -1;
+            _queue.push_back(&r);
+            if (out_handles != nullptr) {
+                out_handles[i] = h;
+            }
+        }
+        _pending_count += p_count;
+    }
+
+    // One wake-up per batch. The condition is notified with io_uring too,
+    // in case its thread fell back to blocking reads.
+    if (_uring != nullptr) {
+        wake_uring();
+    }
+    if (p_count == 1) {
+        _queue_condition.notify_one();
+    } else {
+        _queue_condition.notify_all();
+    }
+}
+
+AsyncIO::Handle AsyncIO::submit(const Read &p_read) {
+    Handle h;
+    submit(&p_read, 1, &h);
+    return h;
+}
+
+AsyncIO::Status AsyncIO::get_status(Handle p_handle) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const Request *r = _requests.get(p_handle);
+    return r == nullptr ? STATUS_INVALID : r->status;
+}
+
+size_t AsyncIO::get_bytes_read(Handle p_handle) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const Request *r = _requests.get(p_handle);
+    // Written by the I/O thread until the status changes
+    return r == nullptr || r->status == STATUS_PENDING ? 0 : r->bytes_read;
+}
+
+bool AsyncIO::release(Handle p_handle) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const Request *r = _requests.get(p_handle);
+    if (r == nullptr) {
+        return true;
+    }
+    ERR_FAIL_COND_V(r->status == STATUS_PENDING, false);
+    _requests.destroy(p_handle);
+    return true;
+}
+
+size_t AsyncIO::update() {
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        count = _completed.size();
+        while (!_completed.is_empty()) {
+            const Request &r = *_completed.front();
+            _completed.pop_front();
+            if (r.read.callback == nullptr) {
+                continue;
+            }
+            Completion c = { r.read.callback, r.read.userdata, r.handle, r.status, r.bytes_read };
+            _reporting.push_back(c);
+            // Released before callbacks run, since they may submit reads reusing its slot
+            _requests.destroy(r.handle);
+        }
+    }
+
+    // Without the lock, callbacks can submit more reads
+    for (size_t i = 0; i < _reporting.size(); ++i) {
+        const Completion &c = _reporting[i];
+        c.callback(c.handle, c.status, c.bytes_read, c.userdata);
+    }
+
+    _reporting.clear();
+    return count;
+}
+
+void AsyncIO::wait_all() {
+    while (true) {
+        update();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_pending_count == 0 && _completed.is_empty()) {
+            break;
+        }
+        while (_completed.is_empty()) {
+            _completion_condition.wait(lock);
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef HEADER_ASYNC_IO_H
+#define HEADER_ASYNC_IO_H
+
+#include "pool.h"
+#include "deque.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Reads files in the background, so streaming assets doesn't block the frame loop.
+// Reads are submitted in batches and many can be in flight. They are done with io_uring on Linux
+// when the kernel supports it, otherwise by a pool of threads doing blocking reads.
+// Completions are reported by update() on the thread owning the service, typically once per frame,
+// so callbacks can record uploads without further synchronization.
+// Not thread-safe, only the owner thread may call its methods.
+class AsyncIO {
+public:
+    enum Status {
+        // The handle doesn't refer to a request, or it was released
+        STATUS_INVALID = 0,
+        STATUS_PENDING,
+        // Reads past the end of the file complete with less bytes than requested
+        STATUS_DONE,
+        STATUS_FAILED
+    };
+
+    enum Backend {
+        BACKEND_IO_URING,
+        BACKEND_THREADS
+    };
+
+    struct Request;
+    typedef PoolHandle<Request> Handle;
+
+    typedef void (*Callback)(Handle p_handle, Status p_status, size_t p_bytes_read, void *p_userdata);
+
+    struct Read {
+        // The path and the destination must stay valid until the read completes
+        const char *path;
+        uint64_t offset;
+        size_t size;
+        void *destination;
+        // Called by update(). The request is released just before, so the handle only identifies it.
+        // Without a callback, the request stays until release() is called.
+        Callback callback;
+        void *userdata;
+    };
+
+    struct Request {
+        Read read;
+        Handle handle;
+        Status status;
+        size_t bytes_read;
+        // Open while io_uring reads it
+        int fd;
+    };
+
+    AsyncIO(uint32_t p_thread_count = 2, uint32_t p_queue_depth = 64);
+    // Waits for reads in flight, without reporting them
+    ~AsyncIO();
+
+    // Queues reads without blocking on I/O. Handles are written in `out_handles` if it is not null.
+    void submit(const Read *p_reads, size_t p_count, Handle *out_handles = nullptr);
+    Handle submit(const Read &p_read);
+
+    Status get_status(Handle p_handle) const;
+    // Only known once the read completed
+    size_t get_bytes_read(Handle p_handle) const;
+
+    // Releases a completed request. Returns false if it is still pending.
+    bool release(Handle p_handle);
+
+    // Calls callbacks of reads completed since the last call, and returns how many completed
+    size_t update();
+
+    // Blocks until all submitted reads completed, reporting them like update()
+    void wait_all();
+
+    inline Backend get_backend() const {
+        return _backend;
+    }
+
+private:
+    AsyncIO(const AsyncIO &);
+    void operator=(const AsyncIO &);
+
+    struct Uring;
+
+    bool start_uring(uint32_t p_queue_depth);
+    void stop_uring();
+    void wake_uring();
+    void uring_loop();
+    void fall_back_from_uring();
+    void thread_loop();
+    void complete(Request &p_request, Status p_status);
+
+    Backend _backend;
+
+    // Guards everything the I/O threads share with the owner
+    mutable std::mutex _mutex;
+    std::condition_variable _queue_condition;
+    std::condition_variable _completion_condition;
+    Pool<Request> _requests;
+    Deque<Request*> _queue;
+    Deque<Request*> _completed;
+    // Submitted and not completed yet
+    size_t _pending_count;
+    bool _stopping;
+
+    // Copied out of a request, so reporting doesn't depend on its slot
+    struct Completion {
+        Callback callback;
+        void *userdata;
+        Handle handle;
+        Status status;
+        size_t bytes_read;
+    };
+
+    // Only used by update(), kept to avoid allocating every frame
+    Vector<Completion> _reporting;
+
+    Vector<std::thread> _threads;
+    Uring *_uring;
+};
+
+#endif // HEADER_ASYNC_IO_H
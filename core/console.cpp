@@ -1,23 +1,31 @@
-#include <cwchar>
 #include <cstdio>
 #include "console.h"
+#include "log.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+// Strings are UTF-8, the console must not interpret them with the local code page
+static struct ConsoleInit {
+    ConsoleInit() {
+        SetConsoleOutputCP(CP_UTF8);
+    }
+} g_console_init;
+#endif
 
 namespace Console {
 
+// Note: only narrow output is used, because mixing it with wide output on the same stream is undefined.
+// Console output is synchronous, so queued log messages are written first to keep the order.
+
 void _print_raw(const char *p_cstr) {
+    Log::flush();
     fputs(p_cstr, stdout);
 }
 
-void _print_raw(const Char *p_cstr) {
-    fputws(p_cstr, stdout);
-}
-
-void _print_raw(const String &p_str) {
-    fputws(p_str.data(), stdout);
-}
-
 void print_line() {
-    fputwc(L'\n', stdout);
+    Log::flush();
+    fputc('\n', stdout);
 }
 
 void pause() {
@@ -6,15 +6,15 @@
 
 namespace Console {
 
+// Output is UTF-8
 void _print_raw(const char *p_cstr);
-void _print_raw(const Char *p_cstr);
 void print_line();
 
 template <typename T>
 inline void print_raw(const T a) {
     String s;
     to_string(s, a);
-    _print_raw(s.data());
+    _print_raw(s.c_str());
 }
 
 template <>
@@ -22,12 +22,8 @@ inline void print_raw(const char *p_cstr) {
     _print_raw(p_cstr);
 }
 template <>
-inline void print_raw(const Char *p_cstr) {
-    _print_raw(p_cstr);
-}
-template <>
 inline void print_raw(const String &p_str) {
-    _print_raw(p_str.data());
+    _print_raw(p_str.c_str());
 }
 
 template <typename T>
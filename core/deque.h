@@ -0,0 +1,265 @@
+#ifndef HEADER_DEQUE_H
+#define HEADER_DEQUE_H
+
+#include "vector.h" // For VectorSboBudget and relocate_elements
+
+// Largest power of two number of elements fitting in a byte budget
+template <typename T>
+constexpr size_t deque_sbo_elements(size_t p_bytes, size_t p_count = 1) {
+    return p_bytes < sizeof(T) ? 0 : (p_count * 2 * sizeof(T) > p_bytes ? p_count : deque_sbo_elements<T>(p_bytes, p_count * 2));
+}
+
+// Double-ended queue stored in a ring buffer, with O(1) push and pop at both ends.
+// Capacity is always a power of two, and the first SBO_SIZE elements are stored inline.
+template <typename T, size_t SBO_SIZE = deque_sbo_elements<T>(VectorSboBudget<T>::BYTES)>
+class Deque {
+public:
+    static_assert((SBO_SIZE & (SBO_SIZE - 1)) == 0, "Inline capacity must be a power of two");
+
+    class ConstIterator {
+    public:
+        ConstIterator(const Deque *p_deque, size_t p_index): m_deque(p_deque), m_index(p_index) {}
+
+        const T &operator*() const {
+            return (*m_deque)[m_index];
+        }
+
+        ConstIterator &operator++() {
+            ++m_index;
+            return *this;
+        }
+
+        bool operator!=(const ConstIterator &p_other) const {
+            return m_index != p_other.m_index;
+        }
+
+    private:
+        const Deque *m_deque;
+        size_t m_index;
+    };
+
+    Deque(): m_data((T*)m_stack_storage), m_capacity(SBO_SIZE), m_head(0), m_size(0) { }
+
+    Deque(const Deque &p_other): m_data((T*)m_stack_storage), m_capacity(SBO_SIZE), m_head(0), m_size(0) {
+        copy(p_other);
+    }
+
+    Deque(Deque &&p_other): m_data((T*)m_stack_storage), m_capacity(SBO_SIZE), m_head(0), m_size(0) {
+        grab(p_other);
+    }
+
+    ~Deque() {
+        hard_clear();
+    }
+
+    inline size_t size() const {
+        return m_size;
+    }
+
+    inline bool is_empty() const {
+        return m_size == 0;
+    }
+
+    inline size_t capacity() const {
+        return m_capacity;
+    }
+
+    inline bool is_using_heap() const {
+        return m_data != (T*)m_stack_storage;
+    }
+
+    void push_back(T p_value) {
+        // Note: we take by value to prevent the case where we resize the capacity,
+        // because the reference could be coming from the same storage
+        if (m_size == m_capacity) {
+            grow();
+        }
+        new(&m_data[wrap(m_head + m_size)]) T(std::move(p_value));
+        ++m_size;
+    }
+
+    void push_front(T p_value) {
+        if (m_size == m_capacity) {
+            grow();
+        }
+        // Unsigned wrap-around is fine since capacity is a power of two
+        m_head = wrap(m_head - 1);
+        new(&m_data[m_head]) T(std::move(p_value));
+        ++m_size;
+    }
+
+    void pop_back() {
+        assert(m_size != 0);
+        --m_size;
+        m_data[wrap(m_head + m_size)].~T();
+    }
+
+    void pop_front() {
+        assert(m_size != 0);
+        m_data[m_head].~T();
+        m_head = wrap(m_head + 1);
+        --m_size;
+    }
+
+    const T &front() const {
+        assert(m_size > 0);
+        return m_data[m_head];
+    }
+
+    T &front() {
+        assert(m_size > 0);
+        return m_data[m_head];
+    }
+
+    const T &back() const {
+        assert(m_size > 0);
+        return m_data[wrap(m_head + m_size - 1)];
+    }
+
+    T &back() {
+        assert(m_size > 0);
+        return m_data[wrap(m_head + m_size - 1)];
+    }
+
+    // Index 0 is the front
+    const T &operator[](size_t p_index) const {
+        assert(p_index < m_size);
+        return m_data[wrap(m_head + p_index)];
+    }
+
+    T &operator[](size_t p_index) {
+        assert(p_index < m_size);
+        return m_data[wrap(m_head + p_index)];
+    }
+
+    ConstIterator begin() const {
+        return ConstIterator(this, 0);
+    }
+
+    ConstIterator end() const {
+        return ConstIterator(this, m_size);
+    }
+
+    void clear() {
+        if (!std::is_trivially_destructible<T>::value) {
+            for (size_t i = 0; i < m_size; ++i) {
+                m_data[wrap(m_head + i)].~T();
+            }
+        }
+        m_head = 0;
+        m_size = 0;
+    }
+
+    void hard_clear() {
+        clear();
+        if (is_using_heap()) {
+            memfree(m_data);
+            m_data = (T*)m_stack_storage;
+        }
+        m_capacity = SBO_SIZE;
+    }
+
+    void reserve(size_t p_capacity) {
+        if (p_capacity > m_capacity) {
+            size_t c = m_capacity == 0 ? 1 : m_capacity;
+            while (c < p_capacity) {
+                c *= 2;
+            }
+            resize_capacity(c);
+        }
+    }
+
+    void copy(const Deque &p_other) {
+        clear();
+        reserve(p_other.size());
+        for (size_t i = 0; i < p_other.size(); ++i) {
+            new(&m_data[i]) T(p_other[i]);
+        }
+        m_size = p_other.size();
+    }
+
+    // Takes the contents of another deque, leaving it empty
+    void grab(Deque &p_other) {
+        hard_clear();
+
+        if (p_other.is_using_heap()) {
+            m_data = p_other.m_data;
+            m_capacity = p_other.m_capacity;
+            m_head = p_other.m_head;
+            m_size = p_other.m_size;
+
+            p_other.m_data = (T*)p_other.m_stack_storage;
+            p_other.m_capacity = SBO_SIZE;
+
+        } else {
+            // Inline storage can't be stolen
+            size_t first_part = p_other.m_capacity - p_other.m_head;
+            if (first_part >= p_other.m_size) {
+                relocate_elements(m_data, p_other.m_data + p_other.m_head, p_other.m_size);
+            } else {
+                relocate_elements(m_data, p_other.m_data + p_other.m_head, first_part);
+                relocate_elements(m_data + first_part, p_other.m_data, p_other.m_size - first_part);
+            }
+            m_size = p_other.m_size;
+        }
+
+        p_other.m_head = 0;
+        p_other.m_size = 0;
+    }
+
+    void operator=(const Deque &p_other) {
+        if (&p_other != this) {
+            copy(p_other);
+        }
+    }
+
+    void operator=(Deque &&p_other) {
+        if (&p_other != this) {
+            grab(p_other);
+        }
+    }
+
+private:
+    inline size_t wrap(size_t i) const {
+        return i & (m_capacity - 1);
+    }
+
+    void grow() {
+        resize_capacity(m_capacity == 0 ? 4 : m_capacity * 2);
+    }
+
+    void resize_capacity(size_t p_capacity) {
+        assert(p_capacity > SBO_SIZE);
+        assert(p_capacity >= m_size);
+
+        // Elements are moved in order, so the front ends up at index 0
+        T *d = static_cast<T*>(memalloc(p_capacity * sizeof(T)));
+
+        size_t first_part = m_capacity - m_head;
+        if (first_part >= m_size) {
+            relocate_elements(d, m_data + m_head, m_size);
+        } else {
+            relocate_elements(d, m_data + m_head, first_part);
+            relocate_elements(d + first_part, m_data, m_size - first_part);
+        }
+
+        if (is_using_heap()) {
+            memfree(m_data);
+        }
+
+        m_data = d;
+        m_capacity = p_capacity;
+        m_head = 0;
+    }
+
+    // Can't be empty even when there is no inline storage
+    alignas(T) uint8_t m_stack_storage[SBO_SIZE == 0 ? 1 : SBO_SIZE * sizeof(T)];
+
+    // Points either to the stack storage or to the heap
+    T *m_data;
+    size_t m_capacity;
+    size_t m_head;
+    size_t m_size;
+};
+
+#endif // HEADER_DEQUE_H
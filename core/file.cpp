@@ -1,4 +1,23 @@
 #include "file.h"
+#include "utf8.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+// Paths are UTF-8, which Windows APIs would interpret with the local code page
+static void to_wide_path(const char *fpath, Vector<wchar_t> &out_wpath) {
+    size_t len = strlen(fpath);
+    out_wpath.resize_no_init(UTF8::to_wide(fpath, len, nullptr) + 1);
+    UTF8::to_wide(fpath, len, out_wpath.data());
+}
+#endif
 
 File::File() {
     _file = nullptr;
@@ -29,7 +48,14 @@ bool File::open(const char *fpath, OpenMode open_mode, DataMode data_mode) {
     if (data_mode == BINARY)
         smode[1] = 'b';
 
+#ifdef _WIN32
+    Vector<wchar_t> wpath;
+    to_wide_path(fpath, wpath);
+    wchar_t wmode[3] = { (wchar_t)smode[0], (wchar_t)smode[1], 0 };
+    _file = _wfopen(wpath.data(), wmode);
+#else
     _file = fopen(fpath, smode);
+#endif
 
     return _file != nullptr;
 }
@@ -41,13 +67,21 @@ void File::close() {
     }
 }
 
-void File::read_all_bytes(Vector<uint8_t> &out_bytes) {
+bool File::read_all_bytes(Vector<uint8_t> &out_bytes) {
     assert(_file != nullptr);
     fseek(_file, 0, SEEK_END); // Non portable, but `EOF, SEEK_CUR` didn't work...
-    size_t len = ftell(_file);
+    long len = ftell(_file);
+    if (len < 0) {
+        return false;
+    }
     out_bytes.resize_no_init(len);
     fseek(_file, 0, 0);
-    fread(out_bytes.data(), sizeof(uint8_t), out_bytes.size(), _file);
+    return fread(out_bytes.data(), sizeof(uint8_t), out_bytes.size(), _file) == out_bytes.size();
+}
+
+bool File::write_bytes(const uint8_t *bytes, size_t size) {
+    assert(_file != nullptr);
+    return fwrite(bytes, sizeof(uint8_t), size, _file) == size;
 }
 
 // Static
@@ -55,9 +89,151 @@ bool File::read_all_bytes(const char *fpath, Vector<uint8_t> &out_bytes) {
     File f;
     if(!f.open(fpath, READ, BINARY))
         return false;
-    f.read_all_bytes(out_bytes);
-    f.close();
+    return f.read_all_bytes(out_bytes);
+}
+
+// Static
+bool File::get_size(const char *fpath, uint64_t &out_size) {
+#ifdef _WIN32
+    Vector<wchar_t> wpath;
+    to_wide_path(fpath, wpath);
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(wpath.data(), GetFileExInfoStandard, &data)) {
+        return false;
+    }
+    out_size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(fpath, &st) != 0) {
+        return false;
+    }
+    out_size = static_cast<uint64_t>(st.st_size);
+#endif
     return true;
 }
 
+MappedFile::MappedFile(): _data(nullptr), _size(0), _is_open(false) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifndef _WIN32
+static int get_advice(MappedFile::AccessHint hint) {
+    switch (hint) {
+        case MappedFile::ACCESS_SEQUENTIAL:
+            return MADV_SEQUENTIAL;
+        case MappedFile::ACCESS_RANDOM:
+            return MADV_RANDOM;
+        case MappedFile::ACCESS_WILL_NEED:
+            return MADV_WILLNEED;
+        default:
+            return MADV_NORMAL;
+    }
+}
+#endif
+
+bool MappedFile::open(const char *fpath, AccessHint hint) {
+
+    close();
+
+#ifdef _WIN32
+    Vector<wchar_t> wpath;
+    to_wide_path(fpath, wpath);
+
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (hint == ACCESS_SEQUENTIAL) {
+        flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+    } else if (hint == ACCESS_RANDOM) {
+        flags |= FILE_FLAG_RANDOM_ACCESS;
+    }
+
+    HANDLE file = CreateFileW(wpath.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    // Empty files can't be mapped
+    if (size.QuadPart != 0) {
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr) {
+            CloseHandle(file);
+            return false;
+        }
+        _data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        // The view keeps the file open
+        CloseHandle(mapping);
+        if (_data == nullptr) {
+            CloseHandle(file);
+            return false;
+        }
+    }
+
+    CloseHandle(file);
+    _size = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(fpath, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // Empty files can't be mapped
+    if (st.st_size != 0) {
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        _data = static_cast<const uint8_t*>(data);
+        madvise(data, st.st_size, get_advice(hint));
+    }
+
+    // The mapping keeps the file open
+    ::close(fd);
+    _size = static_cast<size_t>(st.st_size);
+#endif
+
+    _is_open = true;
+    return true;
+}
+
+void MappedFile::close() {
+    if (_data != nullptr) {
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+#else
+        munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+    }
+    _data = nullptr;
+    _size = 0;
+    _is_open = false;
+}
+
+void MappedFile::advise(AccessHint hint, size_t p_offset, size_t p_size) {
+    assert(p_offset <= _size && p_size <= _size - p_offset);
+#ifndef _WIN32
+    if (p_size == 0) {
+        return;
+    }
+    // The start must be aligned to a page
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = p_offset - p_offset % page_size;
+    madvise(const_cast<uint8_t*>(_data) + begin, p_offset + p_size - begin, get_advice(hint));
+#endif
+}
+
 
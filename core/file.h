@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include "vector.h"
+#include "span.h"
 
 class File {
 public:
@@ -22,12 +23,67 @@ public:
     bool open(const char *fpath, OpenMode open_mode, DataMode data_mode);
     void close();
 
-    void read_all_bytes(Vector<uint8_t> &out_bytes);
+    bool read_all_bytes(Vector<uint8_t> &out_bytes);
+    bool write_bytes(const uint8_t *bytes, size_t size);
 
+    // Copies the file into a vector. Prefer MappedFile to read large files without copying them.
     static bool read_all_bytes(const char *fpath, Vector<uint8_t> &out_bytes);
 
+    // Gets the size of a file without reading it. Returns false if it can't be accessed.
+    static bool get_size(const char *fpath, uint64_t &out_size);
+
 private:
     FILE *_file;
 };
 
+// Read-only file mapped in memory. Pages are loaded by the OS as they are accessed,
+// so the content is neither copied through stdio buffers nor duplicated on the heap.
+// Spans can be given directly to APIs reading memory, and stay valid until the file is closed.
+class MappedFile {
+public:
+    // How the content is going to be accessed, so the OS can read ahead or not.
+    // Only SEQUENTIAL and RANDOM have an effect on Windows, when opening.
+    enum AccessHint {
+        ACCESS_NORMAL,
+        ACCESS_SEQUENTIAL,
+        ACCESS_RANDOM,
+        // Starts loading pages now
+        ACCESS_WILL_NEED
+    };
+
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const char *fpath, AccessHint hint = ACCESS_SEQUENTIAL);
+    void close();
+
+    inline bool is_open() const {
+        return _is_open;
+    }
+
+    // Empty files are open but have no data. The mapping is aligned to at least 4 KiB.
+    inline Span<const uint8_t> get_span() const {
+        return Span<const uint8_t>(_data, _size);
+    }
+
+    inline Span<const uint8_t> get_span(size_t p_offset, size_t p_size) const {
+        return get_span().sub_span(p_offset, p_size);
+    }
+
+    inline size_t size() const {
+        return _size;
+    }
+
+    // Hint for a range of the file, rounded to whole pages. Does nothing on Windows.
+    void advise(AccessHint hint, size_t p_offset, size_t p_size);
+
+private:
+    MappedFile(const MappedFile &);
+    void operator=(const MappedFile &);
+
+    const uint8_t *_data;
+    size_t _size;
+    bool _is_open;
+};
+
 #endif // HEADER_FILE_H
@@ -0,0 +1,130 @@
+#ifndef HEADER_FORMAT_H
+#define HEADER_FORMAT_H
+
+#include "types.h"
+
+// Format strings parsed at compile time, for String::append_format.
+// Use the FMT macro on a string literal, where `%` are placeholders and `\%` is a literal `%`:
+//
+//     s.append_format(FMT("Found % devices"), count);
+//
+// The number of arguments is checked at compile time.
+
+struct ParsedFormat {
+    static const size_t MAX_PIECES = 32;
+
+    // Literal text, which may be followed by an argument
+    struct Piece {
+        size_t begin = 0;
+        size_t end = 0;
+        bool argument_after = false;
+    };
+
+    Piece pieces[MAX_PIECES] = {};
+    size_t piece_count = 0;
+    size_t placeholder_count = 0;
+    // Total size of literal pieces
+    size_t literal_length = 0;
+    bool too_many_pieces = false;
+
+    constexpr void add_piece(size_t p_begin, size_t p_end, bool p_argument_after) {
+        if (p_begin == p_end && !p_argument_after) {
+            return;
+        }
+        if (piece_count == MAX_PIECES) {
+            too_many_pieces = true;
+            return;
+        }
+        Piece &piece = pieces[piece_count++];
+        piece.begin = p_begin;
+        piece.end = p_end;
+        piece.argument_after = p_argument_after;
+        literal_length += p_end - p_begin;
+        if (p_argument_after) {
+            ++placeholder_count;
+        }
+    }
+};
+
+constexpr ParsedFormat parse_format(const char *p_str) {
+    ParsedFormat format;
+    size_t begin = 0;
+    size_t i = 0;
+
+    while (p_str[i] != 0) {
+        if (p_str[i] == '\\' && p_str[i + 1] == '%') {
+            // Skip the backslash, the `%` starts the next piece
+            format.add_piece(begin, i, false);
+            begin = i + 1;
+            i += 2;
+
+        } else if (p_str[i] == '%') {
+            format.add_piece(begin, i, true);
+            begin = i + 1;
+            ++i;
+
+        } else {
+            ++i;
+        }
+    }
+
+    format.add_piece(begin, i, false);
+    return format;
+}
+
+// Wraps a type holding a string literal, so it can be parsed in a constant expression
+template <typename F>
+struct FormatLiteral {
+    static constexpr const char *get() {
+        return F::get();
+    }
+};
+
+#define FMT(p_literal) ([]() { \
+    struct F { static constexpr const char *get() { return p_literal; } }; \
+    return FormatLiteral<F>(); }())
+
+// Estimated number of bytes `to_string` will write, so the destination is only reserved once.
+// Types without an overload get a default estimate.
+template <typename T>
+inline size_t format_size_hint(const T &) {
+    return 16;
+}
+
+inline size_t format_size_hint(char) {
+    return 1;
+}
+
+inline size_t format_size_hint(wchar_t) {
+    return 4;
+}
+
+inline size_t format_size_hint(int) {
+    return 11;
+}
+
+inline size_t format_size_hint(int64_t) {
+    return 20;
+}
+
+inline size_t format_size_hint(float) {
+    return 16;
+}
+
+inline size_t format_size_hint(double) {
+    return 24;
+}
+
+inline size_t format_size_hint(void *) {
+    return 16;
+}
+
+inline size_t format_size_hint(const char *p_cstr) {
+    size_t len = 0;
+    while (p_cstr[len] != 0) {
+        ++len;
+    }
+    return len;
+}
+
+#endif // HEADER_FORMAT_H
@@ -0,0 +1,152 @@
+#include "hash.h"
+#include <cstring> // memcpy
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h> // _umul128
+#endif
+
+namespace Hash {
+
+static const uint64_t g_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+// 64x64 to 128-bit multiplication, low half in a, high half in b
+static inline void mum(uint64_t &a, uint64_t &b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = a;
+    r *= b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    a = _umul128(a, b, &b);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    a = lo;
+    b = hi;
+#endif
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    mum(a, b);
+    return a ^ b;
+}
+
+static inline uint64_t read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t read3(const uint8_t *p, size_t k) {
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+uint64_t hash_bytes(const void *p_data, size_t p_size, uint64_t p_seed) {
+
+    const uint8_t *p = static_cast<const uint8_t*>(p_data);
+    uint64_t seed = p_seed ^ mix(p_seed ^ g_secret[0], g_secret[1]);
+    uint64_t a, b;
+
+    if (p_size <= 16) {
+        if (p_size >= 4) {
+            a = (read4(p) << 32) | read4(p + ((p_size >> 3) << 2));
+            b = (read4(p + p_size - 4) << 32) | read4(p + p_size - 4 - ((p_size >> 3) << 2));
+        } else if (p_size > 0) {
+            a = read3(p, p_size);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+
+    } else {
+        size_t i = p_size;
+
+        if (i > 48) {
+            // Three independent lanes, so multiplications can run in parallel
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = mix(read8(p) ^ g_secret[1], read8(p + 8) ^ seed);
+                seed1 = mix(read8(p + 16) ^ g_secret[2], read8(p + 24) ^ seed1);
+                seed2 = mix(read8(p + 32) ^ g_secret[3], read8(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (i > 16) {
+            seed = mix(read8(p) ^ g_secret[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        // Last 16 bytes, possibly overlapping with already hashed ones
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+
+    a ^= g_secret[1];
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ g_secret[0] ^ p_size, b ^ g_secret[1]);
+}
+
+uint64_t combine(uint64_t p_hash, uint64_t p_value) {
+    return mix(p_hash ^ g_secret[0], p_value ^ g_secret[1]);
+}
+
+Stream::Stream(uint64_t p_seed) {
+    _hash = p_seed;
+    _total_size = 0;
+    _block_size = 0;
+}
+
+void Stream::add_bytes(const void *p_data, size_t p_size) {
+
+    const uint8_t *p = static_cast<const uint8_t*>(p_data);
+    _total_size += p_size;
+
+    while (p_size > 0) {
+        size_t n = BLOCK_SIZE - _block_size;
+        if (n > p_size) {
+            n = p_size;
+        }
+
+        if (_block_size == 0 && n == BLOCK_SIZE) {
+            // Full block, no need to copy it
+            _hash = hash_bytes(p, BLOCK_SIZE, _hash);
+
+        } else {
+            memcpy(_block + _block_size, p, n);
+            _block_size += n;
+            if (_block_size == BLOCK_SIZE) {
+                _hash = hash_bytes(_block, BLOCK_SIZE, _hash);
+                _block_size = 0;
+            }
+        }
+
+        p += n;
+        p_size -= n;
+    }
+}
+
+uint64_t Stream::get() const {
+    // Hashing the remainder with the total size makes data of different length differ
+    return combine(hash_bytes(_block, _block_size, _hash), _total_size);
+}
+
+} // namespace Hash
@@ -0,0 +1,73 @@
+#ifndef HEADER_HASH_H
+#define HEADER_HASH_H
+
+#include <type_traits>
+#include "types.h"
+
+// Fast non-cryptographic hashing, for cache keys and hash tables.
+// Results are stable across runs, but depend on endianness.
+namespace Hash {
+
+// Hashes a span of bytes into 64 bits. Based on wyhash.
+uint64_t hash_bytes(const void *p_data, size_t p_size, uint64_t p_seed = 0);
+
+// Hashes the bytes of a POD value. Beware of padding bytes, which must be zeroed to get stable results.
+template <typename T>
+inline uint64_t hash_pod(const T &p_value, uint64_t p_seed = 0) {
+    static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be hashed by bytes");
+    return hash_bytes(&p_value, sizeof(T), p_seed);
+}
+
+// Mixes a 64-bit value into a hash, to combine fields without hashing them as bytes
+uint64_t combine(uint64_t p_hash, uint64_t p_value);
+
+// Hashes string code units by value (FNV-1a), so that narrow and wide versions of an ASCII string get the same hash.
+// It can run at compile time, to hash literals.
+template <typename C>
+constexpr uint64_t hash_chars(const C *p_str, size_t p_len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < p_len; ++i) {
+        h ^= static_cast<uint64_t>(p_str[i]);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+template <typename C>
+constexpr uint64_t hash_chars(const C *p_cstr) {
+    size_t len = 0;
+    while (p_cstr[len] != 0) {
+        ++len;
+    }
+    return hash_chars(p_cstr, len);
+}
+
+// Hashes data given in several pieces.
+// The result only depends on the concatenated bytes, not on how they were split.
+// It is not the same as hash_bytes() of the whole data.
+class Stream {
+public:
+    Stream(uint64_t p_seed = 0);
+
+    void add_bytes(const void *p_data, size_t p_size);
+
+    template <typename T>
+    void add_pod(const T &p_value) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be hashed by bytes");
+        add_bytes(&p_value, sizeof(T));
+    }
+
+    uint64_t get() const;
+
+private:
+    static const size_t BLOCK_SIZE = 256;
+
+    uint64_t _hash;
+    uint64_t _total_size;
+    size_t _block_size;
+    uint8_t _block[BLOCK_SIZE];
+};
+
+} // namespace Hash
+
+#endif // HEADER_HASH_H
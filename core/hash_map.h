@@ -0,0 +1,91 @@
+#ifndef HEADER_HASH_MAP_H
+#define HEADER_HASH_MAP_H
+
+#include "hash_table.h"
+
+template <typename K, typename V>
+struct HashMapSlot {
+    K key;
+    V value;
+
+    HashMapSlot(const K &p_key, const V &p_value): key(p_key), value(p_value) {}
+};
+
+// Associative container with open addressing, see HashTable.
+// Lookup functions are templates so they can take any key type supported by the hasher,
+// for example a String in a map of C strings.
+template <typename K, typename V, typename H = Hasher<K> >
+class HashMap : public HashTable<K, HashMapSlot<K, V>, H> {
+public:
+    typedef HashTable<K, HashMapSlot<K, V>, H> Base;
+    typedef HashMapSlot<K, V> Slot;
+    typedef typename Base::template IteratorBase<Slot> Iterator;
+    typedef typename Base::template IteratorBase<const Slot> ConstIterator;
+
+    template <typename Q>
+    bool has(const Q &p_key) const {
+        return this->find_index(p_key) != Base::NOT_FOUND;
+    }
+
+    // Returns null if the key is not found
+    template <typename Q>
+    V *getptr(const Q &p_key) {
+        size_t i = this->find_index(p_key);
+        return i == Base::NOT_FOUND ? nullptr : &this->m_slots[i].value;
+    }
+
+    template <typename Q>
+    const V *getptr(const Q &p_key) const {
+        size_t i = this->find_index(p_key);
+        return i == Base::NOT_FOUND ? nullptr : &this->m_slots[i].value;
+    }
+
+    // Returns true if the key was added, false if it was already there and got its value replaced
+    bool set(const K &p_key, const V &p_value) {
+        size_t i = this->find_index(p_key);
+        if (i != Base::NOT_FOUND) {
+            this->m_slots[i].value = p_value;
+            return false;
+        }
+        this->insert_slot(Slot(p_key, p_value), H::hash(p_key));
+        return true;
+    }
+
+    // Inserts a default value if the key is not found
+    V &operator[](const K &p_key) {
+        size_t i = this->find_index(p_key);
+        if (i == Base::NOT_FOUND) {
+            this->insert_slot(Slot(p_key, V()), H::hash(p_key));
+            i = this->find_index(p_key);
+        }
+        return this->m_slots[i].value;
+    }
+
+    template <typename Q>
+    bool erase(const Q &p_key) {
+        size_t i = this->find_index(p_key);
+        if (i == Base::NOT_FOUND) {
+            return false;
+        }
+        this->erase_at(i);
+        return true;
+    }
+
+    Iterator begin() {
+        return Iterator(this, 0);
+    }
+
+    Iterator end() {
+        return Iterator(this, this->m_capacity);
+    }
+
+    ConstIterator begin() const {
+        return ConstIterator(this, 0);
+    }
+
+    ConstIterator end() const {
+        return ConstIterator(this, this->m_capacity);
+    }
+};
+
+#endif // HEADER_HASH_MAP_H
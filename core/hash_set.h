@@ -0,0 +1,64 @@
+#ifndef HEADER_HASH_SET_H
+#define HEADER_HASH_SET_H
+
+#include "hash_table.h"
+
+template <typename K>
+struct HashSetSlot {
+    K key;
+
+    HashSetSlot(const K &p_key): key(p_key) {}
+};
+
+// Set of unique keys with open addressing, see HashTable.
+// Lookup functions are templates so they can take any key type supported by the hasher.
+template <typename K, typename H = Hasher<K> >
+class HashSet : public HashTable<K, HashSetSlot<K>, H> {
+public:
+    typedef HashTable<K, HashSetSlot<K>, H> Base;
+    typedef HashSetSlot<K> Slot;
+
+    // Keys can't be modified in place, so there is only a const iterator
+    class ConstIterator : public Base::template IteratorBase<const Slot> {
+    public:
+        ConstIterator(const Base *p_table, size_t p_index): Base::template IteratorBase<const Slot>(p_table, p_index) {}
+
+        const K &operator*() const {
+            return Base::template IteratorBase<const Slot>::operator*().key;
+        }
+    };
+
+    template <typename Q>
+    bool has(const Q &p_key) const {
+        return this->find_index(p_key) != Base::NOT_FOUND;
+    }
+
+    // Returns true if the key was added, false if it was already there
+    bool insert(const K &p_key) {
+        if (this->find_index(p_key) != Base::NOT_FOUND) {
+            return false;
+        }
+        this->insert_slot(Slot(p_key), H::hash(p_key));
+        return true;
+    }
+
+    template <typename Q>
+    bool erase(const Q &p_key) {
+        size_t i = this->find_index(p_key);
+        if (i == Base::NOT_FOUND) {
+            return false;
+        }
+        this->erase_at(i);
+        return true;
+    }
+
+    ConstIterator begin() const {
+        return ConstIterator(this, 0);
+    }
+
+    ConstIterator end() const {
+        return ConstIterator(this, this->m_capacity);
+    }
+};
+
+#endif // HEADER_HASH_SET_H
@@ -0,0 +1,345 @@
+#ifndef HEADER_HASH_TABLE_H
+#define HEADER_HASH_TABLE_H
+
+#include <cassert>
+#include <new> // For placement new
+#include <type_traits>
+#include <utility> // For std::move
+#include "memory.h"
+#include "types.h"
+#include "hash.h"
+
+class String;
+
+// Mixes bits so that keys differing only in high bits still spread over a power-of-two table
+inline uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb53ca94f882bULL;
+    h ^= h >> 33;
+    return h;
+}
+
+template <typename A, typename B>
+inline bool chars_equal(const A *a, const B *b) {
+    size_t i = 0;
+    while (a[i] == b[i]) {
+        if (a[i] == 0) {
+            return true;
+        }
+        ++i;
+    }
+    return false;
+}
+
+// Hash and equality used by HashMap and HashSet.
+// Overloads of `hash` and `equals` taking other types than K allow heterogeneous lookup.
+template <typename K>
+struct Hasher {
+    static_assert(std::is_integral<K>::value || std::is_enum<K>::value || std::is_pointer<K>::value,
+        "Hasher must be specialized for this key type");
+
+    static inline uint64_t hash(const K &k) {
+        return hash_mix((uint64_t)k);
+    }
+
+    static inline bool equals(const K &a, const K &b) {
+        return a == b;
+    }
+};
+
+// C strings are hashed by content. The table only stores the pointer, so it must outlive it.
+template <>
+struct Hasher<const char *> {
+    static inline uint64_t hash(const char *k) {
+        return Hash::hash_chars(k);
+    }
+
+    static inline bool equals(const char *a, const char *b) {
+        return chars_equal(a, b);
+    }
+
+    // Defined in string.cpp
+    static uint64_t hash(const String &k);
+    static bool equals(const char *a, const String &b);
+};
+
+// Open-addressing table with linear probing and Robin Hood insertion.
+// Each slot has a metadata byte holding its distance to its ideal position plus one, 0 meaning empty.
+// Lookups stop as soon as they meet an element closer to its ideal position than the one searched,
+// and removals shift following elements back, so there are no tombstones.
+// Used as the storage of HashMap and HashSet, where `Slot` has a `key` member.
+template <typename K, typename Slot, typename H>
+class HashTable {
+public:
+    HashTable(): m_slots(nullptr), m_metadata(nullptr), m_capacity(0), m_size(0) { }
+
+    HashTable(const HashTable &p_other): m_slots(nullptr), m_metadata(nullptr), m_capacity(0), m_size(0) {
+        copy(p_other);
+    }
+
+    HashTable(HashTable &&p_other): m_slots(nullptr), m_metadata(nullptr), m_capacity(0), m_size(0) {
+        grab(p_other);
+    }
+
+    ~HashTable() {
+        hard_clear();
+    }
+
+    inline size_t size() const {
+        return m_size;
+    }
+
+    inline bool is_empty() const {
+        return m_size == 0;
+    }
+
+    inline size_t capacity() const {
+        return m_capacity;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < m_capacity; ++i) {
+            if (m_metadata[i] != 0) {
+                m_slots[i].~Slot();
+                m_metadata[i] = 0;
+            }
+        }
+        m_size = 0;
+    }
+
+    void hard_clear() {
+        clear();
+        if (m_slots != nullptr) {
+            memfree(m_slots);
+            m_slots = nullptr;
+            m_metadata = nullptr;
+        }
+        m_capacity = 0;
+    }
+
+    // Makes room for a number of elements without rehashing
+    void reserve(size_t p_count) {
+        size_t c = m_capacity == 0 ? MIN_CAPACITY : m_capacity;
+        while (is_overloaded(p_count, c)) {
+            c *= 2;
+        }
+        if (c > m_capacity) {
+            rehash(c);
+        }
+    }
+
+    void copy(const HashTable &p_other) {
+        clear();
+        reserve(p_other.size());
+        for (size_t i = 0; i < p_other.m_capacity; ++i) {
+            if (p_other.m_metadata[i] != 0) {
+                const Slot &slot = p_other.m_slots[i];
+                insert_slot(Slot(slot), H::hash(slot.key));
+            }
+        }
+    }
+
+    void grab(HashTable &p_other) {
+        hard_clear();
+
+        m_slots = p_other.m_slots;
+        m_metadata = p_other.m_metadata;
+        m_capacity = p_other.m_capacity;
+        m_size = p_other.m_size;
+
+        p_other.m_slots = nullptr;
+        p_other.m_metadata = nullptr;
+        p_other.m_capacity = 0;
+        p_other.m_size = 0;
+    }
+
+    void operator=(const HashTable &p_other) {
+        if (&p_other != this) {
+            copy(p_other);
+        }
+    }
+
+    void operator=(HashTable &&p_other) {
+        if (&p_other != this) {
+            grab(p_other);
+        }
+    }
+
+    // Iterates slots in storage order
+    template <typename S>
+    class IteratorBase {
+    public:
+        IteratorBase(const HashTable *p_table, size_t p_index): m_table(p_table), m_index(p_index) {
+            skip_empty();
+        }
+
+        S &operator*() const {
+            return m_table->m_slots[m_index];
+        }
+
+        S *operator->() const {
+            return &m_table->m_slots[m_index];
+        }
+
+        IteratorBase &operator++() {
+            ++m_index;
+            skip_empty();
+            return *this;
+        }
+
+        bool operator!=(const IteratorBase &p_other) const {
+            return m_index != p_other.m_index;
+        }
+
+    private:
+        void skip_empty() {
+            while (m_index < m_table->m_capacity && m_table->m_metadata[m_index] == 0) {
+                ++m_index;
+            }
+        }
+
+        const HashTable *m_table;
+        size_t m_index;
+    };
+
+protected:
+    // Returns the index of the slot, or NOT_FOUND
+    template <typename Q>
+    size_t find_index(const Q &p_key) const {
+        if (m_size == 0) {
+            return NOT_FOUND;
+        }
+
+        size_t mask = m_capacity - 1;
+        size_t i = H::hash(p_key) & mask;
+        uint32_t distance = 1;
+
+        while (true) {
+            uint32_t m = m_metadata[i];
+            if (m < distance) {
+                // Empty, or the key would have been placed here already
+                return NOT_FOUND;
+            }
+            if (m == distance && H::equals(m_slots[i].key, p_key)) {
+                return i;
+            }
+            i = (i + 1) & mask;
+            ++distance;
+        }
+    }
+
+    // The key must not be present already
+    void insert_slot(Slot &&p_slot, uint64_t p_hash) {
+
+        if (is_overloaded(m_size + 1, m_capacity)) {
+            rehash(m_capacity == 0 ? MIN_CAPACITY : m_capacity * 2);
+        }
+
+        Slot slot(std::move(p_slot));
+        uint64_t hash = p_hash;
+
+        while (true) {
+            size_t mask = m_capacity - 1;
+            size_t i = hash & mask;
+            uint32_t distance = 1;
+
+            while (distance < MAX_DISTANCE) {
+                uint8_t &m = m_metadata[i];
+
+                if (m == 0) {
+                    new(&m_slots[i]) Slot(std::move(slot));
+                    m = static_cast<uint8_t>(distance);
+                    ++m_size;
+                    return;
+                }
+
+                if (m < distance) {
+                    // Take the place of a richer slot, and continue with it
+                    Slot &other = m_slots[i];
+                    Slot temp(std::move(other));
+                    other = std::move(slot);
+                    slot = std::move(temp);
+                    uint32_t other_distance = m;
+                    m = static_cast<uint8_t>(distance);
+                    distance = other_distance;
+                }
+
+                i = (i + 1) & mask;
+                ++distance;
+            }
+
+            // Probe sequence got too long, which only happens with very bad hashes.
+            // Grow, then place the slot we are holding.
+            rehash(m_capacity * 2);
+            hash = H::hash(slot.key);
+        }
+    }
+
+    void erase_at(size_t p_index) {
+        assert(m_metadata[p_index] != 0);
+
+        size_t mask = m_capacity - 1;
+        size_t i = p_index;
+        size_t next = (i + 1) & mask;
+
+        // Shift back following slots which are not at their ideal position
+        while (m_metadata[next] > 1) {
+            m_slots[i] = std::move(m_slots[next]);
+            m_metadata[i] = m_metadata[next] - 1;
+            i = next;
+            next = (next + 1) & mask;
+        }
+
+        m_slots[i].~Slot();
+        m_metadata[i] = 0;
+        --m_size;
+    }
+
+    static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+    Slot *m_slots;
+    uint8_t *m_metadata;
+    size_t m_capacity;
+    size_t m_size;
+
+private:
+    static const size_t MIN_CAPACITY = 8;
+    static const uint32_t MAX_DISTANCE = 255;
+
+    static inline bool is_overloaded(size_t p_size, size_t p_capacity) {
+        // Max load factor of 7/8
+        return p_size * 8 > p_capacity * 7;
+    }
+
+    void rehash(size_t p_capacity) {
+        assert((p_capacity & (p_capacity - 1)) == 0);
+
+        Slot *old_slots = m_slots;
+        uint8_t *old_metadata = m_metadata;
+        size_t old_capacity = m_capacity;
+
+        // Slots and metadata share the same block
+        uint8_t *block = static_cast<uint8_t*>(memalloc(p_capacity * (sizeof(Slot) + 1)));
+        m_slots = reinterpret_cast<Slot*>(block);
+        m_metadata = block + p_capacity * sizeof(Slot);
+        memset(m_metadata, 0, p_capacity);
+        m_capacity = p_capacity;
+        m_size = 0;
+
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_metadata[i] != 0) {
+                Slot &slot = old_slots[i];
+                insert_slot(std::move(slot), H::hash(slot.key));
+                slot.~Slot();
+            }
+        }
+
+        if (old_slots != nullptr) {
+            memfree(old_slots);
+        }
+    }
+};
+
+#endif // HEADER_HASH_TABLE_H
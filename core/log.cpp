@@ -1,11 +1,555 @@
 #include "log.h"
+#include "hash.h"
+#include "number_format.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
 
 namespace Log {
 
-const Char *DEBUG_PREFIX = L"DEBUG: ";
-const Char *INFO_PREFIX = L"INFO: ";
-const Char *WARNING_PREFIX = L"WARNING: ";
-const Char *ERROR_PREFIX = L"ERROR: ";
+const char *DEBUG_PREFIX = "DEBUG: ";
+const char *INFO_PREFIX = "INFO: ";
+const char *WARNING_PREFIX = "WARNING: ";
+const char *ERROR_PREFIX = "ERROR: ";
 
+static const char *get_prefix(Level p_level) {
+    switch (p_level) {
+        case LEVEL_DEBUG:
+            return DEBUG_PREFIX;
+        case LEVEL_INFO:
+            return INFO_PREFIX;
+        case LEVEL_WARNING:
+            return WARNING_PREFIX;
+        default:
+            return ERROR_PREFIX;
+    }
 }
 
+struct RecordHeader {
+    // Nanoseconds since the logger started
+    int64_t timestamp;
+    // Allocated records can be larger than a slot
+    uint32_t size;
+    uint8_t level;
+    // The data is a pointer to a block allocated with memalloc
+    bool allocated;
+};
+
+// Bounded multi-producer single-consumer queue of fixed-size slots.
+// A slot is free for the lap `pos / SLOT_COUNT` when its sequence is twice the lap,
+// and full when it is one more. This way zero-initialized slots are ready, before any static constructor runs.
+static const size_t SLOT_COUNT = 1024;
+static const size_t SLOT_SIZE = 256;
+
+struct Slot {
+    std::atomic<size_t> sequence;
+    RecordHeader header;
+    uint8_t data[SLOT_SIZE - sizeof(std::atomic<size_t>) - sizeof(RecordHeader)];
+};
+
+static_assert(sizeof(Slot) == SLOT_SIZE, "Unexpected slot padding");
+static_assert(MAX_RECORD_SIZE <= sizeof(Slot::data), "Records must fit in a slot");
+
+static Slot g_slots[SLOT_COUNT];
+
+// Kept on separate cache lines, the head is written by producers and the others by the consumer
+alignas(64) static std::atomic<size_t> g_head;
+alignas(64) static std::atomic<size_t> g_tail;
+// Records before this position are written to the output
+static std::atomic<size_t> g_written;
+
+// Created on the first message
+struct Worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<bool> sleeping;
+    bool stop_requested;
+    std::chrono::steady_clock::time_point start_time;
+
+    Worker(): sleeping(false), stop_requested(false), start_time(std::chrono::steady_clock::now()) {}
+};
+
+static std::atomic<Worker*> g_worker;
+static std::mutex g_worker_mutex;
+// Set when the worker was stopped at exit. Messages are then written synchronously.
+static std::atomic<bool> g_stopped;
+static std::mutex g_sync_output_mutex;
+
+// Batches are written once they reach this size, or when the queue is empty
+static const size_t BATCH_SIZE = 32 * 1024;
+// Messages are written at least this often
+static const int WRITE_INTERVAL_MS = 10;
+// Waking the worker costs a system call, so producers only do it when this many messages are pending
+static const size_t WAKE_THRESHOLD = SLOT_COUNT / 4;
+
+static const uint8_t *decode_argument(String &dst, const uint8_t *p, const uint8_t *end);
+
+template <typename T>
+static inline const uint8_t *read_value(const uint8_t *p, T &out_value) {
+    memcpy(&out_value, p, sizeof(T));
+    return p + sizeof(T);
+}
+
+static const uint8_t *decode_format(String &dst, const char *p_format, const uint8_t *p, const uint8_t *end) {
+    const ParsedFormat format = parse_format(p_format);
+    for (size_t i = 0; i < format.piece_count; ++i) {
+        const ParsedFormat::Piece &piece = format.pieces[i];
+        dst.append_region(p_format, piece.begin, piece.end - piece.begin);
+        // Missing arguments are left empty
+        if (piece.argument_after && p < end) {
+            p = decode_argument(dst, p, end);
+        }
+    }
+    return p;
+}
+
+static const uint8_t *decode_argument(String &dst, const uint8_t *p, const uint8_t *end) {
+    uint8_t type = *p;
+    ++p;
+
+    switch (type) {
+        case RecordWriter::ARG_INT: {
+            int64_t v;
+            p = read_value(p, v);
+            to_string(dst, v);
+        } break;
+
+        case RecordWriter::ARG_UINT: {
+            uint64_t v;
+            p = read_value(p, v);
+            char digits[NumberFormat::MAX_LENGTH + 1];
+            const size_t len = NumberFormat::write_uint(v, digits);
+            digits[len] = 0;
+            dst.append_region(digits, 0, len);
+        } break;
+
+        case RecordWriter::ARG_FLOAT: {
+            float v;
+            p = read_value(p, v);
+            to_string(dst, v);
+        } break;
+
+        case RecordWriter::ARG_DOUBLE: {
+            double v;
+            p = read_value(p, v);
+            to_string(dst, v);
+        } break;
+
+        case RecordWriter::ARG_CHAR: {
+            char v;
+            p = read_value(p, v);
+            dst += v;
+        } break;
+
+        case RecordWriter::ARG_STRING: {
+            uint32_t len;
+            p = read_value(p, len);
+            // Never trusted beyond the end of the record. Malformed, the rest is skipped.
+            if (len >= static_cast<size_t>(end - p)) {
+                return end;
+            }
+            dst.append_region(reinterpret_cast<const char*>(p), 0, len);
+            p += len + 1;
+        } break;
+
+        case RecordWriter::ARG_POINTER: {
+            const void *v;
+            p = read_value(p, v);
+            to_string(dst, const_cast<void*>(v));
+        } break;
+
+        case RecordWriter::ARG_FORMAT: {
+            const char *v;
+            p = read_value(p, v);
+            p = decode_format(dst, v, p, end);
+        } break;
+
+        default:
+            assert(false);
+            return end;
+    }
+
+    return p;
+}
+
+static void append_prefix(String &dst, int64_t p_timestamp, Level p_level) {
+    // Seconds with milliseconds
+    int64_t ms = p_timestamp / 1000000;
+    dst += '[';
+    to_string(dst, ms / 1000);
+    dst += '.';
+    int64_t frac = ms % 1000;
+    dst += static_cast<char>('0' + frac / 100);
+    dst += static_cast<char>('0' + frac / 10 % 10);
+    dst += static_cast<char>('0' + frac % 10);
+    dst += "] ";
+    dst += get_prefix(p_level);
+}
+
+static void decode_record(String &dst, const RecordHeader &header, const uint8_t *data) {
+    if (header.allocated) {
+        uint8_t *block;
+        read_value(data, block);
+        data = block;
+    }
+
+    // Timestamped when the message was logged rather than when it is output
+    append_prefix(dst, header.timestamp, static_cast<Level>(header.level));
+
+    const uint8_t *end = data + header.size;
+    for (const uint8_t *p = data; p < end;) {
+        p = decode_argument(dst, p, end);
+    }
+
+    dst += '\n';
+
+    if (header.allocated) {
+        memfree(const_cast<uint8_t*>(data));
+    }
+}
+
+// Counts of suppressed messages are reported at most this often per call site
+static const int64_t REPORT_INTERVAL_MS = 1000;
+
+// Call sites which suppressed messages at least once
+static std::atomic<CallSite*> g_call_sites;
+
+static int64_t get_time_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Contention only happens when several threads log from the same call site
+static inline void lock_call_site(CallSite &p_site) {
+    while (p_site.locked.exchange(true, std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+}
+
+static inline void unlock_call_site(CallSite &p_site) {
+    p_site.locked.store(false, std::memory_order_release);
+}
+
+static void append_call_site_counts(String &dst, int64_t p_timestamp, const CallSite &p_site,
+        uint32_t p_repeat_count, uint32_t p_dropped_count) {
+
+    if (p_repeat_count != 0) {
+        append_prefix(dst, p_timestamp, p_site.level);
+        dst.append_format(FMT("%:%: last message repeated % times\n"),
+            p_site.file, p_site.line, static_cast<int64_t>(p_repeat_count));
+    }
+    if (p_dropped_count != 0) {
+        append_prefix(dst, p_timestamp, p_site.level);
+        dst.append_format(FMT("%:%: % messages dropped\n"),
+            p_site.file, p_site.line, static_cast<int64_t>(p_dropped_count));
+    }
+}
+
+// Reports counts of call sites that didn't log for a while, or all counts if forced
+static void append_quiet_call_sites(String &dst, int64_t p_timestamp, bool p_force) {
+    int64_t now = get_time_ms();
+
+    for (CallSite *site = g_call_sites.load(std::memory_order_acquire); site != nullptr; site = site->next) {
+        lock_call_site(*site);
+
+        uint32_t repeat_count = 0;
+        uint32_t dropped_count = 0;
+
+        // Counts are taken once the call site had a chance to report them itself
+        if (p_force || now - site->last_shown_time >= REPORT_INTERVAL_MS) {
+            repeat_count = site->repeat_count;
+            site->repeat_count = 0;
+        }
+        if (p_force || now - site->window_start_time >= REPORT_INTERVAL_MS) {
+            dropped_count = site->dropped_count;
+            site->dropped_count = 0;
+        }
+
+        // Formatted before unlocking, the location is written by producers
+        append_call_site_counts(dst, p_timestamp, *site, repeat_count, dropped_count);
+
+        unlock_call_site(*site);
+    }
+}
+
+static void write_output(const String &p_batch) {
+    fwrite(p_batch.c_str(), 1, p_batch.length(), stdout);
+    fflush(stdout);
+}
+
+static inline bool is_slot_full(const Slot &slot, size_t pos) {
+    return slot.sequence.load(std::memory_order_acquire) == 2 * (pos / SLOT_COUNT) + 1;
+}
+
+static inline int64_t get_timestamp(const Worker *worker) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - worker->start_time).count();
+}
+
+static void worker_loop(Worker *worker) {
+
+    // Reused, so the worker doesn't allocate once it reached its largest batch
+    String batch;
+    batch.reserve(BATCH_SIZE + SLOT_SIZE);
+
+    size_t tail = g_tail.load(std::memory_order_relaxed);
+
+    while (true) {
+        // Drains the queue, writing whenever a batch is full
+        while (is_slot_full(g_slots[tail % SLOT_COUNT], tail)) {
+            Slot &slot = g_slots[tail % SLOT_COUNT];
+            decode_record(batch, slot.header, slot.data);
+            slot.sequence.store(2 * (tail / SLOT_COUNT) + 2, std::memory_order_release);
+            ++tail;
+            g_tail.store(tail, std::memory_order_release);
+
+            if (batch.length() >= BATCH_SIZE) {
+                write_output(batch);
+                batch.clear();
+                g_written.store(tail, std::memory_order_release);
+            }
+        }
+
+        append_quiet_call_sites(batch, get_timestamp(worker), false);
+
+        if (batch.length() != 0) {
+            write_output(batch);
+            batch.clear();
+            g_written.store(tail, std::memory_order_release);
+        }
+
+        std::unique_lock<std::mutex> lock(worker->mutex);
+        if (worker->stop_requested) {
+            break;
+        }
+        worker->sleeping.store(true, std::memory_order_relaxed);
+        // Producers only wake the worker once the queue fills up, so it also wakes up periodically
+        if (!is_slot_full(g_slots[tail % SLOT_COUNT], tail)) {
+            worker->condition.wait_for(lock, std::chrono::milliseconds(WRITE_INTERVAL_MS));
+        }
+        worker->sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+static Worker *start_worker() {
+    std::lock_guard<std::mutex> lock(g_worker_mutex);
+    Worker *worker = g_worker.load(std::memory_order_relaxed);
+    if (worker == nullptr) {
+        worker = new Worker();
+        worker->thread = std::thread(worker_loop, worker);
+        g_worker.store(worker, std::memory_order_release);
+    }
+    return worker;
+}
+
+static inline void wake_worker(Worker *worker) {
+    if (worker->sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->condition.notify_one();
+    }
+}
+
+// Formats and writes the record on the calling thread, once the worker is stopped
+static void write_sync(const RecordHeader &header, const uint8_t *data) {
+    String line;
+    decode_record(line, header, data);
+    std::lock_guard<std::mutex> lock(g_sync_output_mutex);
+    write_output(line);
+}
+
+// For allocated records, the data is the pointer and the size is the one of the allocated block
+static void push_record(Level p_level, const uint8_t *p_data, size_t p_data_size, size_t p_size, bool p_allocated) {
+
+    Worker *worker = g_worker.load(std::memory_order_acquire);
+    if (worker == nullptr) {
+        worker = start_worker();
+    }
+
+    RecordHeader header;
+    header.timestamp = get_timestamp(worker);
+    assert(p_size <= UINT32_MAX);
+    header.size = static_cast<uint32_t>(p_size);
+    header.level = static_cast<uint8_t>(p_level);
+    header.allocated = p_allocated;
+
+    if (g_stopped.load(std::memory_order_acquire)) {
+        write_sync(header, p_data);
+        return;
+    }
+
+    size_t pos = g_head.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    while (true) {
+        slot = &g_slots[pos % SLOT_COUNT];
+        size_t lap = pos / SLOT_COUNT;
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+        if (sequence == 2 * lap) {
+            if (g_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+
+        } else if (sequence < 2 * lap) {
+            // Full, the worker hasn't consumed that slot from the previous lap
+            wake_worker(worker);
+            std::this_thread::yield();
+            pos = g_head.load(std::memory_order_relaxed);
+
+        } else {
+            // Another producer took the slot
+            pos = g_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->header = header;
+    memcpy(slot->data, p_data, p_data_size);
+    slot->sequence.store(2 * (pos / SLOT_COUNT) + 1, std::memory_order_release);
+
+    if (pos - g_tail.load(std::memory_order_relaxed) >= WAKE_THRESHOLD) {
+        wake_worker(worker);
+    }
+}
+
+void _push(Level p_level, const uint8_t *p_data, size_t p_size) {
+    push_record(p_level, p_data, p_size, p_size, false);
+}
+
+void _push_allocated(Level p_level, uint8_t *p_data, size_t p_size) {
+    // The slot only holds the pointer
+    uint8_t data[sizeof(uint8_t*)];
+    memcpy(data, &p_data, sizeof(uint8_t*));
+    push_record(p_level, data, sizeof(data), p_size, true);
+}
+
+std::atomic<int> _runtime_level;
+
+void set_level(Level p_level) {
+    _runtime_level.store(p_level, std::memory_order_relaxed);
+}
+
+Level get_level() {
+    return static_cast<Level>(_runtime_level.load(std::memory_order_relaxed));
+}
+
+bool _filter(CallSite &p_site, const char *p_file, int p_line, Level p_level, const uint8_t *p_data, size_t p_size) {
+    uint64_t hash = Hash::combine(Hash::hash_bytes(p_data, p_size), p_level);
+    int64_t now = get_time_ms();
+
+    uint32_t repeat_count = 0;
+    uint32_t dropped_count = 0;
+    bool accepted = false;
+
+    lock_call_site(p_site);
+
+    p_site.file = p_file;
+    p_site.line = p_line;
+    p_site.level = p_level;
+
+    if (p_site.has_last && hash == p_site.last_hash && now - p_site.last_shown_time < REPORT_INTERVAL_MS) {
+        ++p_site.repeat_count;
+
+    } else {
+        // A repeated message is shown again every interval, after the count of its repeats
+        repeat_count = p_site.repeat_count;
+        p_site.repeat_count = 0;
+
+        if (now - p_site.window_start_time >= REPORT_INTERVAL_MS) {
+            dropped_count = p_site.dropped_count;
+            p_site.dropped_count = 0;
+            p_site.window_start_time = now;
+            p_site.window_count = 0;
+        }
+
+        if (p_site.window_count < CallSite::MAX_MESSAGES_PER_SECOND) {
+            ++p_site.window_count;
+            p_site.has_last = true;
+            p_site.last_hash = hash;
+            p_site.last_shown_time = now;
+            accepted = true;
+        } else {
+            // Not remembered, repeats of a dropped message are dropped too
+            ++p_site.dropped_count;
+            p_site.has_last = false;
+        }
+    }
+
+    if (!accepted && !p_site.registered) {
+        p_site.registered = true;
+        CallSite *head = g_call_sites.load(std::memory_order_relaxed);
+        do {
+            p_site.next = head;
+        } while (!g_call_sites.compare_exchange_weak(head, &p_site, std::memory_order_release));
+    }
+
+    unlock_call_site(p_site);
+
+    if (repeat_count != 0) {
+        _write(nullptr, nullptr, 0, p_level,
+            FMT("%:%: last message repeated % times"), p_file, p_line, static_cast<int64_t>(repeat_count));
+    }
+    if (dropped_count != 0) {
+        _write(nullptr, nullptr, 0, p_level,
+            FMT("%:%: % messages dropped"), p_file, p_line, static_cast<int64_t>(dropped_count));
+    }
+
+    return accepted;
+}
+
+void flush() {
+    Worker *worker = g_worker.load(std::memory_order_acquire);
+    if (worker == nullptr) {
+        return;
+    }
+
+    size_t head = g_head.load(std::memory_order_acquire);
+
+    while (g_written.load(std::memory_order_acquire) < head) {
+        wake_worker(worker);
+        std::this_thread::yield();
+    }
+}
+
+// Stops the worker after writing pending messages, when static objects are destroyed.
+// It has no constructor, so it is destroyed after objects that are constructed dynamically.
+static struct Shutdown {
+    ~Shutdown() {
+        Worker *worker = g_worker.load(std::memory_order_acquire);
+        if (worker == nullptr) {
+            return;
+        }
+
+        flush();
+        g_stopped.store(true, std::memory_order_release);
+
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->stop_requested = true;
+            worker->condition.notify_one();
+        }
+        worker->thread.join();
+
+        // Messages queued by other threads meanwhile
+        size_t tail = g_tail.load(std::memory_order_acquire);
+        while (is_slot_full(g_slots[tail % SLOT_COUNT], tail)) {
+            Slot &slot = g_slots[tail % SLOT_COUNT];
+            write_sync(slot.header, slot.data);
+            slot.sequence.store(2 * (tail / SLOT_COUNT) + 2, std::memory_order_release);
+            ++tail;
+        }
+        g_tail.store(tail, std::memory_order_release);
+        g_written.store(tail, std::memory_order_release);
+
+        String counts;
+        append_quiet_call_sites(counts, get_timestamp(worker), true);
+        if (counts.length() != 0) {
+            write_output(counts);
+        }
+    }
+} g_shutdown;
+
+} // namespace Log
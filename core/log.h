@@ -1,39 +1,281 @@
 #ifndef HEADER_LOG_H
 #define HEADER_LOG_H
 
+#include "arena.h"
 #include "console.h"
+#include <atomic>
 
+// Messages below this level are compiled out by the LOG_* macros, including their arguments.
+// Set with the `log_level` SCons option, defaults to debug in debug builds and info otherwise.
+#ifndef LOG_MIN_LEVEL
+#ifdef DEBUG
+#define LOG_MIN_LEVEL 0
+#else
+#define LOG_MIN_LEVEL 1
+#endif
+#endif
+
+// Messages are copied into compact records, then formatted and written in batches by a background thread,
+// so logging doesn't wait for formatting or output.
+// Numbers and strings are copied as raw values, strings don't need to outlive the call.
+// Other types are converted with `to_string` on the calling thread.
+// A format parsed with FMT can be given first, its placeholders are replaced by the next arguments:
+//
+//     LOG_INFO(FMT("Created % buffers in % ms"), count, ms);
+//
+// The LOG_* macros should be preferred over the functions, they are filtered before arguments are evaluated,
+// and repeated or too frequent messages from the same call site are suppressed and counted.
 namespace Log {
 
-extern const Char *DEBUG_PREFIX;
-extern const Char *INFO_PREFIX;
-extern const Char *WARNING_PREFIX;
-extern const Char *ERROR_PREFIX;
+extern const char *DEBUG_PREFIX;
+extern const char *INFO_PREFIX;
+extern const char *WARNING_PREFIX;
+extern const char *ERROR_PREFIX;
+
+enum Level {
+    LEVEL_DEBUG = 0,
+    LEVEL_INFO,
+    LEVEL_WARNING,
+    LEVEL_ERROR
+};
+
+static_assert(LOG_MIN_LEVEL >= LEVEL_DEBUG && LOG_MIN_LEVEL <= LEVEL_ERROR, "Invalid LOG_MIN_LEVEL");
+
+// Messages below this level are skipped at runtime. Levels compiled out can't be enabled again.
+void set_level(Level p_level);
+Level get_level();
+
+extern std::atomic<int> _runtime_level;
+
+inline bool is_enabled(Level p_level) {
+    return p_level >= LOG_MIN_LEVEL && p_level >= _runtime_level.load(std::memory_order_relaxed);
+}
+
+// State of a LOG_* macro call site, zero-initialized.
+// Identical consecutive messages are only counted, and shown again with their count once a second.
+// Beyond MAX_MESSAGES_PER_SECOND, other messages are dropped and counted.
+// Counts are reported with the next message shown from the same call site,
+// or by the logging thread once the call site stayed quiet for a second.
+struct CallSite {
+    static const uint32_t MAX_MESSAGES_PER_SECOND = 20;
+
+    std::atomic<bool> locked;
+    // Linked once the call site suppressed a message, so quiet call sites can be reported
+    bool registered;
+    CallSite *next;
+    const char *file;
+    int line;
+    Level level;
+    bool has_last;
+    uint64_t last_hash;
+    int64_t last_shown_time;
+    uint32_t repeat_count;
+    int64_t window_start_time;
+    uint32_t window_count;
+    uint32_t dropped_count;
+};
+
+// Arguments that fit in this size are queued without allocating
+static const size_t MAX_RECORD_SIZE = 224;
+
+// Encodes arguments of a message. Past the capacity, only the required size is counted.
+class RecordWriter {
+public:
+    enum ArgumentType {
+        ARG_INT = 0,
+        ARG_UINT,
+        ARG_FLOAT,
+        ARG_DOUBLE,
+        ARG_CHAR,
+        // Zero-terminated copy
+        ARG_STRING,
+        ARG_POINTER,
+        // Static format string, whose placeholders are the next arguments
+        ARG_FORMAT
+    };
+
+    RecordWriter(uint8_t *p_buffer, size_t p_capacity): _buffer(p_buffer), _capacity(p_capacity), _size(0) {}
+
+    inline void write_int(int64_t v) { write_value(ARG_INT, v); }
+    inline void write_uint(uint64_t v) { write_value(ARG_UINT, v); }
+    inline void write_float(float v) { write_value(ARG_FLOAT, v); }
+    inline void write_double(double v) { write_value(ARG_DOUBLE, v); }
+    inline void write_char(char v) { write_value(ARG_CHAR, v); }
+    inline void write_pointer(const void *v) { write_value(ARG_POINTER, v); }
+    inline void write_format(const char *v) { write_value(ARG_FORMAT, v); }
+
+    // Strings longer than 4 GiB are truncated
+    void write_string(const char *p_cstr, size_t p_len) {
+        uint32_t len = p_len > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(p_len);
+        write_value(ARG_STRING, len);
+        write_bytes(p_cstr, len);
+        write_bytes("", 1);
+    }
+
+    inline size_t get_size() const { return _size; }
+    inline bool has_overflowed() const { return _size > _capacity; }
+
+private:
+    template <typename T>
+    inline void write_value(ArgumentType p_type, const T &v) {
+        uint8_t type = static_cast<uint8_t>(p_type);
+        write_bytes(&type, 1);
+        write_bytes(&v, sizeof(T));
+    }
+
+    inline void write_bytes(const void *p_src, size_t p_size) {
+        // Without an addition that could overflow, so the compiler can prove the copy is in bounds
+        if (_size <= _capacity && p_size <= _capacity - _size) {
+            memcpy(_buffer + _size, p_src, p_size);
+        }
+        _size += p_size;
+    }
+
+    uint8_t *_buffer;
+    size_t _capacity;
+    size_t _size;
+};
+
+// Types without an overload are converted to a string now
+template <typename T>
+inline void encode_argument(RecordWriter &w, const T &v) {
+    String s;
+    to_string(s, v);
+    w.write_string(s.c_str(), s.length());
+}
+
+// Integers are overloaded by fundamental type, since fixed-size types alias different ones depending on the platform
+inline void encode_argument(RecordWriter &w, bool v) { w.write_int(v); }
+inline void encode_argument(RecordWriter &w, signed char v) { w.write_int(v); }
+inline void encode_argument(RecordWriter &w, short v) { w.write_int(v); }
+inline void encode_argument(RecordWriter &w, int v) { w.write_int(v); }
+inline void encode_argument(RecordWriter &w, long v) { w.write_int(v); }
+inline void encode_argument(RecordWriter &w, long long v) { w.write_int(v); }
+inline void encode_argument(RecordWriter &w, unsigned char v) { w.write_uint(v); }
+inline void encode_argument(RecordWriter &w, unsigned short v) { w.write_uint(v); }
+inline void encode_argument(RecordWriter &w, unsigned int v) { w.write_uint(v); }
+inline void encode_argument(RecordWriter &w, unsigned long v) { w.write_uint(v); }
+inline void encode_argument(RecordWriter &w, unsigned long long v) { w.write_uint(v); }
+inline void encode_argument(RecordWriter &w, float v) { w.write_float(v); }
+inline void encode_argument(RecordWriter &w, double v) { w.write_double(v); }
+inline void encode_argument(RecordWriter &w, char v) { w.write_char(v); }
+inline void encode_argument(RecordWriter &w, void *v) { w.write_pointer(v); }
+inline void encode_argument(RecordWriter &w, const void *v) { w.write_pointer(v); }
+inline void encode_argument(RecordWriter &w, const char *v) { w.write_string(v, String::get_length(v)); }
+inline void encode_argument(RecordWriter &w, char *v) { w.write_string(v, String::get_length(v)); }
+inline void encode_argument(RecordWriter &w, const String &v) { w.write_string(v.c_str(), v.length()); }
+
+template <typename F>
+inline void encode_argument(RecordWriter &w, FormatLiteral<F>) {
+    w.write_format(F::get());
+}
+
+inline void _encode(RecordWriter &) {}
+
+template <typename A, typename... Args>
+inline void _encode(RecordWriter &w, const A &arg, const Args &... args) {
+    encode_argument(w, arg);
+    _encode(w, args...);
+}
+
+// Returns false if the message must be suppressed. May write a summary of suppressed messages first.
+bool _filter(CallSite &p_site, const char *p_file, int p_line, Level p_level, const uint8_t *p_data, size_t p_size);
+
+// Queues a record. Thread-safe and lock-free, unless the queue is full.
+void _push(Level p_level, const uint8_t *p_data, size_t p_size);
+// Queues a record whose data was allocated with memalloc, and will be freed once written
+void _push_allocated(Level p_level, uint8_t *p_data, size_t p_size);
+
+// The call site is optional
+template <typename ...Args>
+void _write(CallSite *p_site, const char *p_file, int p_line, Level p_level, const Args&... args) {
+    uint8_t buffer[MAX_RECORD_SIZE];
+    RecordWriter w(buffer, sizeof(buffer));
+    _encode(w, args...);
+
+    if (!w.has_overflowed()) {
+        if (p_site == nullptr || _filter(*p_site, p_file, p_line, p_level, buffer, w.get_size())) {
+            _push(p_level, buffer, w.get_size());
+        }
+        return;
+    }
+
+    // Too large, encoded again in a block of the right size.
+    // It is freed by the worker later, so it can't come from an arena the caller may be using.
+    size_t size = w.get_size();
+    uint8_t *data;
+    {
+        ArenaScope heap_scope(nullptr);
+        data = static_cast<uint8_t*>(memalloc(size));
+    }
+    RecordWriter w2(data, size);
+    _encode(w2, args...);
+    if (p_site == nullptr || _filter(*p_site, p_file, p_line, p_level, data, size)) {
+        _push_allocated(p_level, data, size);
+    } else {
+        memfree(data);
+    }
+}
+
+// Filtered at runtime, but not rate-limited
+template <typename ...Args>
+inline void write(Level p_level, const Args&... args) {
+    if (is_enabled(p_level)) {
+        _write(nullptr, nullptr, 0, p_level, args...);
+    }
+}
+
+// Waits until all messages queued so far are written
+void flush();
 
 template <typename ...Args>
 inline void debug(const Args&... args) {
-    Console::_print_raw(DEBUG_PREFIX);
-    Console::print_line(args...);
+    write(LEVEL_DEBUG, args...);
 }
 
 template <typename ...Args>
 inline void info(const Args&... args) {
-    Console::_print_raw(INFO_PREFIX);
-    Console::print_line(args...);
+    write(LEVEL_INFO, args...);
 }
 
 template <typename ...Args>
 inline void warning(const Args&... args) {
-    Console::_print_raw(WARNING_PREFIX);
-    Console::print_line(args...);
+    write(LEVEL_WARNING, args...);
 }
 
 template <typename ...Args>
 inline void error(const Args&... args) {
-    Console::_print_raw(ERROR_PREFIX);
-    Console::print_line(args...);
+    write(LEVEL_ERROR, args...);
 }
 
 } // namespace Log
 
+#define LOG_AT_LEVEL(p_level, ...) \
+    do { \
+        if (Log::is_enabled(p_level)) { \
+            static Log::CallSite s_log_call_site; \
+            Log::_write(&s_log_call_site, __FILE__, __LINE__, p_level, __VA_ARGS__); \
+        } \
+    } while (false)
+
+#if LOG_MIN_LEVEL <= 0
+#define LOG_DEBUG(...) LOG_AT_LEVEL(Log::LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (false)
+#endif
+
+#if LOG_MIN_LEVEL <= 1
+#define LOG_INFO(...) LOG_AT_LEVEL(Log::LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (false)
+#endif
+
+#if LOG_MIN_LEVEL <= 2
+#define LOG_WARNING(...) LOG_AT_LEVEL(Log::LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(...) do {} while (false)
+#endif
+
+#define LOG_ERROR(...) LOG_AT_LEVEL(Log::LEVEL_ERROR, __VA_ARGS__)
+
 #endif // HEADER_LOG_H
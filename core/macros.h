@@ -5,7 +5,7 @@
 
 #define ERR_FAIL_COND_V(cond, v) \
 if(cond) { \
-    Log::error(__FILE__, ": ", __LINE__, ": `", #cond, "` is false"); \
+    LOG_ERROR(__FILE__, ": ", __LINE__, ": `", #cond, "` is false"); \
     return v; \
 }
 
@@ -13,7 +13,7 @@ if(cond) { \
 { \
     VkResult result = f; \
     if (result != VK_SUCCESS) { \
-        Log::error(__FILE__, ": ", __LINE__, ": `", #f, "`: failed with result ", result); \
+        LOG_ERROR(__FILE__, ": ", __LINE__, ": `", #f, "`: failed with result ", result); \
         return v; \
     } \
 }
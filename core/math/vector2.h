@@ -38,11 +38,15 @@ inline bool operator!=(Vector2i a, Vector2i b) {
 }
 
 inline void to_string(String &dst, Vector2i v) {
-    to_string(dst, L'(');
+    to_string(dst, '(');
     to_string(dst, v.x);
-    to_string(dst, L', ');
+    to_string(dst, ", ");
     to_string(dst, v.y);
-    to_string(dst, L')');
+    to_string(dst, ')');
+}
+
+inline size_t format_size_hint(Vector2i v) {
+    return 4 + format_size_hint(v.x) + format_size_hint(v.y);
 }
 
 #endif // HEADER_VECTOR2_H
@@ -1,39 +1,713 @@
 #include "memory.h"
-//#include <cstdio> // For debug printf
+#include "arena.h"
+#include "log.h"
+#include "macros.h"
+#include "trace.h"
 #include <atomic>
+#include <mutex>
 
 namespace Memory {
 
-std::atomic<size_t> g_alloc_count = 0;
+// Statistics are kept per thread, and only summed when they are queried.
+// Each thread only writes its own counters, so they are updated with plain loads and stores,
+// without atomic read-modify-writes or cache lines shared between threads.
+// They are still atomics, so other threads can read them.
+struct Counter {
+    std::atomic<uint64_t> value;
+
+    inline void add(uint64_t v) {
+        value.store(value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    inline uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+struct Counters {
+    Counter alloc_count;
+    Counter free_count;
+    // Wraps around when the thread frees more than it allocated, which is fine once summed
+    Counter live_bytes;
+    // Highest live bytes seen by the thread
+    Counter peak_bytes;
+
+    inline void add(size_t size) {
+        alloc_count.add(1);
+        live_bytes.add(size);
+        int64_t live = static_cast<int64_t>(live_bytes.get());
+        if (live > static_cast<int64_t>(peak_bytes.get())) {
+            peak_bytes.value.store(live, std::memory_order_relaxed);
+        }
+    }
+
+    inline void remove(size_t size) {
+        free_count.add(1);
+        live_bytes.add(-static_cast<uint64_t>(size));
+    }
+};
+
+struct CallSite {
+    // Null when the slot is free. Published last, so `line` is valid when it is set.
+    std::atomic<const char*> file;
+    int line;
+};
+
+// Open-addressing table of call sites, keyed by file pointer and line.
+// Lookups don't lock, insertions are rare and take a mutex.
+// The last one is used when the table is full.
+static const size_t MAX_CALL_SITES = 4096;
+static const size_t OVERFLOW_CALL_SITE = MAX_CALL_SITES;
+static CallSite g_call_sites[MAX_CALL_SITES + 1];
+static std::mutex g_call_sites_mutex;
+
+// Counters of a thread are allocated in pages of call sites, when first needed
+static const size_t CALL_SITES_PER_PAGE = 256;
+static const size_t CALL_SITE_PAGE_COUNT = (MAX_CALL_SITES + 1 + CALL_SITES_PER_PAGE - 1) / CALL_SITES_PER_PAGE;
+
+// Live bytes are also flushed to a global counter when a thread's balance changed by this much,
+// or when an allocation may raise the global peak, which is how the peak is tracked
+static const int64_t FLUSH_THRESHOLD = 16 * 1024;
+
+struct ThreadStats {
+    std::atomic<Counters*> pages[CALL_SITE_PAGE_COUNT];
+    Counters total;
+    // Live bytes not flushed yet, only used by the owner thread
+    int64_t unflushed_bytes;
+    // Set when the thread exited, so a new thread can take over the counters
+    std::atomic<bool> retired;
+    ThreadStats *next;
+};
+
+// Never freed, counters of exited threads are still needed
+static std::atomic<ThreadStats*> g_thread_stats;
+static std::mutex g_thread_stats_mutex;
+// Used by threads after their thread-local destructors ran, protected by a mutex
+static ThreadStats g_exited_thread_stats;
+static bool g_exited_thread_stats_registered;
+static std::mutex g_exited_thread_stats_mutex;
+
+static std::atomic<int64_t> g_flushed_live_bytes;
+static std::atomic<int64_t> g_peak_bytes;
+
+// Blocks up to this size, header included, are cached per thread by size class
+static const size_t SIZE_CLASS_GRANULARITY = 16;
+static const size_t MAX_SMALL_BLOCK_SIZE = 256;
+static const size_t SIZE_CLASS_COUNT = MAX_SMALL_BLOCK_SIZE / SIZE_CLASS_GRANULARITY;
+static const uint32_t MAX_CACHED_BLOCKS = 32;
+
+// Freed small blocks, linked through their first bytes
+struct ThreadCache {
+    void *free_lists[SIZE_CLASS_COUNT];
+    uint32_t counts[SIZE_CLASS_COUNT];
+};
+
+// Plain data, so accessing them doesn't go through thread-local initialization checks.
+// The cache is only used while `t_stats` is set.
+static thread_local ThreadStats *t_stats = nullptr;
+static thread_local ThreadCache t_cache;
+static thread_local bool t_thread_exited = false;
+static thread_local Arena *t_current_arena = nullptr;
+
+// Stored right before each block. Its size keeps the alignment malloc gives.
+// The owner is either a CallSite for heap blocks, or an Arena tagged with the lowest bit.
+struct Header {
+    uintptr_t owner;
+    size_t size;
+};
+
+static const uintptr_t ARENA_TAG = 1;
+
+static_assert(sizeof(Header) == 16 || sizeof(Header) == 8, "Header should not change block alignment");
+
+static inline bool is_arena_block(const Header *header) {
+    return (header->owner & ARENA_TAG) != 0;
+}
+
+static inline size_t get_owner_call_site_index(const Header *header) {
+    return reinterpret_cast<const CallSite*>(header->owner) - g_call_sites;
+}
+
+static inline Arena *get_arena(const Header *header) {
+    return reinterpret_cast<Arena*>(header->owner & ~ARENA_TAG);
+}
+
+static inline size_t get_call_site_index(const char *file, int line) {
+    uint64_t h = reinterpret_cast<uintptr_t>(file) * 0x9e3779b97f4a7c15ULL + static_cast<uint64_t>(line);
+    return static_cast<size_t>(h ^ (h >> 32)) & (MAX_CALL_SITES - 1);
+}
+
+static CallSite *get_call_site(const char *file, int line) {
+
+    size_t i = get_call_site_index(file, line);
+
+    for (size_t probe = 0; probe < MAX_CALL_SITES; ++probe) {
+        CallSite &site = g_call_sites[i];
+        const char *site_file = site.file.load(std::memory_order_acquire);
+
+        if (site_file == file && site.line == line) {
+            return &site;
+        }
+
+        if (site_file == nullptr) {
+            std::lock_guard<std::mutex> lock(g_call_sites_mutex);
+            // Another thread may have taken the slot meanwhile
+            site_file = site.file.load(std::memory_order_relaxed);
+            if (site_file == nullptr) {
+                site.line = line;
+                site.file.store(file, std::memory_order_release);
+                return &site;
+            }
+            if (site_file == file && site.line == line) {
+                return &site;
+            }
+        }
+
+        i = (i + 1) & (MAX_CALL_SITES - 1);
+    }
+
+    CallSite &overflow = g_call_sites[OVERFLOW_CALL_SITE];
+    if (overflow.file.load(std::memory_order_relaxed) == nullptr) {
+        overflow.file = "<other call sites>";
+    }
+    return &overflow;
+}
+
+// Thread stats
+
+static void flush_live_bytes(ThreadStats &stats) {
+    int64_t live = g_flushed_live_bytes.fetch_add(stats.unflushed_bytes, std::memory_order_relaxed) + stats.unflushed_bytes;
+    stats.unflushed_bytes = 0;
+    int64_t peak = g_peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !g_peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+static Counters &get_counters(ThreadStats &stats, size_t site_index) {
+    std::atomic<Counters*> &page_ref = stats.pages[site_index / CALL_SITES_PER_PAGE];
+    Counters *page = page_ref.load(std::memory_order_relaxed);
+    if (page == nullptr) {
+        // Not tracked, the statistics would have to count themselves
+        page = static_cast<Counters*>(::calloc(CALL_SITES_PER_PAGE, sizeof(Counters)));
+        page_ref.store(page, std::memory_order_release);
+    }
+    return page[site_index % CALL_SITES_PER_PAGE];
+}
+
+static inline void count_alloc(ThreadStats &stats, size_t site_index, size_t size) {
+    get_counters(stats, site_index).add(size);
+    stats.total.add(size);
+    stats.unflushed_bytes += size;
+    // Also flushed when it may raise the peak, so only balances of other threads can make it inexact
+    if (stats.unflushed_bytes >= FLUSH_THRESHOLD
+            || g_flushed_live_bytes.load(std::memory_order_relaxed) + stats.unflushed_bytes > g_peak_bytes.load(std::memory_order_relaxed)) {
+        flush_live_bytes(stats);
+    }
+}
+
+static inline void count_free(ThreadStats &stats, size_t site_index, size_t size) {
+    get_counters(stats, site_index).remove(size);
+    stats.total.remove(size);
+    stats.unflushed_bytes -= size;
+    if (stats.unflushed_bytes <= -FLUSH_THRESHOLD) {
+        flush_live_bytes(stats);
+    }
+}
+
+static void free_cached_blocks() {
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+        void *block = t_cache.free_lists[i];
+        while (block != nullptr) {
+            void *next = *static_cast<void**>(block);
+            ::free(block);
+            block = next;
+        }
+        t_cache.free_lists[i] = nullptr;
+        t_cache.counts[i] = 0;
+    }
+}
+
+// Releases the cache and the counters of a thread when it exits
+struct ThreadExitHandler {
+    ThreadStats *stats = nullptr;
+
+    ~ThreadExitHandler() {
+        t_stats = nullptr;
+        t_thread_exited = true;
+        free_cached_blocks();
+        if (stats != nullptr) {
+            flush_live_bytes(*stats);
+            stats->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local ThreadExitHandler t_exit_handler;
+
+static ThreadStats *register_thread() {
+
+    std::lock_guard<std::mutex> lock(g_thread_stats_mutex);
+
+    ThreadStats *stats = nullptr;
+
+    // Counters of exited threads are reused, so threads created often don't add up
+    for (ThreadStats *s = g_thread_stats.load(std::memory_order_relaxed); s != nullptr; s = s->next) {
+        bool retired = true;
+        if (s->retired.compare_exchange_strong(retired, false, std::memory_order_acquire)) {
+            stats = s;
+            break;
+        }
+    }
+
+    if (stats == nullptr) {
+        stats = static_cast<ThreadStats*>(::calloc(1, sizeof(ThreadStats)));
+        stats->next = g_thread_stats.load(std::memory_order_relaxed);
+        g_thread_stats.store(stats, std::memory_order_release);
+    }
+
+    // Constructs the handler, so it runs when the thread exits
+    t_exit_handler.stats = stats;
+    t_stats = stats;
+    return stats;
+}
+
+static void count_slow(size_t site_index, size_t size, bool is_alloc) {
+    if (t_thread_exited) {
+        std::lock_guard<std::mutex> lock(g_exited_thread_stats_mutex);
+        if (!g_exited_thread_stats_registered) {
+            std::lock_guard<std::mutex> lock2(g_thread_stats_mutex);
+            g_exited_thread_stats.next = g_thread_stats.load(std::memory_order_relaxed);
+            g_thread_stats.store(&g_exited_thread_stats, std::memory_order_release);
+            g_exited_thread_stats_registered = true;
+        }
+        if (is_alloc) {
+            count_alloc(g_exited_thread_stats, site_index, size);
+        } else {
+            count_free(g_exited_thread_stats, site_index, size);
+        }
+        return;
+    }
+
+    ThreadStats *stats = register_thread();
+    if (is_alloc) {
+        count_alloc(*stats, site_index, size);
+    } else {
+        count_free(*stats, site_index, size);
+    }
+}
+
+// Frame auditing
+
+static const size_t MAX_FRAME_CALL_SITES = 32;
+
+struct FrameAllocation {
+    const char *file;
+    int line;
+    uint64_t count;
+    uint64_t bytes;
+};
+
+// Only read on the allocation path, so it doesn't bounce between threads
+static std::atomic<bool> g_frame_active;
+static std::mutex g_frame_mutex;
+static FrameAllocation g_frame_allocations[MAX_FRAME_CALL_SITES];
+static size_t g_frame_allocation_site_count;
+static uint64_t g_frame_allocation_count;
+static uint64_t g_frame_index;
+
+// Allocations are not expected in audited frames, so this doesn't need to be fast
+static void record_frame_allocation(size_t nbytes, const char *file, int line) {
+    std::lock_guard<std::mutex> lock(g_frame_mutex);
+    if (!g_frame_active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    ++g_frame_allocation_count;
+
+    for (size_t i = 0; i < g_frame_allocation_site_count; ++i) {
+        FrameAllocation &a = g_frame_allocations[i];
+        if (a.file == file && a.line == line) {
+            ++a.count;
+            a.bytes += nbytes;
+            return;
+        }
+    }
+
+    // Further call sites are only counted in the total
+    if (g_frame_allocation_site_count < MAX_FRAME_CALL_SITES) {
+        FrameAllocation &a = g_frame_allocations[g_frame_allocation_site_count++];
+        a.file = file;
+        a.line = line;
+        a.count = 1;
+        a.bytes = nbytes;
+    }
+}
+
+// Heap blocks
+
+// Small blocks are allocated with the size of their class, so they can be reused for any size in it
+static inline size_t get_block_size(size_t nbytes) {
+    size_t size = sizeof(Header) + nbytes;
+    if (size <= MAX_SMALL_BLOCK_SIZE) {
+        size = (size + SIZE_CLASS_GRANULARITY - 1) & ~(SIZE_CLASS_GRANULARITY - 1);
+    }
+    return size;
+}
+
+static inline size_t get_size_class(size_t block_size) {
+    return block_size / SIZE_CLASS_GRANULARITY - 1;
+}
+
+static inline Header *get_header(const void *ptr) {
+    return reinterpret_cast<Header*>(const_cast<void*>(ptr)) - 1;
+}
+
+// Payloads are the size and the address of the block
+static Trace::Event s_alloc_event("alloc");
+static Trace::Event s_free_event("free");
+
+static inline void *track(Header *header, size_t nbytes, const char *file, int line) {
+    CallSite *call_site = get_call_site(file, line);
+    header->owner = reinterpret_cast<uintptr_t>(call_site);
+    header->size = nbytes;
+
+    size_t site_index = call_site - g_call_sites;
+    ThreadStats *stats = t_stats;
+    if (stats != nullptr) {
+        count_alloc(*stats, site_index, nbytes);
+    } else {
+        count_slow(site_index, nbytes, true);
+    }
+
+    if (g_frame_active.load(std::memory_order_relaxed)) {
+        record_frame_allocation(nbytes, file, line);
+    }
+
+    Trace::instant(s_alloc_event, nbytes, reinterpret_cast<uintptr_t>(header + 1));
+
+    return header + 1;
+}
+
+static inline void untrack(const Header *header) {
+    Trace::instant(s_free_event, header->size, reinterpret_cast<uintptr_t>(header + 1));
+
+    // Attributed to where it was allocated, which is not necessarily where it gets freed
+    size_t site_index = get_owner_call_site_index(header);
+    ThreadStats *stats = t_stats;
+    if (stats != nullptr) {
+        count_free(*stats, site_index, header->size);
+    } else {
+        count_slow(site_index, header->size, false);
+    }
+}
+
+static void *alloc_from_arena(Arena *arena, size_t nbytes) {
+    Header *header = static_cast<Header*>(arena->alloc(sizeof(Header) + nbytes));
+    ERR_FAIL_COND_V(header == nullptr, nullptr);
+    header->owner = reinterpret_cast<uintptr_t>(arena) | ARENA_TAG;
+    header->size = nbytes;
+    return header + 1;
+}
 
 void *alloc(size_t nbytes, const char *file, int line) {
 
-    //printf("Alloc at %s: %i\n", file, line);
-    ++g_alloc_count;
+    if (t_current_arena != nullptr) {
+        return alloc_from_arena(t_current_arena, nbytes);
+    }
+
+    size_t block_size = get_block_size(nbytes);
+    Header *header = nullptr;
+
+    if (block_size <= MAX_SMALL_BLOCK_SIZE && t_stats != nullptr) {
+        size_t size_class = get_size_class(block_size);
+        void *block = t_cache.free_lists[size_class];
+        if (block != nullptr) {
+            t_cache.free_lists[size_class] = *static_cast<void**>(block);
+            --t_cache.counts[size_class];
+            header = static_cast<Header*>(block);
+        }
+    }
+
+    if (header == nullptr) {
+        header = static_cast<Header*>(::malloc(block_size));
+        if (header == nullptr) {
+            return nullptr;
+        }
+    }
 
-    return ::malloc(nbytes);
+    return track(header, nbytes, file, line);
 }
 
 void *realloc(void *ptr, size_t nbytes, const char *file, int line) {
 
-    //printf("Realloc at %s: %i\n", file, line);
+    if (ptr == nullptr) {
+        return alloc(nbytes, file, line);
+    }
 
-    // TODO How do I get size of that damn pointer
-    return ::realloc(ptr, nbytes);
+    Header *old_header = get_header(ptr);
+
+    if (is_arena_block(old_header)) {
+        // Grown in place if it is the last allocation of its arena
+        Arena *arena = get_arena(old_header);
+        if (arena->resize_last(old_header, sizeof(Header) + old_header->size, sizeof(Header) + nbytes)) {
+            old_header->size = nbytes;
+            return ptr;
+        }
+
+        void *new_ptr = alloc(nbytes, file, line);
+        if (new_ptr != nullptr) {
+            memcpy(new_ptr, ptr, old_header->size < nbytes ? old_header->size : nbytes);
+        }
+        return new_ptr;
+    }
+
+    Header old = *old_header;
+    size_t block_size = get_block_size(nbytes);
+
+    Header *header = old_header;
+    // Small blocks already have the size of their class
+    if (block_size != get_block_size(old.size) || block_size > MAX_SMALL_BLOCK_SIZE) {
+        header = static_cast<Header*>(::realloc(old_header, block_size));
+        if (header == nullptr) {
+            // The original block is left untouched
+            return nullptr;
+        }
+    }
+
+    untrack(&old);
+    return track(header, nbytes, file, line);
+}
+
+void free(void *ptr) {
+
+    if (ptr == nullptr) {
+        return;
+    }
+
+    Header *header = get_header(ptr);
+    if (is_arena_block(header)) {
+        // Reclaimed when the arena is reset
+        return;
+    }
+
+    untrack(header);
+
+    size_t block_size = get_block_size(header->size);
+    if (block_size <= MAX_SMALL_BLOCK_SIZE && t_stats != nullptr) {
+        size_t size_class = get_size_class(block_size);
+        if (t_cache.counts[size_class] < MAX_CACHED_BLOCKS) {
+            *reinterpret_cast<void**>(header) = t_cache.free_lists[size_class];
+            t_cache.free_lists[size_class] = header;
+            ++t_cache.counts[size_class];
+            return;
+        }
+    }
+
+    ::free(header);
 }
 
-void free(void *ptr, const char *file, int line) {
+size_t get_size(const void *ptr) {
+    return ptr == nullptr ? 0 : get_header(ptr)->size;
+}
 
-    //printf("Free at %s: %i\n", file, line);
-    --g_alloc_count;
+Arena *get_current_arena() {
+    return t_current_arena;
+}
 
-    ::free(ptr);
+void set_current_arena(Arena *p_arena) {
+    t_current_arena = p_arena;
+}
+
+// Statistics
+
+static const Counters *get_counters_for_reading(const ThreadStats &stats, size_t site_index) {
+    const Counters *page = stats.pages[site_index / CALL_SITES_PER_PAGE].load(std::memory_order_acquire);
+    return page == nullptr ? nullptr : &page[site_index % CALL_SITES_PER_PAGE];
+}
+
+static void get_total_counts(uint64_t &out_alloc_count, uint64_t &out_free_count) {
+    ThreadStats *first = g_thread_stats.load(std::memory_order_acquire);
+    // Frees are read first, so there can't be more of them than allocations
+    out_free_count = 0;
+    for (const ThreadStats *s = first; s != nullptr; s = s->next) {
+        out_free_count += s->total.free_count.get();
+    }
+    out_alloc_count = 0;
+    for (const ThreadStats *s = first; s != nullptr; s = s->next) {
+        out_alloc_count += s->total.alloc_count.get();
+    }
 }
 
 size_t get_alloc_count() {
-    return g_alloc_count;
+    uint64_t alloc_count, free_count;
+    get_total_counts(alloc_count, free_count);
+    return static_cast<size_t>(alloc_count - free_count);
 }
 
-} // namespace Memory
+uint64_t get_live_bytes() {
+    uint64_t live_bytes = 0;
+    for (const ThreadStats *s = g_thread_stats.load(std::memory_order_acquire); s != nullptr; s = s->next) {
+        live_bytes += s->total.live_bytes.get();
+    }
+    return live_bytes;
+}
+
+uint64_t get_peak_bytes() {
+    int64_t peak = g_peak_bytes.load(std::memory_order_relaxed);
+    int64_t live = static_cast<int64_t>(get_live_bytes());
+    return static_cast<uint64_t>(live > peak ? live : peak);
+}
+
+uint64_t get_total_alloc_count() {
+    uint64_t alloc_count, free_count;
+    get_total_counts(alloc_count, free_count);
+    return alloc_count;
+}
+
+static void add_stats(size_t site_index, const char *file, CallSiteStats *io_stats, size_t &io_count, size_t p_max_count) {
+
+    uint64_t free_count = 0;
+    uint64_t alloc_count = 0;
+    uint64_t live_bytes = 0;
+    // Approximation, since peaks of each thread didn't necessarily happen at the same time
+    uint64_t peak_bytes = 0;
 
+    ThreadStats *first = g_thread_stats.load(std::memory_order_acquire);
+    for (const ThreadStats *s = first; s != nullptr; s = s->next) {
+        const Counters *counters = get_counters_for_reading(*s, site_index);
+        if (counters != nullptr) {
+            free_count += counters->free_count.get();
+        }
+    }
+    for (const ThreadStats *s = first; s != nullptr; s = s->next) {
+        const Counters *counters = get_counters_for_reading(*s, site_index);
+        if (counters != nullptr) {
+            alloc_count += counters->alloc_count.get();
+            live_bytes += counters->live_bytes.get();
+            peak_bytes += counters->peak_bytes.get();
+        }
+    }
+
+    int line = g_call_sites[site_index].line;
+
+    // The same header can be seen with a different `__FILE__` pointer in each translation unit
+    for (size_t i = 0; i < io_count; ++i) {
+        CallSiteStats &s = io_stats[i];
+        if (s.line == line && (s.file == file || strcmp(s.file, file) == 0)) {
+            s.alloc_count += alloc_count;
+            s.live_count += alloc_count - free_count;
+            s.live_bytes += live_bytes;
+            s.peak_bytes += peak_bytes;
+            return;
+        }
+    }
+
+    if (io_count < p_max_count) {
+        CallSiteStats &s = io_stats[io_count++];
+        s.file = file;
+        s.line = line;
+        s.alloc_count = alloc_count;
+        s.live_count = alloc_count - free_count;
+        s.live_bytes = live_bytes;
+        s.peak_bytes = peak_bytes;
+    }
+}
+
+size_t get_call_site_stats(CallSiteStats *out_stats, size_t p_max_count) {
+
+    size_t count = 0;
+
+    for (size_t i = 0; i <= OVERFLOW_CALL_SITE; ++i) {
+        const char *file = g_call_sites[i].file.load(std::memory_order_acquire);
+        if (file != nullptr) {
+            add_stats(i, file, out_stats, count, p_max_count);
+        }
+    }
+
+    return count;
+}
 
+void begin_frame() {
+    std::lock_guard<std::mutex> lock(g_frame_mutex);
+    g_frame_allocation_site_count = 0;
+    g_frame_allocation_count = 0;
+    g_frame_active.store(true, std::memory_order_relaxed);
+}
+
+size_t end_frame() {
+    // Logging may allocate, so the results are copied first
+    FrameAllocation allocations[MAX_FRAME_CALL_SITES];
+    size_t site_count;
+    uint64_t allocation_count;
+    uint64_t frame_index;
+    {
+        std::lock_guard<std::mutex> lock(g_frame_mutex);
+        if (!g_frame_active.load(std::memory_order_relaxed)) {
+            return 0;
+        }
+        g_frame_active.store(false, std::memory_order_relaxed);
+        site_count = g_frame_allocation_site_count;
+        allocation_count = g_frame_allocation_count;
+        frame_index = g_frame_index++;
+        memcpy(allocations, g_frame_allocations, site_count * sizeof(FrameAllocation));
+    }
+
+    if (allocation_count != 0) {
+        Log::warning("Audited frame ", frame_index, " made ", allocation_count, " heap allocations:");
+        for (size_t i = 0; i < site_count; ++i) {
+            const FrameAllocation &a = allocations[i];
+            Console::print_line("\t", a.file, ":", a.line, ": ", (int64_t)a.count, " allocs, ", (int64_t)a.bytes, " bytes");
+        }
+        if (site_count == MAX_FRAME_CALL_SITES) {
+            Console::print_line("\t(more call sites not shown)");
+        }
+    }
+
+    return static_cast<size_t>(allocation_count);
+}
+
+static inline bool is_before(const CallSiteStats &a, const CallSiteStats &b) {
+    return a.live_bytes != b.live_bytes ? a.live_bytes > b.live_bytes : a.peak_bytes > b.peak_bytes;
+}
+
+void print_report(size_t p_max_call_sites) {
+
+    uint64_t alloc_count, free_count;
+    get_total_counts(alloc_count, free_count);
+
+    Log::info("Memory: ", alloc_count - free_count, " blocks live, ",
+        get_live_bytes(), " bytes live, ", get_peak_bytes(), " bytes peak, ",
+        alloc_count, " allocations in total");
+
+    // Static so reporting doesn't change what is reported
+    static CallSiteStats s_stats[MAX_CALL_SITES + 1];
+    static std::mutex s_mutex;
+    std::lock_guard<std::mutex> lock(s_mutex);
+
+    size_t count = get_call_site_stats(s_stats, MAX_CALL_SITES + 1);
+
+    // Partial selection sort, only the first ones are printed
+    if (p_max_call_sites > count) {
+        p_max_call_sites = count;
+    }
+    for (size_t i = 0; i < p_max_call_sites; ++i) {
+        size_t best = i;
+        for (size_t j = i + 1; j < count; ++j) {
+            if (is_before(s_stats[j], s_stats[best])) {
+                best = j;
+            }
+        }
+        CallSiteStats temp = s_stats[i];
+        s_stats[i] = s_stats[best];
+        s_stats[best] = temp;
+    }
+
+    Console::print_line("Per call site:");
+    for (size_t i = 0; i < p_max_call_sites; ++i) {
+        const CallSiteStats &s = s_stats[i];
+        Console::print_line("\t", s.file, ":", s.line, ": ", (int64_t)s.alloc_count, " allocs, ",
+            (int64_t)s.live_count, " live, ", (int64_t)s.live_bytes, " bytes live, ", (int64_t)s.peak_bytes, " bytes peak");
+    }
+}
+
+} // namespace Memory
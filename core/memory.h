@@ -3,19 +3,67 @@
 
 #include <cstdlib>
 #include <cstring> // memcpy etc
+#include "types.h"
 
+class Arena;
+
+// Every block is tracked with its size and the file and line it was allocated from.
+// Statistics are counted per thread and summed when queried, and small blocks are cached per thread,
+// so threads allocating at the same time don't contend.
+// Allocations can be routed to an Arena with ArenaScope, see arena.h.
 namespace Memory {
 
 void *alloc(size_t nbytes, const char *file, int line);
 void *realloc(void *ptr, size_t nbytes, const char *file, int line);
-void free(void *ptr, const char *file, int line);
+// Frees are counted against the call site that allocated the block
+void free(void *ptr);
+
+// Size requested for a block
+size_t get_size(const void *ptr);
 
+// Arena used by allocations of the current thread, or null for the heap. Use ArenaScope to change it.
+Arena *get_current_arena();
+void set_current_arena(Arena *p_arena);
+
+// Number of live heap blocks. Statistics don't include arena allocations.
 size_t get_alloc_count();
+uint64_t get_live_bytes();
+// Exact when one thread allocates. With several, it can be off by up to 16 KiB per other thread,
+// which are the live bytes each thread hasn't reported yet.
+uint64_t get_peak_bytes();
+// Includes reallocations
+uint64_t get_total_alloc_count();
+
+struct CallSiteStats {
+    const char *file;
+    int line;
+    // Includes reallocations
+    uint64_t alloc_count;
+    uint64_t live_count;
+    uint64_t live_bytes;
+    // Sum of the peaks seen by each thread
+    uint64_t peak_bytes;
+};
+
+// Copies statistics of call sites and returns how many were written, up to `p_max_count`.
+// Call sites with the same file and line are merged.
+size_t get_call_site_stats(CallSiteStats *out_stats, size_t p_max_count);
+
+// Prints totals, then the first call sites sorted by live bytes and peak bytes.
+// Thread-safe, can be called at any time. At exit, call sites with live blocks are leaks.
+void print_report(size_t p_max_call_sites = 20);
+
+// Frame auditing, to check that the steady state doesn't allocate.
+// Heap allocations made by any thread between begin_frame() and end_frame() are recorded with their call site.
+// Arena allocations are not recorded. Costs nothing when no frame is audited.
+void begin_frame();
+// Returns the number of heap allocations made since begin_frame(), and logs their call sites if there were any
+size_t end_frame();
 
 } // namespace Memory
 
 #define memalloc(nbytes) Memory::alloc(nbytes, __FILE__, __LINE__)
 #define memrealloc(ptr, nbytes) Memory::realloc(ptr, nbytes, __FILE__, __LINE__)
-#define memfree(ptr) Memory::free(ptr, __FILE__, __LINE__)
+#define memfree(ptr) Memory::free(ptr)
 
 #endif // HEADER_MEMORY_H
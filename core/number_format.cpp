@@ -0,0 +1,638 @@
+#include "number_format.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace NumberFormat {
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t POWERS_OF_10[] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+size_t count_digits(uint64_t p_value) {
+    size_t count = 1;
+    while (count < 20 && p_value >= POWERS_OF_10[count]) {
+        ++count;
+    }
+    return count;
+}
+
+void write_digits(uint64_t p_value, size_t p_digit_count, char *out_str) {
+    size_t i = p_digit_count;
+    uint64_t n = p_value;
+
+    while (n >= 100) {
+        const char *pair = DIGIT_PAIRS + (n % 100) * 2;
+        n /= 100;
+        out_str[--i] = pair[1];
+        out_str[--i] = pair[0];
+    }
+
+    if (n >= 10) {
+        const char *pair = DIGIT_PAIRS + n * 2;
+        out_str[--i] = pair[1];
+        out_str[--i] = pair[0];
+    } else {
+        out_str[--i] = static_cast<char>('0' + n);
+    }
+
+    // Leading zeros
+    while (i > 0) {
+        out_str[--i] = '0';
+    }
+}
+
+// Grisu2, from "Printing Floating-Point Numbers Quickly and Accurately with Integers", Florian Loitsch, 2010.
+// Its output always reads back as the same number, and is the shortest for more than 99.9% of numbers.
+namespace {
+
+// Floating point number f * 2^e, with no implicit bit
+struct DiyFp {
+    uint64_t f;
+    int e;
+
+    DiyFp(uint64_t p_f, int p_e): f(p_f), e(p_e) {}
+};
+
+// Both numbers must have the same exponent
+inline DiyFp sub(const DiyFp &x, const DiyFp &y) {
+    assert(x.e == y.e && x.f >= y.f);
+    return DiyFp(x.f - y.f, x.e);
+}
+
+// Keeps the upper 64 bits of the product, rounded
+inline DiyFp mul(const DiyFp &x, const DiyFp &y) {
+    uint64_t u_lo = x.f & 0xffffffffu;
+    uint64_t u_hi = x.f >> 32;
+    uint64_t v_lo = y.f & 0xffffffffu;
+    uint64_t v_hi = y.f >> 32;
+
+    uint64_t p0 = u_lo * v_lo;
+    uint64_t p1 = u_lo * v_hi;
+    uint64_t p2 = u_hi * v_lo;
+    uint64_t p3 = u_hi * v_hi;
+
+    uint64_t q = (p0 >> 32) + (p1 & 0xffffffffu) + (p2 & 0xffffffffu);
+    q += uint64_t(1) << 31;
+
+    return DiyFp(p3 + (p2 >> 32) + (p1 >> 32) + (q >> 32), x.e + y.e + 64);
+}
+
+inline DiyFp normalize(DiyFp x) {
+    assert(x.f != 0);
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        --x.e;
+    }
+    return x;
+}
+
+inline DiyFp normalize_to(const DiyFp &x, int p_e) {
+    int delta = x.e - p_e;
+    assert(delta >= 0);
+    return DiyFp(x.f << delta, p_e);
+}
+
+// A number and the boundaries of the interval rounding to it
+struct Boundaries {
+    DiyFp w;
+    DiyFp minus;
+    DiyFp plus;
+};
+
+template <typename T, typename Bits>
+Boundaries compute_boundaries(T p_value) {
+    assert(std::isfinite(p_value) && p_value > 0);
+
+    // Precision includes the implicit bit
+    const int precision = std::numeric_limits<T>::digits;
+    const int bias = std::numeric_limits<T>::max_exponent - 1 + (precision - 1);
+    const int min_exponent = 1 - bias;
+    const uint64_t hidden_bit = uint64_t(1) << (precision - 1);
+
+    Bits bits;
+    memcpy(&bits, &p_value, sizeof(T));
+    uint64_t biased_e = bits >> (precision - 1);
+    uint64_t fraction = bits & (hidden_bit - 1);
+
+    DiyFp v = biased_e == 0 ?
+        DiyFp(fraction, min_exponent) :
+        DiyFp(fraction + hidden_bit, static_cast<int>(biased_e) - bias);
+
+    // When the fraction is zero, the previous number is closer
+    bool lower_boundary_is_closer = fraction == 0 && biased_e > 1;
+    DiyFp m_plus(2 * v.f + 1, v.e - 1);
+    DiyFp m_minus = lower_boundary_is_closer ?
+        DiyFp(4 * v.f - 1, v.e - 2) :
+        DiyFp(2 * v.f - 1, v.e - 1);
+
+    DiyFp w_plus = normalize(m_plus);
+    DiyFp w_minus = normalize_to(m_minus, w_plus.e);
+
+    return Boundaries{ normalize(v), w_minus, w_plus };
+}
+
+// Binary exponent range in which digits are generated, so that the integral part fits in 32 bits
+const int ALPHA = -60;
+const int GAMMA = -32;
+
+struct CachedPower {
+    uint64_t f;
+    int e;
+    int k;
+};
+
+// Normalized 10^k for k from -300 to 324, every 8
+const int CACHED_POWERS_MIN_DECIMAL_EXPONENT = -300;
+const int CACHED_POWERS_DECIMAL_STEP = 8;
+const CachedPower CACHED_POWERS[] = {
+    { 0xAB70FE17C79AC6CAULL, -1060, -300 },
+    { 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+    { 0xBE5691EF416BD60CULL, -1007, -284 },
+    { 0x8DD01FAD907FFC3CULL, -980, -276 },
+    { 0xD3515C2831559A83ULL, -954, -268 },
+    { 0x9D71AC8FADA6C9B5ULL, -927, -260 },
+    { 0xEA9C227723EE8BCBULL, -901, -252 },
+    { 0xAECC49914078536DULL, -874, -244 },
+    { 0x823C12795DB6CE57ULL, -847, -236 },
+    { 0xC21094364DFB5637ULL, -821, -228 },
+    { 0x9096EA6F3848984FULL, -794, -220 },
+    { 0xD77485CB25823AC7ULL, -768, -212 },
+    { 0xA086CFCD97BF97F4ULL, -741, -204 },
+    { 0xEF340A98172AACE5ULL, -715, -196 },
+    { 0xB23867FB2A35B28EULL, -688, -188 },
+    { 0x84C8D4DFD2C63F3BULL, -661, -180 },
+    { 0xC5DD44271AD3CDBAULL, -635, -172 },
+    { 0x936B9FCEBB25C996ULL, -608, -164 },
+    { 0xDBAC6C247D62A584ULL, -582, -156 },
+    { 0xA3AB66580D5FDAF6ULL, -555, -148 },
+    { 0xF3E2F893DEC3F126ULL, -529, -140 },
+    { 0xB5B5ADA8AAFF80B8ULL, -502, -132 },
+    { 0x87625F056C7C4A8BULL, -475, -124 },
+    { 0xC9BCFF6034C13053ULL, -449, -116 },
+    { 0x964E858C91BA2655ULL, -422, -108 },
+    { 0xDFF9772470297EBDULL, -396, -100 },
+    { 0xA6DFBD9FB8E5B88FULL, -369, -92 },
+    { 0xF8A95FCF88747D94ULL, -343, -84 },
+    { 0xB94470938FA89BCFULL, -316, -76 },
+    { 0x8A08F0F8BF0F156BULL, -289, -68 },
+    { 0xCDB02555653131B6ULL, -263, -60 },
+    { 0x993FE2C6D07B7FACULL, -236, -52 },
+    { 0xE45C10C42A2B3B06ULL, -210, -44 },
+    { 0xAA242499697392D3ULL, -183, -36 },
+    { 0xFD87B5F28300CA0EULL, -157, -28 },
+    { 0xBCE5086492111AEBULL, -130, -20 },
+    { 0x8CBCCC096F5088CCULL, -103, -12 },
+    { 0xD1B71758E219652CULL, -77, -4 },
+    { 0x9C40000000000000ULL, -50, 4 },
+    { 0xE8D4A51000000000ULL, -24, 12 },
+    { 0xAD78EBC5AC620000ULL, 3, 20 },
+    { 0x813F3978F8940984ULL, 30, 28 },
+    { 0xC097CE7BC90715B3ULL, 56, 36 },
+    { 0x8F7E32CE7BEA5C70ULL, 83, 44 },
+    { 0xD5D238A4ABE98068ULL, 109, 52 },
+    { 0x9F4F2726179A2245ULL, 136, 60 },
+    { 0xED63A231D4C4FB27ULL, 162, 68 },
+    { 0xB0DE65388CC8ADA8ULL, 189, 76 },
+    { 0x83C7088E1AAB65DBULL, 216, 84 },
+    { 0xC45D1DF942711D9AULL, 242, 92 },
+    { 0x924D692CA61BE758ULL, 269, 100 },
+    { 0xDA01EE641A708DEAULL, 295, 108 },
+    { 0xA26DA3999AEF774AULL, 322, 116 },
+    { 0xF209787BB47D6B85ULL, 348, 124 },
+    { 0xB454E4A179DD1877ULL, 375, 132 },
+    { 0x865B86925B9BC5C2ULL, 402, 140 },
+    { 0xC83553C5C8965D3DULL, 428, 148 },
+    { 0x952AB45CFA97A0B3ULL, 455, 156 },
+    { 0xDE469FBD99A05FE3ULL, 481, 164 },
+    { 0xA59BC234DB398C25ULL, 508, 172 },
+    { 0xF6C69A72A3989F5CULL, 534, 180 },
+    { 0xB7DCBF5354E9BECEULL, 561, 188 },
+    { 0x88FCF317F22241E2ULL, 588, 196 },
+    { 0xCC20CE9BD35C78A5ULL, 614, 204 },
+    { 0x98165AF37B2153DFULL, 641, 212 },
+    { 0xE2A0B5DC971F303AULL, 667, 220 },
+    { 0xA8D9D1535CE3B396ULL, 694, 228 },
+    { 0xFB9B7CD9A4A7443CULL, 720, 236 },
+    { 0xBB764C4CA7A44410ULL, 747, 244 },
+    { 0x8BAB8EEFB6409C1AULL, 774, 252 },
+    { 0xD01FEF10A657842CULL, 800, 260 },
+    { 0x9B10A4E5E9913129ULL, 827, 268 },
+    { 0xE7109BFBA19C0C9DULL, 853, 276 },
+    { 0xAC2820D9623BF429ULL, 880, 284 },
+    { 0x80444B5E7AA7CF85ULL, 907, 292 },
+    { 0xBF21E44003ACDD2DULL, 933, 300 },
+    { 0x8E679C2F5E44FF8FULL, 960, 308 },
+    { 0xD433179D9C8CB841ULL, 986, 316 },
+    { 0x9E19DB92B4E31BA9ULL, 1013, 324 },
+};
+
+// Returns c = 10^k such that ALPHA <= e + c.e + 64 <= GAMMA
+CachedPower get_cached_power_for_binary_exponent(int e) {
+    // k = ceil((ALPHA - e - 1) * log10(2)), with log10(2) ~= 78913 / 2^18
+    int f = ALPHA - e - 1;
+    int k = (f * 78913) / (1 << 18) + (f > 0 ? 1 : 0);
+
+    int index = (-CACHED_POWERS_MIN_DECIMAL_EXPONENT + k + (CACHED_POWERS_DECIMAL_STEP - 1)) / CACHED_POWERS_DECIMAL_STEP;
+    assert(index >= 0 && static_cast<size_t>(index) < sizeof(CACHED_POWERS) / sizeof(CACHED_POWERS[0]));
+
+    const CachedPower &cached = CACHED_POWERS[index];
+    assert(ALPHA <= cached.e + e + 64 && cached.e + e + 64 <= GAMMA);
+    return cached;
+}
+
+// Returns the number of digits of n and the largest power of 10 not greater than n
+inline int find_largest_pow10(uint32_t n, uint32_t &out_pow10) {
+    int count = static_cast<int>(count_digits(n));
+    out_pow10 = static_cast<uint32_t>(POWERS_OF_10[count - 1]);
+    return count;
+}
+
+// Moves the last digit towards the number while it stays in the interval
+inline void grisu2_round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+    while (rest < dist
+        && delta - rest >= ten_k
+        && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        assert(buf[len - 1] != '0');
+        --buf[len - 1];
+        rest += ten_k;
+    }
+}
+
+void grisu2_digit_gen(char *buffer, int &length, int &decimal_exponent, DiyFp m_minus, DiyFp w, DiyFp m_plus) {
+    assert(m_plus.e >= ALPHA && m_plus.e <= GAMMA);
+
+    uint64_t delta = sub(m_plus, m_minus).f;
+    uint64_t dist = sub(m_plus, w).f;
+
+    // Split m_plus into integral and fractional parts
+    const DiyFp one(uint64_t(1) << -m_plus.e, m_plus.e);
+
+    uint32_t p1 = static_cast<uint32_t>(m_plus.f >> -one.e);
+    uint64_t p2 = m_plus.f & (one.f - 1);
+
+    uint32_t pow10;
+    int n = find_largest_pow10(p1, pow10);
+
+    // Integral digits
+    while (n > 0) {
+        uint32_t d = p1 / pow10;
+        p1 %= pow10;
+        buffer[length++] = static_cast<char>('0' + d);
+        --n;
+
+        uint64_t rest = (uint64_t(p1) << -one.e) + p2;
+        if (rest <= delta) {
+            decimal_exponent += n;
+            grisu2_round(buffer, length, dist, delta, rest, uint64_t(pow10) << -one.e);
+            return;
+        }
+
+        pow10 /= 10;
+    }
+
+    // Fractional digits
+    int m = 0;
+    while (true) {
+        assert(p2 <= ~uint64_t(0) / 10);
+        p2 *= 10;
+        uint64_t d = p2 >> -one.e;
+        p2 &= one.f - 1;
+        buffer[length++] = static_cast<char>('0' + d);
+        ++m;
+
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta) {
+            break;
+        }
+    }
+
+    decimal_exponent -= m;
+    grisu2_round(buffer, length, dist, delta, p2, one.f);
+}
+
+// Writes the digits of a positive number, such that it equals digits * 10^decimal_exponent
+template <typename T, typename Bits>
+void grisu2(char *buffer, int &length, int &decimal_exponent, T p_value) {
+    Boundaries b = compute_boundaries<T, Bits>(p_value);
+
+    CachedPower cached = get_cached_power_for_binary_exponent(b.plus.e);
+    DiyFp c_minus_k(cached.f, cached.e);
+
+    DiyFp w = mul(b.w, c_minus_k);
+    DiyFp w_minus = mul(b.minus, c_minus_k);
+    DiyFp w_plus = mul(b.plus, c_minus_k);
+
+    // Products are rounded, so shrink the interval by one unit to stay inside it
+    DiyFp m_minus(w_minus.f + 1, w_minus.e);
+    DiyFp m_plus(w_plus.f - 1, w_plus.e);
+
+    length = 0;
+    decimal_exponent = -cached.k;
+    grisu2_digit_gen(buffer, length, decimal_exponent, m_minus, w, m_plus);
+}
+
+inline size_t write_exponent(int e, char *out_str) {
+    char *p = out_str;
+    if (e < 0) {
+        *p++ = '-';
+        e = -e;
+    } else {
+        *p++ = '+';
+    }
+    // At least two digits
+    if (e >= 100) {
+        *p++ = static_cast<char>('0' + e / 100);
+        e %= 100;
+    }
+    *p++ = DIGIT_PAIRS[e * 2];
+    *p++ = DIGIT_PAIRS[e * 2 + 1];
+    return p - out_str;
+}
+
+// Places the decimal point or exponent in digits written at the start of the buffer
+size_t format_digits(char *buf, int length, int decimal_exponent, int max_exponent) {
+    const int min_exponent = -4;
+
+    int k = length;
+    // Position of the decimal point
+    int n = length + decimal_exponent;
+
+    if (k <= n && n <= max_exponent) {
+        // Integer: ddd00.0
+        memset(buf + k, '0', n - k);
+        buf[n] = '.';
+        buf[n + 1] = '0';
+        return n + 2;
+    }
+
+    if (0 < n && n <= max_exponent) {
+        // dd.ddd
+        memmove(buf + n + 1, buf + n, k - n);
+        buf[n] = '.';
+        return k + 1;
+    }
+
+    if (min_exponent < n && n <= 0) {
+        // 0.000ddd
+        memmove(buf + 2 - n, buf, k);
+        buf[0] = '0';
+        buf[1] = '.';
+        memset(buf + 2, '0', -n);
+        return 2 - n + k;
+    }
+
+    // d.ddde+nn
+    size_t len = 1;
+    if (k > 1) {
+        memmove(buf + 2, buf + 1, k - 1);
+        buf[1] = '.';
+        len = k + 1;
+    }
+    buf[len++] = 'e';
+    return len + write_exponent(n - 1, buf + len);
+}
+
+inline size_t write_special(double p_value, char *out_str) {
+    if (std::isnan(p_value)) {
+        memcpy(out_str, "nan", 3);
+        return 3;
+    }
+    if (p_value < 0) {
+        memcpy(out_str, "-inf", 4);
+        return 4;
+    }
+    memcpy(out_str, "inf", 3);
+    return 3;
+}
+
+template <typename T, typename Bits>
+size_t write_shortest_t(T p_value, char *out_str) {
+    if (!std::isfinite(p_value)) {
+        return write_special(p_value, out_str);
+    }
+
+    char *p = out_str;
+    if (std::signbit(p_value)) {
+        *p++ = '-';
+        p_value = -p_value;
+    }
+
+    if (p_value == 0) {
+        memcpy(p, "0.0", 3);
+        return p + 3 - out_str;
+    }
+
+    int length;
+    int decimal_exponent;
+    grisu2<T, Bits>(p, length, decimal_exponent, p_value);
+    assert(length <= std::numeric_limits<T>::max_digits10);
+
+    p += format_digits(p, length, decimal_exponent, std::numeric_limits<T>::digits10);
+    assert(static_cast<size_t>(p - out_str) <= MAX_LENGTH);
+    return p - out_str;
+}
+
+} // namespace
+
+size_t write_shortest(double p_value, char *out_str) {
+    return write_shortest_t<double, uint64_t>(p_value, out_str);
+}
+
+size_t write_shortest(float p_value, char *out_str) {
+    return write_shortest_t<float, uint32_t>(p_value, out_str);
+}
+
+// Exact 64x64 to 128-bit product
+static inline void mul_128(uint64_t a, uint64_t b, uint64_t &out_hi, uint64_t &out_lo) {
+    uint64_t a_lo = a & 0xffffffffu;
+    uint64_t a_hi = a >> 32;
+    uint64_t b_lo = b & 0xffffffffu;
+    uint64_t b_hi = b >> 32;
+
+    uint64_t p0 = a_lo * b_lo;
+    uint64_t p1 = a_lo * b_hi;
+    uint64_t p2 = a_hi * b_lo;
+    uint64_t p3 = a_hi * b_hi;
+
+    uint64_t mid = (p0 >> 32) + (p1 & 0xffffffffu) + (p2 & 0xffffffffu);
+    out_lo = (mid << 32) | (p0 & 0xffffffffu);
+    out_hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+}
+
+// Rounds `p_value * p_scale` to the nearest integer, ties away from zero.
+// It is computed from the exact binary value, scaling in floating point would round twice:
+// 2.675 is stored as 2.67499999999999982236431605997495353221893310546875, which must give 267.
+// The result must fit in 64 bits.
+static uint64_t round_scaled(double p_value, uint64_t p_scale) {
+    assert(p_value >= 0);
+
+    // p_value = mantissa * 2^exponent
+    uint64_t bits;
+    memcpy(&bits, &p_value, sizeof(bits));
+    uint64_t biased_e = bits >> 52;
+    uint64_t mantissa = bits & ((uint64_t(1) << 52) - 1);
+    int exponent;
+    if (biased_e == 0) {
+        exponent = 1 - 1075;
+    } else {
+        mantissa |= uint64_t(1) << 52;
+        exponent = static_cast<int>(biased_e) - 1075;
+    }
+
+    // Scales are at most 10^15, so the product takes at most 103 bits
+    uint64_t hi;
+    uint64_t lo;
+    mul_128(mantissa, p_scale, hi, lo);
+
+    if (exponent >= 0) {
+        return lo << exponent;
+    }
+
+    const int shift = -exponent;
+    if (shift >= 128) {
+        return 0;
+    }
+
+    // Adding half of the divisor before shifting rounds to nearest
+    const int half_bit = shift - 1;
+    if (half_bit >= 64) {
+        hi += uint64_t(1) << (half_bit - 64);
+    } else {
+        uint64_t sum = lo + (uint64_t(1) << half_bit);
+        hi += sum < lo;
+        lo = sum;
+    }
+
+    if (shift >= 64) {
+        return hi >> (shift - 64);
+    }
+    return (lo >> shift) | (hi << (64 - shift));
+}
+
+// Writes the exact decimal digits of an integer stored in a double, which can have up to 309 of them
+static size_t write_large_integer(double p_value, char *out_str) {
+    assert(p_value >= 0 && p_value == std::floor(p_value));
+
+    uint64_t bits;
+    memcpy(&bits, &p_value, sizeof(bits));
+    int exponent = static_cast<int>(bits >> 52) - 1075;
+    uint64_t mantissa = (bits & ((uint64_t(1) << 52) - 1)) | (uint64_t(1) << 52);
+
+    if (exponent <= 0) {
+        // Small enough for 64 bits
+        return write_uint(static_cast<uint64_t>(p_value), out_str);
+    }
+
+    // mantissa * 2^exponent, in base 10^9 limbs with the lowest first
+    const uint32_t limb_base = 1000000000;
+    uint32_t limbs[36];
+    size_t limb_count = 0;
+    for (uint64_t m = mantissa; m != 0; m /= limb_base) {
+        limbs[limb_count++] = static_cast<uint32_t>(m % limb_base);
+    }
+
+    while (exponent > 0) {
+        // A limb times 2^29 plus a carry fits in 64 bits
+        const int shift = exponent < 29 ? exponent : 29;
+        exponent -= shift;
+        uint64_t carry = 0;
+        for (size_t i = 0; i < limb_count; ++i) {
+            uint64_t v = (static_cast<uint64_t>(limbs[i]) << shift) + carry;
+            limbs[i] = static_cast<uint32_t>(v % limb_base);
+            carry = v / limb_base;
+        }
+        while (carry != 0) {
+            assert(limb_count < sizeof(limbs) / sizeof(limbs[0]));
+            limbs[limb_count++] = static_cast<uint32_t>(carry % limb_base);
+            carry /= limb_base;
+        }
+    }
+
+    char *p = out_str;
+    p += write_uint(limbs[limb_count - 1], p);
+    for (size_t i = limb_count - 1; i > 0; --i) {
+        write_digits(limbs[i - 1], 9, p);
+        p += 9;
+    }
+    return p - out_str;
+}
+
+size_t write_fixed(double p_value, int p_decimals, char *out_str) {
+    if (!std::isfinite(p_value)) {
+        return write_special(p_value, out_str);
+    }
+
+    assert(p_decimals >= 0 && p_decimals <= MAX_FIXED_DECIMALS);
+    size_t decimals = p_decimals < 0 ? 0 : (p_decimals > MAX_FIXED_DECIMALS ? MAX_FIXED_DECIMALS : p_decimals);
+    const uint64_t unit = POWERS_OF_10[decimals];
+
+    char *p = out_str;
+    // Like printf, negative values rounding to zero keep their sign
+    if (std::signbit(p_value)) {
+        *p++ = '-';
+    }
+    double a = std::fabs(p_value);
+
+    uint64_t integer_part;
+    uint64_t fraction_digits = 0;
+
+    if (a < 9007199254740992.0) {
+        // Below 2^53, the fractional part is exact and is rounded on its own
+        integer_part = static_cast<uint64_t>(a);
+        fraction_digits = round_scaled(a - static_cast<double>(integer_part), unit);
+        if (fraction_digits == unit) {
+            ++integer_part;
+            fraction_digits = 0;
+        }
+        p += write_uint(integer_part, p);
+
+    } else {
+        // Larger doubles are integers
+        p += write_large_integer(a, p);
+    }
+
+    if (decimals > 0) {
+        *p++ = '.';
+        write_digits(fraction_digits, decimals, p);
+        p += decimals;
+    }
+
+    assert(static_cast<size_t>(p - out_str) <= MAX_FIXED_LENGTH);
+    return p - out_str;
+}
+
+} // namespace NumberFormat
@@ -0,0 +1,42 @@
+#ifndef HEADER_NUMBER_FORMAT_H
+#define HEADER_NUMBER_FORMAT_H
+
+#include "types.h"
+
+// Conversion of numbers to decimal text, without allocating.
+// Functions write into a buffer of at least MAX_LENGTH chars, return how many were written,
+// and don't write a zero terminator.
+namespace NumberFormat {
+
+const size_t MAX_LENGTH = 32;
+
+// Returns how many decimal digits `p_value` has
+size_t count_digits(uint64_t p_value);
+
+// Writes exactly `p_digit_count` decimal digits, two at a time.
+// `p_digit_count` must be at least count_digits(p_value).
+void write_digits(uint64_t p_value, size_t p_digit_count, char *out_str);
+
+inline size_t write_uint(uint64_t p_value, char *out_str) {
+    size_t count = count_digits(p_value);
+    write_digits(p_value, count, out_str);
+    return count;
+}
+
+// Shortest digits reading back as the same number, using Grisu2.
+// Magnitudes between 1e-5 and 1e15 (1e6 for floats) are written in decimal notation, like "0.001" or "42.0",
+// others in scientific notation, like "1.5e+20". Also writes "nan", "inf" and "-inf".
+size_t write_shortest(double p_value, char *out_str);
+size_t write_shortest(float p_value, char *out_str);
+
+// Decimal notation with a fixed number of digits after the point, from 0 to MAX_FIXED_DECIMALS.
+// Rounds the exact value of the double like printf, except that exact ties round away from zero.
+// Large numbers are written with all their integer digits, so the buffer must hold MAX_FIXED_LENGTH chars.
+const int MAX_FIXED_DECIMALS = 15;
+// Sign, 309 integer digits for the largest double, point and decimals
+const size_t MAX_FIXED_LENGTH = 1 + 309 + 1 + MAX_FIXED_DECIMALS;
+size_t write_fixed(double p_value, int p_decimals, char *out_str);
+
+} // namespace NumberFormat
+
+#endif // HEADER_NUMBER_FORMAT_H
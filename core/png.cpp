@@ -0,0 +1,195 @@
+#include "png.h"
+#include "file.h"
+#include "log.h"
+
+namespace PNG {
+
+struct CrcTable {
+    uint32_t values[256];
+
+    CrcTable() {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                if (c & 1)
+                    c = 0xedb88320u ^ (c >> 1);
+                else
+                    c = c >> 1;
+            }
+            values[n] = c;
+        }
+    }
+};
+
+static uint32_t update_crc(uint32_t crc, const uint8_t *bytes, size_t size) {
+    // Initialized on first use, thread-safe
+    static const CrcTable s_table;
+    uint32_t c = crc;
+    for (size_t i = 0; i < size; ++i) {
+        c = s_table.values[(c ^ bytes[i]) & 0xff] ^ (c >> 8);
+    }
+    return c;
+}
+
+static void update_adler32(uint32_t &a, uint32_t &b, const uint8_t *bytes, size_t size) {
+    // 5552 is the largest count for which sums can't overflow before taking the modulo
+    while (size > 0) {
+        size_t n = size < 5552 ? size : 5552;
+        size -= n;
+        for (size_t i = 0; i < n; ++i) {
+            a += bytes[i];
+            b += a;
+        }
+        bytes += n;
+        a %= 65521;
+        b %= 65521;
+    }
+}
+
+static inline void write_u32_be(uint8_t *dst, uint32_t v) {
+    dst[0] = (v >> 24) & 0xff;
+    dst[1] = (v >> 16) & 0xff;
+    dst[2] = (v >> 8) & 0xff;
+    dst[3] = v & 0xff;
+}
+
+// Writes one chunk in pieces, so big data doesn't have to be assembled in memory first
+class ChunkWriter {
+public:
+    ChunkWriter(File &file, const char *type, uint32_t length): _file(file), _ok(true) {
+        uint8_t header[8];
+        write_u32_be(header, length);
+        memcpy(header + 4, type, 4);
+        _ok = _file.write_bytes(header, 8);
+        // The CRC covers the type but not the length
+        _crc = update_crc(0xffffffffu, header + 4, 4);
+    }
+
+    void write(const uint8_t *bytes, size_t size) {
+        _crc = update_crc(_crc, bytes, size);
+        _ok = _ok && _file.write_bytes(bytes, size);
+    }
+
+    bool end() {
+        uint8_t crc[4];
+        write_u32_be(crc, _crc ^ 0xffffffffu);
+        return _ok && _file.write_bytes(crc, 4);
+    }
+
+private:
+    File &_file;
+    uint32_t _crc;
+    bool _ok;
+};
+
+bool save_rgba8(const char *fpath, const uint8_t *pixels, uint32_t width, uint32_t height, size_t row_pitch, bool bgra) {
+
+    assert(pixels != nullptr);
+    assert(width > 0 && height > 0);
+    assert(row_pitch >= width * 4);
+
+    // Scanlines, each prefixed with filter type 0 (none)
+    const size_t line_size = 1 + width * 4;
+    Vector<uint8_t> raw;
+    raw.resize_no_init(line_size * height);
+
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t *src = pixels + y * row_pitch;
+        uint8_t *dst = raw.data() + y * line_size;
+        dst[0] = 0;
+        ++dst;
+        if (bgra) {
+            for (uint32_t x = 0; x < width; ++x) {
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+                dst[3] = src[3];
+                dst += 4;
+                src += 4;
+            }
+        } else {
+            memcpy(dst, src, width * 4);
+        }
+    }
+
+    // Zlib stream made of stored deflate blocks
+    const size_t max_block_size = 65535;
+    const size_t block_count = (raw.size() + max_block_size - 1) / max_block_size;
+    const size_t zlib_size = 2 + block_count * 5 + raw.size() + 4;
+    if (zlib_size > 0x7fffffffu) {
+        LOG_ERROR("Image is too big to be saved as PNG: ", fpath);
+        return false;
+    }
+
+    File f;
+    if (!f.open(fpath, File::WRITE, File::BINARY)) {
+        LOG_ERROR("Could not open file for writing: ", fpath);
+        return false;
+    }
+
+    bool ok = true;
+
+    const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    ok = ok && f.write_bytes(signature, 8);
+
+    {
+        uint8_t ihdr[13];
+        write_u32_be(ihdr, width);
+        write_u32_be(ihdr + 4, height);
+        ihdr[8] = 8; // Bit depth
+        ihdr[9] = 6; // Color type RGBA
+        ihdr[10] = 0; // Compression
+        ihdr[11] = 0; // Filter
+        ihdr[12] = 0; // No interlace
+        ChunkWriter chunk(f, "IHDR", 13);
+        chunk.write(ihdr, 13);
+        ok = ok && chunk.end();
+    }
+
+    {
+        ChunkWriter chunk(f, "IDAT", static_cast<uint32_t>(zlib_size));
+
+        // Deflate, 32K window, no preset dictionary, fastest level
+        const uint8_t zlib_header[2] = { 0x78, 0x01 };
+        chunk.write(zlib_header, 2);
+
+        uint32_t adler_a = 1;
+        uint32_t adler_b = 0;
+
+        for (size_t i = 0; i < block_count; ++i) {
+            const size_t begin = i * max_block_size;
+            const size_t size = Math::min(max_block_size, raw.size() - begin);
+            const uint8_t *block = raw.data() + begin;
+
+            uint8_t block_header[5];
+            block_header[0] = (i + 1 == block_count) ? 1 : 0; // Final flag, stored type
+            block_header[1] = size & 0xff;
+            block_header[2] = (size >> 8) & 0xff;
+            block_header[3] = ~size & 0xff;
+            block_header[4] = (~size >> 8) & 0xff;
+            chunk.write(block_header, 5);
+            chunk.write(block, size);
+
+            update_adler32(adler_a, adler_b, block, size);
+        }
+
+        uint8_t adler[4];
+        write_u32_be(adler, (adler_b << 16) | adler_a);
+        chunk.write(adler, 4);
+
+        ok = ok && chunk.end();
+    }
+
+    {
+        ChunkWriter chunk(f, "IEND", 0);
+        ok = ok && chunk.end();
+    }
+
+    if (!ok) {
+        LOG_ERROR("Failed to write PNG file: ", fpath);
+    }
+
+    return ok;
+}
+
+} // namespace PNG
@@ -0,0 +1,16 @@
+#ifndef HEADER_PNG_H
+#define HEADER_PNG_H
+
+#include "types.h"
+
+namespace PNG {
+
+// Saves 8-bit RGBA pixels as a PNG file.
+// Data is stored without compression: files are big, but encoding costs little more than a copy.
+// `row_pitch` is the distance in bytes between two rows of `pixels`.
+// If `bgra` is true, input pixels are in BGRA order and get converted.
+bool save_rgba8(const char *fpath, const uint8_t *pixels, uint32_t width, uint32_t height, size_t row_pitch, bool bgra = false);
+
+} // namespace PNG
+
+#endif // HEADER_PNG_H
@@ -0,0 +1,302 @@
+#ifndef HEADER_POOL_H
+#define HEADER_POOL_H
+
+#include "vector.h"
+#include <utility> // std::forward
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit. Must not be zero.
+inline uint32_t find_first_bit(uint64_t v) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return i;
+#elif defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    uint32_t i = 0;
+    while ((v & 1) == 0) {
+        v >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+// Refers to an object of a Pool. Becomes invalid when the object is destroyed,
+// even if its slot gets reused by a new object.
+template <typename T>
+struct PoolHandle {
+    uint32_t index;
+    // Always odd for a valid handle, zero for a null one
+    uint32_t generation;
+
+    PoolHandle(): index(0), generation(0) {}
+    PoolHandle(uint32_t p_index, uint32_t p_generation): index(p_index), generation(p_generation) {}
+
+    inline bool is_null() const {
+        return generation == 0;
+    }
+
+    inline bool operator==(const PoolHandle &p_other) const {
+        return index == p_other.index && generation == p_other.generation;
+    }
+
+    inline bool operator!=(const PoolHandle &p_other) const {
+        return !(*this == p_other);
+    }
+};
+
+// Stores objects of the same type in pages of PAGE_SLOTS slots, with O(1) creation and destruction.
+// Objects never move, so pointers to them stay valid until they are destroyed.
+// Freed slots are reused before new pages are allocated, and iteration goes through pages in order,
+// so live objects stay dense in memory.
+template <typename T>
+class Pool {
+public:
+    typedef PoolHandle<T> Handle;
+
+    static const uint32_t PAGE_SLOTS = 64;
+
+    // Iterates live objects in storage order
+    template <typename P, typename V>
+    class IteratorBase {
+    public:
+        IteratorBase(P *p_pool, size_t p_page_index): m_pool(p_pool), m_page_index(p_page_index), m_mask(0) {
+            if (m_page_index < m_pool->m_pages.size()) {
+                m_mask = m_pool->m_pages[m_page_index]->live_mask;
+                skip_empty();
+            }
+        }
+
+        V &operator*() const {
+            return m_pool->m_pages[m_page_index]->get_object(find_first_bit(m_mask));
+        }
+
+        V *operator->() const {
+            return &**this;
+        }
+
+        Handle get_handle() const {
+            const Page *page = m_pool->m_pages[m_page_index];
+            uint32_t slot = find_first_bit(m_mask);
+            return Handle(static_cast<uint32_t>(m_page_index) * PAGE_SLOTS + slot, page->generations[slot]);
+        }
+
+        IteratorBase &operator++() {
+            // Clears the lowest bit
+            m_mask &= m_mask - 1;
+            skip_empty();
+            return *this;
+        }
+
+        bool operator!=(const IteratorBase &p_other) const {
+            return m_page_index != p_other.m_page_index || m_mask != p_other.m_mask;
+        }
+
+    private:
+        void skip_empty() {
+            while (m_mask == 0) {
+                ++m_page_index;
+                if (m_page_index == m_pool->m_pages.size()) {
+                    break;
+                }
+                m_mask = m_pool->m_pages[m_page_index]->live_mask;
+            }
+        }
+
+        P *m_pool;
+        size_t m_page_index;
+        // Live slots not visited yet in the current page
+        uint64_t m_mask;
+    };
+
+    typedef IteratorBase<Pool, T> Iterator;
+    typedef IteratorBase<const Pool, const T> ConstIterator;
+
+    Pool(): m_free_head(NO_SLOT), m_size(0) {}
+
+    ~Pool() {
+        clear();
+        for (size_t i = 0; i < m_pages.size(); ++i) {
+            memfree(m_pages[i]);
+        }
+    }
+
+    template <typename... Args>
+    Handle create(Args&&... p_args) {
+        if (m_free_head == NO_SLOT) {
+            add_page();
+        }
+
+        uint32_t index = m_free_head;
+        Page &page = get_page(index);
+        uint32_t slot = index % PAGE_SLOTS;
+
+        m_free_head = page.next_free[slot];
+
+        new(&page.get_object(slot)) T(std::forward<Args>(p_args)...);
+        ++page.generations[slot];
+        page.live_mask |= uint64_t(1) << slot;
+        ++m_size;
+
+        return Handle(index, page.generations[slot]);
+    }
+
+    // Returns null if the object was destroyed
+    T *get(Handle p_handle) {
+        if (!is_valid(p_handle)) {
+            return nullptr;
+        }
+        return &get_page(p_handle.index).get_object(p_handle.index % PAGE_SLOTS);
+    }
+
+    const T *get(Handle p_handle) const {
+        if (!is_valid(p_handle)) {
+            return nullptr;
+        }
+        return &get_page(p_handle.index).get_object(p_handle.index % PAGE_SLOTS);
+    }
+
+    inline bool is_valid(Handle p_handle) const {
+        return !p_handle.is_null()
+            && p_handle.index < m_pages.size() * PAGE_SLOTS
+            && get_page(p_handle.index).generations[p_handle.index % PAGE_SLOTS] == p_handle.generation;
+    }
+
+    // Returns false if the object was already destroyed
+    bool destroy(Handle p_handle) {
+        if (!is_valid(p_handle)) {
+            return false;
+        }
+        destroy_at(p_handle.index);
+        return true;
+    }
+
+    // Destroys all objects. Pages are kept.
+    void clear() {
+        for (size_t i = 0; i < m_pages.size(); ++i) {
+            Page &page = *m_pages[i];
+            while (page.live_mask != 0) {
+                destroy_at(static_cast<uint32_t>(i) * PAGE_SLOTS + find_first_bit(page.live_mask));
+            }
+        }
+
+        // Chained again in order, so the first slots are used first
+        m_free_head = m_pages.size() == 0 ? NO_SLOT : 0;
+        for (size_t i = 0; i < m_pages.size(); ++i) {
+            link_free_slots(*m_pages[i], static_cast<uint32_t>(i) * PAGE_SLOTS,
+                i + 1 < m_pages.size() ? static_cast<uint32_t>(i + 1) * PAGE_SLOTS : NO_SLOT);
+        }
+    }
+
+    inline size_t size() const {
+        return m_size;
+    }
+
+    inline bool is_empty() const {
+        return m_size == 0;
+    }
+
+    inline size_t capacity() const {
+        return m_pages.size() * PAGE_SLOTS;
+    }
+
+    Iterator begin() {
+        return Iterator(this, 0);
+    }
+
+    Iterator end() {
+        return Iterator(this, m_pages.size());
+    }
+
+    ConstIterator begin() const {
+        return ConstIterator(this, 0);
+    }
+
+    ConstIterator end() const {
+        return ConstIterator(this, m_pages.size());
+    }
+
+private:
+    Pool(const Pool &);
+    void operator=(const Pool &);
+
+    static const uint32_t NO_SLOT = 0xffffffff;
+
+    // Slot states are kept apart from objects, so objects are contiguous
+    struct Page {
+        uint64_t live_mask;
+        // Odd when the slot is used
+        uint32_t generations[PAGE_SLOTS];
+        // Only meaningful for free slots
+        uint32_t next_free[PAGE_SLOTS];
+        alignas(T) uint8_t objects[PAGE_SLOTS * sizeof(T)];
+
+        inline T &get_object(uint32_t p_slot) {
+            return reinterpret_cast<T*>(objects)[p_slot];
+        }
+
+        inline const T &get_object(uint32_t p_slot) const {
+            return reinterpret_cast<const T*>(objects)[p_slot];
+        }
+    };
+
+    inline Page &get_page(uint32_t p_index) {
+        return *m_pages[p_index / PAGE_SLOTS];
+    }
+
+    inline const Page &get_page(uint32_t p_index) const {
+        return *m_pages[p_index / PAGE_SLOTS];
+    }
+
+    void add_page() {
+        // Memory blocks are only guaranteed to be aligned to 16 bytes
+        static_assert(alignof(T) <= 16, "Over-aligned types are not supported");
+        assert(m_pages.size() < NO_SLOT / PAGE_SLOTS);
+
+        Page *page = static_cast<Page*>(memalloc(sizeof(Page)));
+        page->live_mask = 0;
+
+        for (uint32_t i = 0; i < PAGE_SLOTS; ++i) {
+            page->generations[i] = 0;
+        }
+
+        // Only happens when there are no free slots left, so the page is the whole free list
+        uint32_t first_index = static_cast<uint32_t>(m_pages.size()) * PAGE_SLOTS;
+        link_free_slots(*page, first_index, m_free_head);
+        m_free_head = first_index;
+
+        m_pages.push_back(page);
+    }
+
+    static void link_free_slots(Page &p_page, uint32_t p_first_index, uint32_t p_next_free) {
+        for (uint32_t i = 0; i + 1 < PAGE_SLOTS; ++i) {
+            p_page.next_free[i] = p_first_index + i + 1;
+        }
+        p_page.next_free[PAGE_SLOTS - 1] = p_next_free;
+    }
+
+    void destroy_at(uint32_t p_index) {
+        Page &page = get_page(p_index);
+        uint32_t slot = p_index % PAGE_SLOTS;
+
+        page.get_object(slot).~T();
+        // Handles to the destroyed object no longer match
+        ++page.generations[slot];
+        page.live_mask &= ~(uint64_t(1) << slot);
+        --m_size;
+
+        page.next_free[slot] = m_free_head;
+        m_free_head = p_index;
+    }
+
+    Vector<Page*> m_pages;
+    uint32_t m_free_head;
+    size_t m_size;
+};
+
+#endif // HEADER_POOL_H
@@ -0,0 +1,41 @@
+#ifndef HEADER_SPAN_H
+#define HEADER_SPAN_H
+
+#include "types.h"
+#include <cassert>
+
+// Non-owning view of contiguous elements. It is only valid as long as what it points to.
+template <typename T>
+class Span {
+public:
+    Span(): _data(nullptr), _size(0) {}
+    Span(T *p_data, size_t p_size): _data(p_data), _size(p_size) {}
+
+    inline T *data() const {
+        return _data;
+    }
+
+    inline size_t size() const {
+        return _size;
+    }
+
+    inline bool is_empty() const {
+        return _size == 0;
+    }
+
+    inline T &operator[](size_t p_index) const {
+        assert(p_index < _size);
+        return _data[p_index];
+    }
+
+    Span sub_span(size_t p_from, size_t p_size) const {
+        assert(p_from <= _size && p_size <= _size - p_from);
+        return Span(_data + p_from, p_size);
+    }
+
+private:
+    T *_data;
+    size_t _size;
+};
+
+#endif // HEADER_SPAN_H
@@ -1,31 +1,42 @@
 #include "string.h"
+#include "utf8.h"
+#include "number_format.h"
 
 // static
 
 //String::String(const String &other): Vector(other) { }
 
-String::String(const Char *p_cstr) {
-
-    size_t len = get_length(p_cstr);
-    resize_no_init(len + 1);
-    Char *d = data();
-    d[len] = 0;
-    memcpy(d, p_cstr, len * sizeof(Char));
+String::String(const char *p_cstr) {
+    *this += p_cstr;
 }
 
-String &String::operator+=(const char p_char) {
-    *this += (Char)p_char;
-    return *this;
+String::String(const wchar_t *p_wstr) {
+    *this += p_wstr;
 }
 
-String &String::operator+=(const Char p_char) {
+String &String::operator+=(const char p_char) {
     size_t i = length();
-    push_back(0);
+    resize_no_init(i + 2);
     Char *d = data();
     d[i] = p_char;
+    d[i + 1] = 0;
+    return *this;
+}
+
+String &String::operator+=(const wchar_t p_char) {
+    append_code_point(static_cast<uint32_t>(p_char));
     return *this;
 }
 
+void String::append_code_point(uint32_t p_code_point) {
+    size_t begin = length();
+    size_t len = UTF8::get_encoded_length(p_code_point);
+    resize_no_init(begin + len + 1);
+    Char *d = data() + begin;
+    UTF8::encode(p_code_point, d);
+    d[len] = 0;
+}
+
 String &String::operator+=(const char *p_cstr) {
 
     size_t begin = length();
@@ -33,22 +44,18 @@ String &String::operator+=(const char *p_cstr) {
     resize_no_init(begin + len + 1);
     Char *d = data() + begin;
     d[len] = 0;
-    // TODO Handle multibyte UTF-8
-    for(int i = 0; i < len; ++i) {
-        d[i] = p_cstr[i];
-    }
+    memcpy(d, p_cstr, len);
 
     return *this;
 }
 
-String &String::operator+=(const Char *p_cstr) {
+String &String::operator+=(const wchar_t *p_wstr) {
 
+    size_t wlen = get_length(p_wstr);
     size_t begin = length();
-    size_t len = get_length(p_cstr);
+    size_t len = UTF8::from_wide(p_wstr, wlen, nullptr);
     resize_no_init(begin + len + 1);
-    Char *d = data() + begin;
-    d[len] = 0;
-    memcpy(d, p_cstr, len * sizeof(Char));
+    UTF8::from_wide(p_wstr, wlen, data() + begin);
 
     return *this;
 }
@@ -66,6 +73,12 @@ String &String::operator+=(const String &p_other) {
     return *this;
 }
 
+void String::to_wide(Vector<wchar_t> &out_wstr) const {
+    size_t len = UTF8::to_wide(data(), length(), nullptr);
+    out_wstr.resize_no_init(len + 1);
+    UTF8::to_wide(data(), length(), out_wstr.data());
+}
+
 void String::append_region(const Char *p_cstr, size_t from, size_t len) {
 
     // TODO Check this only in debug
@@ -115,6 +128,23 @@ void append_int(String &p_dst, int64_t p_num, int base, bool capitalize_hex) {
 
     bool sign = p_num < 0;
 
+    if (base == 10) {
+        // Common case, written two digits at a time
+        uint64_t u = sign ? 0 - static_cast<uint64_t>(p_num) : static_cast<uint64_t>(p_num);
+        size_t digits = NumberFormat::count_digits(u);
+        size_t chars = digits + (sign ? 1 : 0);
+
+        size_t prev_len = p_dst.length();
+        p_dst.resize_no_init(prev_len + chars + 1);
+        Char *dst = p_dst.data() + prev_len;
+
+        if (sign)
+            dst[0] = '-';
+        NumberFormat::write_digits(u, digits, dst + chars - digits);
+        dst[chars] = 0;
+        return;
+    }
+
     int64_t n = p_num;
 
     int chars = 0;
@@ -149,3 +179,35 @@ void append_int(String &p_dst, int64_t p_num, int base, bool capitalize_hex) {
         dst[0] = '-';
 }
 
+template <typename T>
+static void append_float_t(String &p_dst, T p_num) {
+    // Written on the stack first, so short strings can stay inline
+    char buffer[NumberFormat::MAX_LENGTH + 1];
+    size_t len = NumberFormat::write_shortest(p_num, buffer);
+    buffer[len] = 0;
+    p_dst.append_region(buffer, 0, len);
+}
+
+void append_float(String &p_dst, double p_num) {
+    append_float_t(p_dst, p_num);
+}
+
+void append_float(String &p_dst, float p_num) {
+    append_float_t(p_dst, p_num);
+}
+
+void append_float_fixed(String &p_dst, double p_num, int p_decimals) {
+    char buffer[NumberFormat::MAX_FIXED_LENGTH + 1];
+    size_t len = NumberFormat::write_fixed(p_num, p_decimals, buffer);
+    buffer[len] = 0;
+    p_dst.append_region(buffer, 0, len);
+}
+
+
+uint64_t Hasher<const char *>::hash(const String &k) {
+    return Hash::hash_chars(k.data(), k.length());
+}
+
+bool Hasher<const char *>::equals(const char *a, const String &b) {
+    return chars_equal(a, b.c_str());
+}
@@ -3,12 +3,16 @@
 
 #include "vector.h"
 #include "math/math_funcs.h"
+#include "hash_table.h"
+#include "format.h"
 
-// Encapsulates a zero-terminated string inside a Vector structure
-class String : public Vector<Char, 20> {
+// Encapsulates a zero-terminated UTF-8 string inside a Vector structure.
+// Short strings are stored inline.
+// Wide strings are converted when appended, and with to_wide() for APIs requiring them.
+class String : public Vector<Char, 24> {
 public:
 
-    static const Char ESCAPE_CHAR = L'\\';
+    static const Char ESCAPE_CHAR = '\\';
 
     template <typename C>
     static size_t get_length(const C *p_cstr) {
@@ -21,23 +25,35 @@ public:
 
     String() { }
     //String(const String &other);
-    String(const Char *p_cstr);
+    String(const char *p_cstr);
+    String(const wchar_t *p_wstr);
 
-    String &String::operator+=(const char p_cstr);
-    String &String::operator+=(const Char p_cstr);
-    String &String::operator+=(const char *p_cstr);
-    String &String::operator+=(const Char *p_cstr);
-    String &String::operator+=(const String &p_other);
+    String &operator+=(const char p_char);
+    // Wide characters are taken as code points
+    String &operator+=(const wchar_t p_char);
+    String &operator+=(const char *p_cstr);
+    String &operator+=(const wchar_t *p_wstr);
+    String &operator+=(const String &p_other);
+
+    void append_code_point(uint32_t p_code_point);
 
     void append_region(const Char *p_cstr, size_t from, size_t len);
     void append_region(const String &p_str, size_t from, size_t len);
 
-    // Length does not include '\0'
+    // Length in bytes, not including '\0'
     inline size_t length() const {
         size_t s = size();
         return s == 0 ? 0 : s - 1;
     }
 
+    // Zero-terminated even when the string is empty
+    inline const Char *c_str() const {
+        return size() == 0 ? "" : data();
+    }
+
+    // For APIs requiring wide strings. The result is zero-terminated.
+    void to_wide(Vector<wchar_t> &out_wstr) const;
+
     static bool find_not_escaped(const Char *str, size_t len, Char p_c, size_t & out_index, size_t p_from = 0);
 
     bool find_not_escaped(Char p_c, size_t & out_index, size_t p_from = 0) {
@@ -52,9 +68,9 @@ private:
             return from;
 
         size_t placeholder_pos = 0;
-        if (find_not_escaped(src, src_len, L'%', placeholder_pos, from)) {
+        if (find_not_escaped(src, src_len, '%', placeholder_pos, from)) {
 
-            dst.append_region(src, from, placeholder_pos);
+            dst.append_region(src, from, placeholder_pos - from);
             to_string(dst, arg);
 
             return placeholder_pos + 1;
@@ -88,6 +104,71 @@ public:
         return dst;
     }
 
+private:
+    // Appends literal pieces up to the next argument, and returns the index of the piece after it
+    static size_t _format_literals(String &dst, const Char *src, const ParsedFormat &format, size_t i) {
+        for (; i < format.piece_count; ++i) {
+            const ParsedFormat::Piece &piece = format.pieces[i];
+            dst._append_unchecked(src + piece.begin, piece.end - piece.begin);
+            if (piece.argument_after) {
+                return i + 1;
+            }
+        }
+        return i;
+    }
+
+    static void _format_pieces(String &dst, const Char *src, const ParsedFormat &format, size_t i) {
+        _format_literals(dst, src, format, i);
+    }
+
+    template <typename A, typename... Args>
+    static void _format_pieces(String &dst, const Char *src, const ParsedFormat &format, size_t i,
+            const A &arg, const Args &... args) {
+        i = _format_literals(dst, src, format, i);
+        to_string(dst, arg);
+        _format_pieces(dst, src, format, i, args...);
+    }
+
+    static inline size_t _format_size_hint() {
+        return 0;
+    }
+
+    template <typename A, typename... Args>
+    static inline size_t _format_size_hint(const A &arg, const Args &... args) {
+        return format_size_hint(arg) + _format_size_hint(args...);
+    }
+
+    // Same as append_region, without checking the source length
+    void _append_unchecked(const Char *p_src, size_t p_len) {
+        if (p_len != 0) {
+            size_t begin = length();
+            resize_no_init(begin + p_len + 1);
+            Char *d = data() + begin;
+            memcpy(d, p_src, p_len * sizeof(Char));
+            d[p_len] = 0;
+        }
+    }
+
+public:
+    // Formats with a string parsed at compile time, see FMT.
+    // The destination is reserved once from an estimate of the output size.
+    template <typename F, typename... Args>
+    void append_format(FormatLiteral<F>, const Args &... args) {
+        static constexpr ParsedFormat FORMAT = parse_format(F::get());
+        static_assert(!FORMAT.too_many_pieces, "Format string has too many placeholders");
+        static_assert(FORMAT.placeholder_count == sizeof...(Args), "Number of arguments doesn't match the format string");
+
+        reserve(length() + FORMAT.literal_length + _format_size_hint(args...) + 1);
+        _format_pieces(*this, F::get(), FORMAT, 0, args...);
+    }
+
+    template <typename F, typename... Args>
+    static String format(FormatLiteral<F> p_format, const Args &... args) {
+        String dst;
+        dst.append_format(p_format, args...);
+        return dst;
+    }
+
 /*private:
     template <typename A>
     static void concat(String &dst, A arg) {
@@ -109,14 +190,29 @@ inline void to_string(String &dst, const String &s) {
 
 void append_int(String &p_dst, int64_t p_num, int base = 10, bool capitalize_hex = false);
 
+// Shortest text reading back as the same number, see NumberFormat::write_shortest
+void append_float(String &p_dst, double p_num);
+void append_float(String &p_dst, float p_num);
+
+// With a fixed number of decimals, see NumberFormat::write_fixed
+void append_float_fixed(String &p_dst, double p_num, int p_decimals);
+
 inline void to_string(String &dst, char p_char) {
     dst += p_char;
 }
 
-inline void to_string(String &dst, Char p_char) {
+inline void to_string(String &dst, wchar_t p_char) {
     dst += p_char;
 }
 
+inline void to_string(String &dst, const char *p_cstr) {
+    dst += p_cstr;
+}
+
+inline void to_string(String &dst, const wchar_t *p_wstr) {
+    dst += p_wstr;
+}
+
 inline void to_string(String &dst, int64_t p_num) {
     append_int(dst, p_num);
 }
@@ -125,10 +221,42 @@ inline void to_string(String &dst, int p_num) {
     append_int(dst, p_num);
 }
 
+inline void to_string(String &dst, float p_num) {
+    append_float(dst, p_num);
+}
+
+inline void to_string(String &dst, double p_num) {
+    append_float(dst, p_num);
+}
+
 inline void to_string(String &dst, void *ptr) {
     append_int(dst, (size_t)ptr, 16);
 }
 
+inline size_t format_size_hint(const String &s) {
+    return s.length();
+}
+
+// Strings can be looked up with C strings
+template <>
+struct Hasher<String> {
+    static inline uint64_t hash(const String &k) {
+        return Hash::hash_chars(k.data(), k.length());
+    }
+
+    static inline uint64_t hash(const char *k) {
+        return Hash::hash_chars(k);
+    }
+
+    static inline bool equals(const String &a, const String &b) {
+        return a.length() == b.length() && memcmp(a.data(), b.data(), a.length()) == 0;
+    }
+
+    static inline bool equals(const String &a, const char *b) {
+        return chars_equal(a.c_str(), b);
+    }
+};
+
 // Shortcut if we need the easy version
 template <typename T>
 String to_string(const T &x) {
@@ -0,0 +1,102 @@
+#include "string_name.h"
+#include <atomic>
+#include <mutex>
+
+// Fixed amount of buckets, so readers never see the table being resized.
+// Chains only get long with many thousands of names.
+static const size_t BUCKET_COUNT = 4096;
+
+// Nodes are immutable once published and never removed before cleanup, so readers only need acquire loads
+static std::atomic<StringName::Data*> g_buckets[BUCKET_COUNT];
+static std::atomic<size_t> g_count(0);
+
+// Only taken to insert new names
+static std::mutex &get_write_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static const StringName::Data *find(std::atomic<StringName::Data*> &bucket, const char *p_cstr, size_t p_len, uint64_t p_hash) {
+    for (const StringName::Data *d = bucket.load(std::memory_order_acquire); d != nullptr; d = d->next) {
+        if (d->hash == p_hash && d->length == p_len && memcmp(d->str, p_cstr, p_len) == 0) {
+            return d;
+        }
+    }
+    return nullptr;
+}
+
+static const StringName::Data *intern(const char *p_cstr, size_t p_len) {
+
+    if (p_len == 0) {
+        return nullptr;
+    }
+
+    uint64_t hash = Hash::hash_chars(p_cstr, p_len);
+    std::atomic<StringName::Data*> &bucket = g_buckets[hash & (BUCKET_COUNT - 1)];
+
+    const StringName::Data *existing = find(bucket, p_cstr, p_len, hash);
+    if (existing != nullptr) {
+        return existing;
+    }
+
+    std::lock_guard<std::mutex> lock(get_write_mutex());
+
+    // Another thread may have added it in the meantime
+    existing = find(bucket, p_cstr, p_len, hash);
+    if (existing != nullptr) {
+        return existing;
+    }
+
+    StringName::Data *d = static_cast<StringName::Data*>(memalloc(sizeof(StringName::Data) + p_len));
+    d->hash = hash;
+    d->length = p_len;
+    memcpy(d->str, p_cstr, p_len);
+    d->str[p_len] = 0;
+    d->next = bucket.load(std::memory_order_relaxed);
+
+    bucket.store(d, std::memory_order_release);
+    ++g_count;
+
+    return d;
+}
+
+StringName::StringName(const char *p_cstr) {
+    _data = intern(p_cstr, strlen(p_cstr));
+}
+
+StringName::StringName(const char *p_cstr, size_t p_len) {
+    _data = intern(p_cstr, p_len);
+}
+
+StringName::StringName(const String &p_str) {
+    _data = intern(p_str.c_str(), p_str.length());
+}
+
+// Static
+StringName StringName::find(const char *p_cstr) {
+    size_t len = strlen(p_cstr);
+    if (len == 0) {
+        return StringName();
+    }
+    uint64_t hash = Hash::hash_chars(p_cstr, len);
+    return StringName(::find(g_buckets[hash & (BUCKET_COUNT - 1)], p_cstr, len, hash));
+}
+
+void StringName::cleanup() {
+    std::lock_guard<std::mutex> lock(get_write_mutex());
+
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        Data *d = g_buckets[i].exchange(nullptr);
+        while (d != nullptr) {
+            Data *next = d->next;
+            memfree(d);
+            d = next;
+        }
+    }
+
+    g_count = 0;
+}
+
+size_t StringName::get_count() {
+    return g_count;
+}
@@ -0,0 +1,83 @@
+#ifndef HEADER_STRING_NAME_H
+#define HEADER_STRING_NAME_H
+
+#include "string.h"
+
+// Interned string, for identifiers compared or looked up often.
+// All StringNames with the same content share the same data, so equality and hashing only involve a pointer.
+// Creating one from a string looks up a global table, which is thread-safe and doesn't lock when the name exists.
+// Names stay allocated until cleanup().
+class StringName {
+public:
+    StringName(): _data(nullptr) {}
+    StringName(const char *p_cstr);
+    StringName(const char *p_cstr, size_t p_len);
+    StringName(const String &p_str);
+
+    inline bool operator==(const StringName &p_other) const {
+        return _data == p_other._data;
+    }
+
+    inline bool operator!=(const StringName &p_other) const {
+        return _data != p_other._data;
+    }
+
+    inline bool is_empty() const {
+        return _data == nullptr;
+    }
+
+    inline const char *c_str() const {
+        return _data == nullptr ? "" : _data->str;
+    }
+
+    inline size_t length() const {
+        return _data == nullptr ? 0 : _data->length;
+    }
+
+    // Hash of the content, same as Hash::hash_chars()
+    inline uint64_t get_hash() const {
+        return _data == nullptr ? Hash::hash_chars("", 0) : _data->hash;
+    }
+
+    // Returns the name if it exists, or an empty one, without adding it.
+    // For lookups of strings that may not be names, so they don't stay allocated.
+    static StringName find(const char *p_cstr);
+
+    // Frees all names. Must only be called when no StringName is used anymore.
+    static void cleanup();
+
+    static size_t get_count();
+
+    struct Data {
+        Data *next;
+        uint64_t hash;
+        size_t length;
+        char str[1];
+    };
+
+private:
+    StringName(const Data *p_data): _data(p_data) {}
+
+    const Data *_data;
+};
+
+inline void to_string(String &dst, const StringName &p_name) {
+    dst += p_name.c_str();
+}
+
+inline size_t format_size_hint(const StringName &p_name) {
+    return p_name.length();
+}
+
+template <>
+struct Hasher<StringName> {
+    static inline uint64_t hash(const StringName &k) {
+        return k.get_hash();
+    }
+
+    static inline bool equals(const StringName &a, const StringName &b) {
+        return a == b;
+    }
+};
+
+#endif // HEADER_STRING_NAME_H
@@ -0,0 +1,378 @@
+#include "trace.h"
+#include "log.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#include "utf8.h"
+#include "vector.h"
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h> // __rdtsc
+#define TRACE_USE_TSC
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h> // __rdtsc
+#define TRACE_USE_TSC
+#endif
+
+namespace Trace {
+
+static const size_t MAX_EVENTS = 1024;
+// Records are copied to the file by blocks of this many, 8 KiB
+static const uint32_t BUFFER_RECORDS = 256;
+
+std::atomic<bool> _enabled;
+
+// Guards the registry and the file. Only taken when a buffer is flushed, or when an event is constructed.
+static std::mutex g_mutex;
+static const char *g_event_names[MAX_EVENTS];
+static size_t g_event_count;
+
+// Incremented by start(), so records buffered before a previous stop() are not written to the next file
+static std::atomic<uint32_t> g_session;
+static std::atomic<uint32_t> g_thread_count;
+
+struct MappedOutput {
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    uint8_t *data;
+    size_t record_capacity;
+    std::chrono::steady_clock::time_point start_time;
+
+    inline FileHeader &get_header() {
+        return *reinterpret_cast<FileHeader*>(data);
+    }
+
+    inline Record *get_records() {
+        return reinterpret_cast<Record*>(data + sizeof(FileHeader));
+    }
+};
+
+static MappedOutput g_output;
+
+// Invariant TSC on x86, as it is much cheaper than steady_clock. Converted using the rate measured in the header.
+static inline uint64_t get_ticks() {
+#ifdef TRACE_USE_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static bool map_output(MappedOutput &output, const char *p_fpath, size_t p_size) {
+#ifdef _WIN32
+    size_t len = strlen(p_fpath);
+    Vector<wchar_t> wpath;
+    wpath.resize_no_init(UTF8::to_wide(p_fpath, len, nullptr) + 1);
+    UTF8::to_wide(p_fpath, len, wpath.data());
+
+    output.file = CreateFileW(wpath.data(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+        nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (output.file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    uint64_t size = p_size;
+    output.mapping = CreateFileMappingW(output.file, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+    if (output.mapping == nullptr) {
+        CloseHandle(output.file);
+        return false;
+    }
+
+    output.data = static_cast<uint8_t*>(MapViewOfFile(output.mapping, FILE_MAP_WRITE, 0, 0, p_size));
+    if (output.data == nullptr) {
+        CloseHandle(output.mapping);
+        CloseHandle(output.file);
+        return false;
+    }
+#else
+    output.fd = open(p_fpath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (output.fd == -1) {
+        return false;
+    }
+
+    // Reserved as a sparse file, pages are only allocated once written
+    if (ftruncate(output.fd, p_size) != 0) {
+        close(output.fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, p_size, PROT_READ | PROT_WRITE, MAP_SHARED, output.fd, 0);
+    if (data == MAP_FAILED) {
+        close(output.fd);
+        return false;
+    }
+    output.data = static_cast<uint8_t*>(data);
+#endif
+    return true;
+}
+
+// The file is truncated to what was written
+static void unmap_output(MappedOutput &output, size_t p_used_size) {
+#ifdef _WIN32
+    UnmapViewOfFile(output.data);
+    CloseHandle(output.mapping);
+    LARGE_INTEGER size;
+    size.QuadPart = p_used_size;
+    SetFilePointerEx(output.file, size, nullptr, FILE_BEGIN);
+    SetEndOfFile(output.file);
+    CloseHandle(output.file);
+#else
+    munmap(output.data, sizeof(FileHeader) + output.record_capacity * sizeof(Record));
+    // If it fails, the end of the file stays zeroed and readers rely on the record count
+    int result = ftruncate(output.fd, p_used_size);
+    (void)result;
+    close(output.fd);
+#endif
+    output.data = nullptr;
+}
+
+// Expects the mutex to be locked
+static void update_header_time(MappedOutput &output) {
+    FileHeader &header = output.get_header();
+    header.end_ticks = get_ticks();
+    header.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - output.start_time).count();
+}
+
+// Expects the mutex to be locked
+static void write_records(MappedOutput &output, const Record *p_records, size_t p_count) {
+    FileHeader &header = output.get_header();
+
+    size_t count = p_count;
+    if (header.record_count + count > output.record_capacity) {
+        count = output.record_capacity - header.record_count;
+        header.dropped_count += p_count - count;
+    }
+
+    memcpy(output.get_records() + header.record_count, p_records, count * sizeof(Record));
+    header.record_count += count;
+    update_header_time(output);
+}
+
+// Expects the mutex to be locked
+static void write_event_name(MappedOutput &output, uint16_t p_event, const char *p_name) {
+    Record records[MAX_EVENT_NAME_LENGTH / sizeof(Record::payload)];
+    memset(records, 0, sizeof(records));
+
+    size_t len = strlen(p_name);
+    if (len > MAX_EVENT_NAME_LENGTH) {
+        len = MAX_EVENT_NAME_LENGTH;
+    }
+
+    const size_t chunk_size = sizeof(Record::payload);
+    size_t chunk_count = len == 0 ? 1 : (len + chunk_size - 1) / chunk_size;
+
+    for (size_t i = 0; i < chunk_count; ++i) {
+        Record &r = records[i];
+        r.event = p_event;
+        r.phase = PHASE_NAME;
+        r.name_chunk = static_cast<uint8_t>(i);
+        size_t begin = i * chunk_size;
+        memcpy(r.payload, p_name + begin, len - begin < chunk_size ? len - begin : chunk_size);
+    }
+
+    write_records(output, records, chunk_count);
+}
+
+Event::Event(const char *p_name) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+
+    if (g_event_count + 1 >= MAX_EVENTS) {
+        // Not recorded
+        _id = 0;
+        return;
+    }
+
+    // Zero is left for events not constructed yet
+    ++g_event_count;
+    g_event_names[g_event_count] = p_name;
+    _id = static_cast<uint16_t>(g_event_count);
+
+    if (g_output.data != nullptr) {
+        write_event_name(g_output, _id, p_name);
+    }
+}
+
+// Allocated with malloc, as allocations can be traced themselves
+struct ThreadBuffer {
+    Record records[BUFFER_RECORDS];
+    uint32_t count;
+    uint32_t thread;
+    uint32_t session;
+};
+
+static thread_local ThreadBuffer *t_buffer = nullptr;
+static thread_local bool t_thread_exited = false;
+
+static void flush_buffer(ThreadBuffer &buffer) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_output.data != nullptr && buffer.session == g_session.load(std::memory_order_relaxed)) {
+        write_records(g_output, buffer.records, buffer.count);
+    }
+    buffer.count = 0;
+}
+
+// Writes and releases the buffer of a thread when it exits
+struct ThreadExitHandler {
+    ThreadBuffer *buffer = nullptr;
+
+    ~ThreadExitHandler() {
+        t_buffer = nullptr;
+        t_thread_exited = true;
+        if (buffer != nullptr) {
+            if (buffer->count != 0) {
+                flush_buffer(*buffer);
+            }
+            ::free(buffer);
+        }
+    }
+};
+
+static thread_local ThreadExitHandler t_exit_handler;
+
+static ThreadBuffer *create_thread_buffer() {
+    if (t_thread_exited) {
+        return nullptr;
+    }
+
+    ThreadBuffer *buffer = static_cast<ThreadBuffer*>(::malloc(sizeof(ThreadBuffer)));
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+    buffer->count = 0;
+    buffer->thread = g_thread_count.fetch_add(1, std::memory_order_relaxed);
+    buffer->session = 0;
+
+    // Constructs the handler, so it runs when the thread exits
+    t_exit_handler.buffer = buffer;
+    t_buffer = buffer;
+    return buffer;
+}
+
+void _record(uint16_t p_event, Phase p_phase, uint64_t p_a, uint64_t p_b) {
+    ThreadBuffer *buffer = t_buffer;
+    if (buffer == nullptr) {
+        buffer = create_thread_buffer();
+        if (buffer == nullptr) {
+            return;
+        }
+    }
+
+    // Leftovers of a previous trace are discarded
+    uint32_t session = g_session.load(std::memory_order_relaxed);
+    if (buffer->session != session) {
+        buffer->count = 0;
+        buffer->session = session;
+    }
+
+    Record &r = buffer->records[buffer->count];
+    r.timestamp = get_ticks();
+    r.thread = buffer->thread;
+    r.event = p_event;
+    r.phase = static_cast<uint8_t>(p_phase);
+    r.name_chunk = 0;
+    r.payload[0] = p_a;
+    r.payload[1] = p_b;
+
+    ++buffer->count;
+    if (buffer->count == BUFFER_RECORDS) {
+        flush_buffer(*buffer);
+    }
+}
+
+bool start(const char *p_fpath, size_t p_max_bytes) {
+    // Logged after unlocking, logging allocates and allocations are traced
+    bool already_started = false;
+    bool mapped = false;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+
+        if (g_output.data != nullptr) {
+            already_started = true;
+
+        } else {
+            size_t record_capacity = p_max_bytes > sizeof(FileHeader) ? (p_max_bytes - sizeof(FileHeader)) / sizeof(Record) : 0;
+            // Room for names and at least one buffer
+            if (record_capacity < g_event_count * (MAX_EVENT_NAME_LENGTH / sizeof(Record::payload)) + BUFFER_RECORDS) {
+                record_capacity = g_event_count * (MAX_EVENT_NAME_LENGTH / sizeof(Record::payload)) + BUFFER_RECORDS;
+            }
+
+            mapped = map_output(g_output, p_fpath, sizeof(FileHeader) + record_capacity * sizeof(Record));
+            if (mapped) {
+                g_output.record_capacity = record_capacity;
+                g_output.start_time = std::chrono::steady_clock::now();
+
+                FileHeader &header = g_output.get_header();
+                memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+                header.version = FILE_VERSION;
+                header.record_size = sizeof(Record);
+                header.record_count = 0;
+                header.dropped_count = 0;
+                header.start_ticks = get_ticks();
+                update_header_time(g_output);
+
+                for (size_t i = 1; i <= g_event_count; ++i) {
+                    write_event_name(g_output, static_cast<uint16_t>(i), g_event_names[i]);
+                }
+
+                g_session.fetch_add(1, std::memory_order_relaxed);
+                _enabled.store(true, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    if (already_started) {
+        LOG_ERROR("A trace is already being recorded");
+        return false;
+    }
+    if (!mapped) {
+        LOG_ERROR("Could not create trace file ", p_fpath);
+        return false;
+    }
+    return true;
+}
+
+void stop() {
+    flush();
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_output.data == nullptr) {
+        return;
+    }
+
+    _enabled.store(false, std::memory_order_relaxed);
+    update_header_time(g_output);
+    unmap_output(g_output, sizeof(FileHeader) + g_output.get_header().record_count * sizeof(Record));
+}
+
+void flush() {
+    ThreadBuffer *buffer = t_buffer;
+    if (buffer != nullptr && buffer->count != 0) {
+        flush_buffer(*buffer);
+    }
+}
+
+// Closes the file if it is still open when static objects are destroyed.
+// Buffers of the main thread are written before, when its thread-local objects are destroyed.
+static struct Shutdown {
+    ~Shutdown() {
+        stop();
+    }
+} g_shutdown;
+
+} // namespace Trace
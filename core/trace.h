@@ -0,0 +1,147 @@
+#ifndef HEADER_TRACE_H
+#define HEADER_TRACE_H
+
+#include "types.h"
+#include <atomic>
+
+// Binary log of high-frequency events, cheap enough to stay enabled in release builds.
+// Events are fixed-size records written to a buffer of the calling thread,
+// which is copied to a memory-mapped file when it is full.
+// `trace_convert` decodes the file to text or to Chrome trace JSON (chrome://tracing, Perfetto).
+//
+//     static Trace::Event s_upload_event("upload");
+//     ...
+//     TRACE_SCOPE(s_upload_event, size);
+//
+// Recording costs a relaxed load when no trace is started.
+namespace Trace {
+
+enum Phase {
+    // Declares the name of an event, 16 characters at a time
+    PHASE_NAME = 0,
+    PHASE_BEGIN,
+    PHASE_END,
+    PHASE_INSTANT,
+    // The first value of the payload is a signed value
+    PHASE_COUNTER
+};
+
+static const char FILE_MAGIC[8] = { 'T', 'R', 'A', 'C', 'E', 'B', 'I', 'N' };
+static const uint32_t FILE_VERSION = 1;
+
+// The file starts with this header, followed by records in the order buffers were flushed.
+// Records of the same thread are in order, records of different threads have to be sorted by timestamp.
+// It is updated at every flush, so the file is readable if the program stops without calling stop().
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    // Records lost because the file was full
+    uint64_t dropped_count;
+    // Timestamps are in ticks of a clock whose rate is measured between the start and the last flush
+    uint64_t start_ticks;
+    uint64_t end_ticks;
+    uint64_t elapsed_ns;
+};
+
+struct Record {
+    uint64_t timestamp;
+    uint32_t thread;
+    uint16_t event;
+    uint8_t phase;
+    // Index of the 16 characters held by the payload of a name record
+    uint8_t name_chunk;
+    uint64_t payload[2];
+};
+
+static_assert(sizeof(Record) == 32, "Records are expected to be 32 bytes");
+
+static const size_t MAX_EVENT_NAME_LENGTH = 4 * sizeof(Record::payload);
+
+// Identifies a kind of event. Meant to be static, its name must outlive it.
+class Event {
+public:
+    Event(const char *p_name);
+
+    // Zero until the event is constructed
+    inline uint16_t get_id() const { return _id; }
+
+private:
+    Event(const Event &);
+    void operator=(const Event &);
+
+    uint16_t _id;
+};
+
+// Starts recording into a new file of up to `p_max_bytes`. Events past that are dropped.
+bool start(const char *p_fpath, size_t p_max_bytes = 64 * 1024 * 1024);
+
+// Writes the buffer of the calling thread and closes the file.
+// Records still buffered by other threads are lost, unless they called flush() before.
+void stop();
+
+// Writes the buffer of the calling thread to the file
+void flush();
+
+extern std::atomic<bool> _enabled;
+
+void _record(uint16_t p_event, Phase p_phase, uint64_t p_a, uint64_t p_b);
+
+inline bool is_enabled() {
+    return _enabled.load(std::memory_order_relaxed);
+}
+
+inline void begin(const Event &p_event, uint64_t p_a = 0, uint64_t p_b = 0) {
+    if (is_enabled() && p_event.get_id() != 0) {
+        _record(p_event.get_id(), PHASE_BEGIN, p_a, p_b);
+    }
+}
+
+inline void end(const Event &p_event, uint64_t p_a = 0, uint64_t p_b = 0) {
+    if (is_enabled() && p_event.get_id() != 0) {
+        _record(p_event.get_id(), PHASE_END, p_a, p_b);
+    }
+}
+
+inline void instant(const Event &p_event, uint64_t p_a = 0, uint64_t p_b = 0) {
+    if (is_enabled() && p_event.get_id() != 0) {
+        _record(p_event.get_id(), PHASE_INSTANT, p_a, p_b);
+    }
+}
+
+inline void counter(const Event &p_event, int64_t p_value) {
+    if (is_enabled() && p_event.get_id() != 0) {
+        _record(p_event.get_id(), PHASE_COUNTER, static_cast<uint64_t>(p_value), 0);
+    }
+}
+
+// Records the beginning and the end of an event in the current scope
+class Scope {
+public:
+    inline Scope(const Event &p_event, uint64_t p_a = 0, uint64_t p_b = 0): _event(p_event) {
+        _recorded = is_enabled() && p_event.get_id() != 0;
+        if (_recorded) {
+            _record(p_event.get_id(), PHASE_BEGIN, p_a, p_b);
+        }
+    }
+
+    inline ~Scope() {
+        if (_recorded) {
+            _record(_event.get_id(), PHASE_END, 0, 0);
+        }
+    }
+
+private:
+    const Event &_event;
+    bool _recorded;
+};
+
+} // namespace Trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_SCOPE(...) Trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif // HEADER_TRACE_H
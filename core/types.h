@@ -3,7 +3,8 @@
 
 #include <cstddef>
 
-typedef wchar_t Char;
+// Code unit of String, which is encoded in UTF-8
+typedef char Char;
 
 #ifdef _MSC_VER
 
@@ -0,0 +1,184 @@
+#include "utf8.h"
+
+namespace UTF8 {
+
+static inline bool is_surrogate(uint32_t c) {
+    return c >= 0xd800 && c <= 0xdfff;
+}
+
+size_t get_encoded_length(uint32_t c) {
+    if (c < 0x80) {
+        return 1;
+    } else if (c < 0x800) {
+        return 2;
+    } else if (c < 0x10000) {
+        return 3;
+    } else if (c <= 0x10ffff) {
+        return 4;
+    }
+    // Encoded as a replacement character
+    return 3;
+}
+
+size_t encode(uint32_t c, char *out_bytes) {
+    uint8_t *dst = reinterpret_cast<uint8_t*>(out_bytes);
+
+    if (c > 0x10ffff || is_surrogate(c)) {
+        c = REPLACEMENT_CHARACTER;
+    }
+
+    if (c < 0x80) {
+        dst[0] = static_cast<uint8_t>(c);
+        return 1;
+
+    } else if (c < 0x800) {
+        dst[0] = static_cast<uint8_t>(0xc0 | (c >> 6));
+        dst[1] = static_cast<uint8_t>(0x80 | (c & 0x3f));
+        return 2;
+
+    } else if (c < 0x10000) {
+        dst[0] = static_cast<uint8_t>(0xe0 | (c >> 12));
+        dst[1] = static_cast<uint8_t>(0x80 | ((c >> 6) & 0x3f));
+        dst[2] = static_cast<uint8_t>(0x80 | (c & 0x3f));
+        return 3;
+
+    } else {
+        dst[0] = static_cast<uint8_t>(0xf0 | (c >> 18));
+        dst[1] = static_cast<uint8_t>(0x80 | ((c >> 12) & 0x3f));
+        dst[2] = static_cast<uint8_t>(0x80 | ((c >> 6) & 0x3f));
+        dst[3] = static_cast<uint8_t>(0x80 | (c & 0x3f));
+        return 4;
+    }
+}
+
+uint32_t decode(const char *p_str, size_t p_len, size_t &io_pos) {
+    const uint8_t *s = reinterpret_cast<const uint8_t*>(p_str);
+    size_t i = io_pos;
+    uint8_t b0 = s[i];
+
+    if (b0 < 0x80) {
+        io_pos = i + 1;
+        return b0;
+    }
+
+    size_t count;
+    uint32_t c;
+    uint32_t min;
+    if ((b0 & 0xe0) == 0xc0) {
+        count = 1;
+        c = b0 & 0x1f;
+        min = 0x80;
+    } else if ((b0 & 0xf0) == 0xe0) {
+        count = 2;
+        c = b0 & 0x0f;
+        min = 0x800;
+    } else if ((b0 & 0xf8) == 0xf0) {
+        count = 3;
+        c = b0 & 0x07;
+        min = 0x10000;
+    } else {
+        // Stray continuation byte or invalid lead byte
+        io_pos = i + 1;
+        return REPLACEMENT_CHARACTER;
+    }
+
+    for (size_t j = 1; j <= count; ++j) {
+        if (i + j >= p_len || (s[i + j] & 0xc0) != 0x80) {
+            // Truncated sequence, resume at the byte that broke it
+            io_pos = i + j;
+            return REPLACEMENT_CHARACTER;
+        }
+        c = (c << 6) | (s[i + j] & 0x3f);
+    }
+
+    io_pos = i + count + 1;
+
+    // Overlong encodings, surrogates and out of range values are invalid
+    if (c < min || c > 0x10ffff || is_surrogate(c)) {
+        return REPLACEMENT_CHARACTER;
+    }
+    return c;
+}
+
+bool is_valid(const char *p_str, size_t p_len) {
+    size_t i = 0;
+    while (i < p_len) {
+        size_t begin = i;
+        uint32_t c = decode(p_str, p_len, i);
+        if (c == REPLACEMENT_CHARACTER) {
+            // Could be a legit replacement character
+            char expected[MAX_SEQUENCE_LENGTH];
+            size_t len = encode(REPLACEMENT_CHARACTER, expected);
+            if (i - begin != len || p_str[begin] != expected[0]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+size_t count_code_points(const char *p_str, size_t p_len) {
+    size_t count = 0;
+    size_t i = 0;
+    while (i < p_len) {
+        decode(p_str, p_len, i);
+        ++count;
+    }
+    return count;
+}
+
+size_t from_wide(const wchar_t *p_wstr, size_t p_wlen, char *out_str) {
+    size_t len = 0;
+    char temp[MAX_SEQUENCE_LENGTH];
+
+    for (size_t i = 0; i < p_wlen; ++i) {
+        uint32_t c = static_cast<uint32_t>(p_wstr[i]);
+
+        if (sizeof(wchar_t) == 2 && c >= 0xd800 && c <= 0xdbff && i + 1 < p_wlen) {
+            // UTF-16 surrogate pair
+            uint32_t low = static_cast<uint32_t>(p_wstr[i + 1]);
+            if (low >= 0xdc00 && low <= 0xdfff) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                ++i;
+            }
+        }
+
+        len += encode(c, out_str != nullptr ? out_str + len : temp);
+    }
+
+    if (out_str != nullptr) {
+        out_str[len] = 0;
+    }
+    return len;
+}
+
+size_t to_wide(const char *p_str, size_t p_len, wchar_t *out_wstr) {
+    size_t len = 0;
+    size_t i = 0;
+
+    while (i < p_len) {
+        uint32_t c = decode(p_str, p_len, i);
+
+        if (sizeof(wchar_t) == 2 && c >= 0x10000) {
+            if (out_wstr != nullptr) {
+                c -= 0x10000;
+                out_wstr[len] = static_cast<wchar_t>(0xd800 + (c >> 10));
+                out_wstr[len + 1] = static_cast<wchar_t>(0xdc00 + (c & 0x3ff));
+            }
+            len += 2;
+
+        } else {
+            if (out_wstr != nullptr) {
+                out_wstr[len] = static_cast<wchar_t>(c);
+            }
+            ++len;
+        }
+    }
+
+    if (out_wstr != nullptr) {
+        out_wstr[len] = 0;
+    }
+    return len;
+}
+
+} // namespace UTF8
@@ -0,0 +1,37 @@
+#ifndef HEADER_UTF8_H
+#define HEADER_UTF8_H
+
+#include "types.h"
+
+// Encoding and decoding of UTF-8, which is the encoding of String.
+// Invalid sequences decode as REPLACEMENT_CHARACTER.
+namespace UTF8 {
+
+const uint32_t REPLACEMENT_CHARACTER = 0xfffd;
+const size_t MAX_SEQUENCE_LENGTH = 4;
+
+// Writes the sequence of a code point and returns its length
+size_t encode(uint32_t p_code_point, char *out_bytes);
+
+// Returns the length of the sequence encoding a code point
+size_t get_encoded_length(uint32_t p_code_point);
+
+// Decodes the code point starting at `io_pos`, and advances `io_pos` to the next one
+uint32_t decode(const char *p_str, size_t p_len, size_t &io_pos);
+
+bool is_valid(const char *p_str, size_t p_len);
+size_t count_code_points(const char *p_str, size_t p_len);
+
+// Conversion from wide strings, which are UTF-16 on Windows and UTF-32 elsewhere.
+// Returns how many bytes were written, not including the zero terminator.
+// `out_str` can be null to only get the required size.
+size_t from_wide(const wchar_t *p_wstr, size_t p_wlen, char *out_str);
+
+// Conversion to wide strings, for APIs requiring them.
+// Returns how many wide characters were written, not including the zero terminator.
+// `out_wstr` can be null to only get the required size.
+size_t to_wide(const char *p_str, size_t p_len, wchar_t *out_wstr);
+
+} // namespace UTF8
+
+#endif // HEADER_UTF8_H
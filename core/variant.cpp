@@ -1,4 +1,42 @@
 #include "variant.h"
+#include <new> // For placement new
+
+struct Variant::LongString {
+    std::atomic<uint32_t> refcount;
+    size_t length;
+    char str[1];
+};
+
+static Variant::LongString *create_long_string(const char *p_cstr, size_t p_len) {
+    // The terminator uses the char already in the struct
+    void *block = memalloc(sizeof(Variant::LongString) + p_len);
+    Variant::LongString *s = new(block) Variant::LongString();
+    s->refcount = 1;
+    s->length = p_len;
+    memcpy(s->str, p_cstr, p_len);
+    s->str[p_len] = 0;
+    return s;
+}
+
+template <typename T>
+static inline void ref(T *p_data) {
+    p_data->refcount.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+static inline void unref(T *p_data) {
+    if (p_data->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        p_data->~T();
+        memfree(p_data);
+    }
+}
+
+template <typename T>
+static inline T *create_data() {
+    return new(memalloc(sizeof(T))) T();
+}
+
+// Variant
 
 bool Variant::get_bool() const {
     assert(_type == BOOL);
@@ -21,20 +59,86 @@ TaggedPointer Variant::get_tagged_pointer() const {
 }
 
 String Variant::get_string() const {
+    return String(get_cstr());
+}
+
+const char *Variant::get_cstr() const {
     assert(_type == STRING);
-    assert(!"Not implemented");
-    //return _data.string_value;
-    return String();
+    return _long_string ? _data.long_string->str : _data.short_string;
+}
+
+size_t Variant::get_string_length() const {
+    assert(_type == STRING);
+    return _long_string ?
+        _data.long_string->length :
+        SHORT_STRING_CAPACITY - static_cast<size_t>(_data.short_string[SHORT_STRING_CAPACITY]);
+}
+
+VariantArray Variant::get_array() const {
+    assert(_type == ARRAY);
+    ref(_data.array_value);
+    return VariantArray(_data.array_value);
+}
+
+VariantDictionary Variant::get_dictionary() const {
+    assert(_type == DICTIONARY);
+    ref(_data.dictionary_value);
+    return VariantDictionary(_data.dictionary_value);
 }
 
 void Variant::reset() {
     switch(_type) {
     case STRING:
-        assert(!"Not implemented");
-        //_data.string_value.~String();
+        if (_long_string) {
+            unref(_data.long_string);
+        }
+        break;
+    case ARRAY:
+        unref(_data.array_value);
+        break;
+    case DICTIONARY:
+        unref(_data.dictionary_value);
+        break;
+    default:
         break;
     }
     _type = NIL;
+    _long_string = false;
+}
+
+void Variant::copy(const Variant &p_other) {
+    assert(_type == NIL);
+
+    _data = p_other._data;
+    _type = p_other._type;
+    _long_string = p_other._long_string;
+
+    switch(_type) {
+    case STRING:
+        if (_long_string) {
+            ref(_data.long_string);
+        }
+        break;
+    case ARRAY:
+        ref(_data.array_value);
+        break;
+    case DICTIONARY:
+        ref(_data.dictionary_value);
+        break;
+    default:
+        break;
+    }
+}
+
+void Variant::grab(Variant &p_other) {
+    assert(_type == NIL);
+
+    _data = p_other._data;
+    _type = p_other._type;
+    _long_string = p_other._long_string;
+
+    p_other._type = NIL;
+    p_other._long_string = false;
 }
 
 void Variant::set(bool v) {
@@ -61,11 +165,230 @@ void Variant::set(TaggedPointer v) {
     _type = TAGGED_POINTER;
 }
 
-void Variant::set(String v) {
+void Variant::set(const String &v) {
+    set_string(v.c_str(), v.length());
+}
+
+void Variant::set(const char *v) {
+    set_string(v, String::get_length(v));
+}
+
+void Variant::set_string(const char *p_cstr, size_t p_len) {
+    // The source could be our own string, so it is copied before being released
+    Data d;
+    bool long_string = p_len > SHORT_STRING_CAPACITY;
+
+    if (long_string) {
+        d.long_string = create_long_string(p_cstr, p_len);
+    } else {
+        memcpy(d.short_string, p_cstr, p_len);
+        d.short_string[p_len] = 0;
+        d.short_string[SHORT_STRING_CAPACITY] = static_cast<char>(SHORT_STRING_CAPACITY - p_len);
+    }
+
     reset();
-    assert(!"Not implemented");
-    //_data.string_value.String(v);
+    _data = d;
     _type = STRING;
+    _long_string = long_string;
+}
+
+void Variant::set(const VariantArray &v) {
+    // Referenced first in case we were holding the last reference
+    ref(v._data);
+    reset();
+    _data.array_value = v._data;
+    _type = ARRAY;
+}
+
+void Variant::set(const VariantDictionary &v) {
+    ref(v._data);
+    reset();
+    _data.dictionary_value = v._data;
+    _type = DICTIONARY;
+}
+
+bool Variant::operator==(const Variant &p_other) const {
+    if (_type != p_other._type) {
+        return false;
+    }
+
+    switch(_type) {
+    case NIL:
+        return true;
+    case BOOL:
+        return _data.bool_value == p_other._data.bool_value;
+    case INT:
+        return _data.int_value == p_other._data.int_value;
+    case FLOAT:
+        return _data.float_value == p_other._data.float_value;
+    case TAGGED_POINTER:
+        return _data.tagged_pointer_value.ptr == p_other._data.tagged_pointer_value.ptr
+            && _data.tagged_pointer_value.tag == p_other._data.tagged_pointer_value.tag;
+    case STRING: {
+        size_t len = get_string_length();
+        return len == p_other.get_string_length() && memcmp(get_cstr(), p_other.get_cstr(), len) == 0;
+    }
+    case ARRAY:
+        return _data.array_value == p_other._data.array_value;
+    case DICTIONARY:
+        return _data.dictionary_value == p_other._data.dictionary_value;
+    default:
+        assert(false);
+        return false;
+    }
+}
+
+uint64_t Variant::get_hash() const {
+    uint64_t h = 0;
+
+    switch(_type) {
+    case NIL:
+        break;
+    case BOOL:
+        h = _data.bool_value ? 1 : 0;
+        break;
+    case INT:
+        h = static_cast<uint64_t>(_data.int_value);
+        break;
+    case FLOAT:
+        // -0 and 0 are equal, so they must hash the same
+        h = _data.float_value == 0.0 ? 0 : Hash::hash_pod(_data.float_value);
+        break;
+    case TAGGED_POINTER:
+        h = Hash::combine((uint64_t)_data.tagged_pointer_value.ptr, (uint64_t)_data.tagged_pointer_value.tag);
+        break;
+    case STRING:
+        h = Hash::hash_chars(get_cstr(), get_string_length());
+        break;
+    case ARRAY:
+        h = (uint64_t)_data.array_value;
+        break;
+    case DICTIONARY:
+        h = (uint64_t)_data.dictionary_value;
+        break;
+    default:
+        assert(false);
+        break;
+    }
+
+    return hash_mix(Hash::combine(h, _type));
+}
+
+// VariantArray
+
+VariantArray::VariantArray(): _data(create_data<Data>()) {}
+
+VariantArray::VariantArray(Data *p_data): _data(p_data) {}
+
+VariantArray::VariantArray(const VariantArray &p_other): _data(p_other._data) {
+    ref(_data);
+}
+
+VariantArray::~VariantArray() {
+    unref(_data);
+}
+
+void VariantArray::operator=(const VariantArray &p_other) {
+    ref(p_other._data);
+    unref(_data);
+    _data = p_other._data;
+}
+
+void VariantArray::push_back(const Variant &p_value) {
+    _data->items.push_back(p_value);
+}
+
+void VariantArray::pop_back() {
+    _data->items.pop_back();
+}
+
+void VariantArray::remove_at(size_t p_index) {
+    Vector<Variant> &items = _data->items;
+    assert(p_index < items.size());
+    for (size_t i = p_index + 1; i < items.size(); ++i) {
+        items[i - 1] = std::move(items[i]);
+    }
+    items.pop_back();
+}
+
+void VariantArray::resize(size_t p_size) {
+    _data->items.resize(p_size, Variant());
+}
+
+void VariantArray::reserve(size_t p_capacity) {
+    _data->items.reserve(p_capacity);
+}
+
+void VariantArray::clear() {
+    _data->items.clear();
+}
+
+VariantArray VariantArray::duplicate() const {
+    VariantArray a;
+    a._data->items = _data->items;
+    return a;
+}
+
+// VariantDictionary
+
+VariantDictionary::VariantDictionary(): _data(create_data<Data>()) {}
+
+VariantDictionary::VariantDictionary(Data *p_data): _data(p_data) {}
+
+VariantDictionary::VariantDictionary(const VariantDictionary &p_other): _data(p_other._data) {
+    ref(_data);
+}
+
+VariantDictionary::~VariantDictionary() {
+    unref(_data);
+}
+
+void VariantDictionary::operator=(const VariantDictionary &p_other) {
+    ref(p_other._data);
+    unref(_data);
+    _data = p_other._data;
+}
+
+bool VariantDictionary::has(const Variant &p_key) const {
+    return _data->map.has(p_key);
+}
+
+Variant *VariantDictionary::getptr(const Variant &p_key) {
+    return _data->map.getptr(p_key);
+}
+
+const Variant *VariantDictionary::getptr(const Variant &p_key) const {
+    const HashMap<Variant, Variant> &map = _data->map;
+    return map.getptr(p_key);
+}
+
+void VariantDictionary::set(const Variant &p_key, const Variant &p_value) {
+    _data->map.set(p_key, p_value);
+}
+
+bool VariantDictionary::erase(const Variant &p_key) {
+    return _data->map.erase(p_key);
+}
+
+void VariantDictionary::clear() {
+    _data->map.clear();
+}
+
+Variant &VariantDictionary::operator[](const Variant &p_key) {
+    return _data->map[p_key];
+}
+
+void VariantDictionary::get_keys(VariantArray &out_keys) const {
+    out_keys.reserve(out_keys.size() + size());
+    for (ConstIterator it = begin(); it != end(); ++it) {
+        out_keys.push_back(it->key);
+    }
+}
+
+VariantDictionary VariantDictionary::duplicate() const {
+    VariantDictionary d;
+    d._data->map = _data->map;
+    return d;
 }
 
 void to_string(String &dst, const Variant &v) {
@@ -73,14 +396,14 @@ void to_string(String &dst, const Variant &v) {
     switch(v.get_type()) {
 
     case Variant::NIL:
-        dst += L"null";
+        dst += "null";
         break;
 
     case Variant::BOOL:
         if(v.get_bool())
-            dst += L"true";
+            dst += "true";
         else
-            dst += L"false";
+            dst += "false";
         break;
 
     case Variant::INT:
@@ -88,17 +411,44 @@ void to_string(String &dst, const Variant &v) {
         break;
 
     case Variant::FLOAT:
-        // TODO Float tostring
-        dst += L"<float>";
+        append_float(dst, v.get_float());
         break;
 
     case Variant::TAGGED_POINTER:
-        dst.append_format(L"<ptr: %, tag: %>", v.get_tagged_pointer().ptr, v.get_tagged_pointer().tag);
+        dst.append_format(FMT("<ptr: %, tag: %>"), v.get_tagged_pointer().ptr, v.get_tagged_pointer().tag);
         break;
 
     case Variant::STRING:
-        dst += v.get_string();
+        dst += v.get_cstr();
+        break;
+
+    case Variant::ARRAY: {
+        VariantArray a = v.get_array();
+        dst += '[';
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (i != 0) {
+                dst += ", ";
+            }
+            to_string(dst, a[i]);
+        }
+        dst += ']';
         break;
+    }
+
+    case Variant::DICTIONARY: {
+        VariantDictionary d = v.get_dictionary();
+        dst += '{';
+        for (VariantDictionary::ConstIterator it = d.begin(); it != d.end(); ++it) {
+            if (it != d.begin()) {
+                dst += ", ";
+            }
+            to_string(dst, it->key);
+            dst += ": ";
+            to_string(dst, it->value);
+        }
+        dst += '}';
+        break;
+    }
 
     default:
         assert(false);
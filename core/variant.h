@@ -1,13 +1,115 @@
 #ifndef HEADER_VARIANT_H
 #define HEADER_VARIANT_H
 
+#include <atomic>
 #include "string.h"
+#include "hash_map.h"
 
 struct TaggedPointer {
     void *ptr;
     void *tag;
 };
 
+class Variant;
+
+// Defined after Variant
+template <>
+struct Hasher<Variant>;
+
+// Array of variants, shared by reference: copies point to the same elements.
+// Use duplicate() to get a separate array.
+// Note: an array containing itself will never be freed.
+class VariantArray {
+public:
+    VariantArray();
+    VariantArray(const VariantArray &p_other);
+    ~VariantArray();
+
+    void operator=(const VariantArray &p_other);
+
+    inline bool operator==(const VariantArray &p_other) const {
+        return _data == p_other._data;
+    }
+
+    inline size_t size() const;
+    inline bool is_empty() const;
+
+    inline const Variant &operator[](size_t p_index) const;
+    inline Variant &operator[](size_t p_index);
+
+    void push_back(const Variant &p_value);
+    void pop_back();
+    // Shifts following elements
+    void remove_at(size_t p_index);
+    void resize(size_t p_size);
+    void reserve(size_t p_capacity);
+    void clear();
+
+    // Elements are copied, but arrays or dictionaries inside are still shared
+    VariantArray duplicate() const;
+
+    struct Data;
+
+private:
+    friend class Variant;
+
+    explicit VariantArray(Data *p_data);
+
+    Data *_data;
+};
+
+// Map of variants, shared by reference like VariantArray.
+// Keys are compared by value, except arrays and dictionaries which are compared by identity.
+class VariantDictionary {
+public:
+    VariantDictionary();
+    VariantDictionary(const VariantDictionary &p_other);
+    ~VariantDictionary();
+
+    void operator=(const VariantDictionary &p_other);
+
+    inline bool operator==(const VariantDictionary &p_other) const {
+        return _data == p_other._data;
+    }
+
+    inline size_t size() const;
+    inline bool is_empty() const;
+
+    bool has(const Variant &p_key) const;
+    // Returns null if the key is not found
+    Variant *getptr(const Variant &p_key);
+    const Variant *getptr(const Variant &p_key) const;
+    void set(const Variant &p_key, const Variant &p_value);
+    bool erase(const Variant &p_key);
+    void clear();
+
+    // Inserts a null value if the key is not found
+    Variant &operator[](const Variant &p_key);
+
+    void get_keys(VariantArray &out_keys) const;
+
+    // Iterates entries, which have `key` and `value` members
+    typedef HashMapSlot<Variant, Variant> Entry;
+    typedef HashMap<Variant, Variant>::ConstIterator ConstIterator;
+    inline ConstIterator begin() const;
+    inline ConstIterator end() const;
+
+    // Entries are copied, but arrays or dictionaries inside are still shared
+    VariantDictionary duplicate() const;
+
+    struct Data;
+
+private:
+    friend class Variant;
+
+    explicit VariantDictionary(Data *p_data);
+
+    Data *_data;
+};
+
+// Dynamically-typed value.
+// Strings up to SHORT_STRING_CAPACITY bytes are stored inline. Longer ones are immutable and refcounted,
+// so copying a Variant never allocates.
 class Variant {
 public:
     enum Type {
@@ -19,22 +121,67 @@ public:
         TAGGED_POINTER,
         // Non-PODs
         STRING,
+        ARRAY,
+        DICTIONARY
     };
 
+    static const size_t SHORT_STRING_CAPACITY = 15;
+
+    struct LongString;
+
     union Data {
         bool bool_value;
         int64_t int_value;
         double float_value;
-        //String string_value; // TODO Non-POD in union, use a buffer for these
         TaggedPointer tagged_pointer_value;
+        // The last byte holds the remaining capacity, so it becomes the terminator when full
+        char short_string[SHORT_STRING_CAPACITY + 1];
+        LongString *long_string;
+        VariantArray::Data *array_value;
+        VariantDictionary::Data *dictionary_value;
     };
 
-    Variant(): _type(NIL) { }
-    Variant(bool v): _type(BOOL) { _data.bool_value = v; }
-    Variant(int64_t v): _type(INT) { _data.int_value = v; }
-    Variant(double v): _type(FLOAT) { _data.float_value = v; }
-    Variant(TaggedPointer v): _type(TAGGED_POINTER) { _data.tagged_pointer_value = v; }
-    //Variant(String v): _type(STRING) { _data.string_value.String(v); }
+    // Zeroed, since copies copy the data whatever the type
+    Variant(): _data(), _type(NIL), _long_string(false) { }
+    Variant(bool v): _type(BOOL), _long_string(false) { _data.bool_value = v; }
+    Variant(int v): _type(INT), _long_string(false) { _data.int_value = v; }
+    Variant(int64_t v): _type(INT), _long_string(false) { _data.int_value = v; }
+    Variant(double v): _type(FLOAT), _long_string(false) { _data.float_value = v; }
+    Variant(TaggedPointer v): _type(TAGGED_POINTER), _long_string(false) { _data.tagged_pointer_value = v; }
+    Variant(const char *v): _type(NIL), _long_string(false) { set_string(v, String::get_length(v)); }
+    Variant(const String &v): _type(NIL), _long_string(false) { set_string(v.c_str(), v.length()); }
+    Variant(const VariantArray &v): _type(NIL), _long_string(false) { set(v); }
+    Variant(const VariantDictionary &v): _type(NIL), _long_string(false) { set(v); }
+
+    Variant(const Variant &p_other): _type(NIL), _long_string(false) {
+        copy(p_other);
+    }
+
+    Variant(Variant &&p_other): _type(NIL), _long_string(false) {
+        grab(p_other);
+    }
+
+    ~Variant() {
+        reset();
+    }
+
+    // The other variant can be owned by this one, as an element of its array or dictionary.
+    // It is taken before releasing the current value, which could free it.
+    void operator=(const Variant &p_other) {
+        if (&p_other != this) {
+            Variant temp(p_other);
+            reset();
+            grab(temp);
+        }
+    }
+
+    void operator=(Variant &&p_other) {
+        if (&p_other != this) {
+            Variant temp(std::move(p_other));
+            reset();
+            grab(temp);
+        }
+    }
 
     Type get_type() const { return _type; }
 
@@ -43,6 +190,12 @@ public:
     double get_float() const;
     TaggedPointer get_tagged_pointer() const;
     String get_string() const;
+    VariantArray get_array() const;
+    VariantDictionary get_dictionary() const;
+
+    // Access to the string without copying it. Zero-terminated.
+    const char *get_cstr() const;
+    size_t get_string_length() const;
 
     void reset();
 
@@ -50,13 +203,89 @@ public:
     void set(int64_t v);
     void set(double v);
     void set(TaggedPointer v);
-    void set(String v);
+    void set(const String &v);
+    void set(const char *v);
+    void set(const VariantArray &v);
+    void set(const VariantDictionary &v);
+
+    // Values of different types are never equal
+    bool operator==(const Variant &p_other) const;
+
+    inline bool operator!=(const Variant &p_other) const {
+        return !(*this == p_other);
+    }
+
+    uint64_t get_hash() const;
 
 private:
+    void set_string(const char *p_cstr, size_t p_len);
+    void copy(const Variant &p_other);
+    void grab(Variant &p_other);
+
     Data _data;
     Type _type;
+    bool _long_string;
 };
 
 void to_string(String &dst, const Variant &v);
 
+template <>
+struct Hasher<Variant> {
+    static inline uint64_t hash(const Variant &k) {
+        return k.get_hash();
+    }
+
+    static inline bool equals(const Variant &a, const Variant &b) {
+        return a == b;
+    }
+};
+
+struct VariantArray::Data {
+    std::atomic<uint32_t> refcount;
+    Vector<Variant> items;
+
+    Data(): refcount(1) {}
+};
+
+struct VariantDictionary::Data {
+    std::atomic<uint32_t> refcount;
+    HashMap<Variant, Variant> map;
+
+    Data(): refcount(1) {}
+};
+
+inline size_t VariantArray::size() const {
+    return _data->items.size();
+}
+
+inline bool VariantArray::is_empty() const {
+    return _data->items.is_empty();
+}
+
+inline const Variant &VariantArray::operator[](size_t p_index) const {
+    return _data->items[p_index];
+}
+
+inline Variant &VariantArray::operator[](size_t p_index) {
+    return _data->items[p_index];
+}
+
+inline size_t VariantDictionary::size() const {
+    return _data->map.size();
+}
+
+inline bool VariantDictionary::is_empty() const {
+    return _data->map.is_empty();
+}
+
+inline VariantDictionary::ConstIterator VariantDictionary::begin() const {
+    const HashMap<Variant, Variant> &map = _data->map;
+    return map.begin();
+}
+
+inline VariantDictionary::ConstIterator VariantDictionary::end() const {
+    const HashMap<Variant, Variant> &map = _data->map;
+    return map.end();
+}
+
 #endif // HEADER_VARIANT_H
@@ -3,28 +3,131 @@
 
 #include <cassert>
 #include <new> // For placement new
+#include <type_traits>
+#include <utility> // For std::move and std::forward
 #include "memory.h"
 #include "types.h"
 //#include <cstdio> // For debug print
 
+// Default size of the inline storage of vectors, in bytes.
+// Specialize it to change the default for a given element type.
+template <typename T>
+struct VectorSboBudget {
+    static const size_t BYTES = 64;
+};
+
+// Number of elements fitting in a byte budget, to override the inline storage of a specific vector
+template <typename T>
+constexpr size_t sbo_elements(size_t p_bytes) {
+    return p_bytes / sizeof(T);
+}
+
+#ifdef VECTOR_FOOTPRINT_REPORT
+// Each instantiation emits a deprecation warning whose template arguments give its footprint,
+// so building with `vector_footprint=yes` lists the inline storage cost of every vector type.
+template <typename T, size_t SBO_SIZE, size_t INLINE_BYTES, size_t OBJECT_BYTES>
+struct VectorFootprint {
+    [[deprecated("Vector footprint report")]]
+    static void report() {}
+};
+#endif
+
+// Operations on uninitialized storage, dispatched on whether elements can be copied with memcpy.
+// Only the valid implementation is compiled for a given type.
+template <typename T>
+using IsTriviallyCopyable = typename std::is_trivially_copyable<T>::type;
+
+// Moves elements to uninitialized memory, leaving the source uninitialized. Ranges must not overlap.
+template <typename T>
+inline void relocate_elements(T *p_dst, T *p_src, size_t p_count, std::true_type) {
+    memcpy(p_dst, p_src, p_count * sizeof(T));
+}
+
+template <typename T>
+inline void relocate_elements(T *p_dst, T *p_src, size_t p_count, std::false_type) {
+    for (size_t i = 0; i < p_count; ++i) {
+        new(&p_dst[i]) T(std::move(p_src[i]));
+        p_src[i].~T();
+    }
+}
+
+template <typename T>
+inline void relocate_elements(T *p_dst, T *p_src, size_t p_count) {
+    relocate_elements(p_dst, p_src, p_count, IsTriviallyCopyable<T>());
+}
+
+// Copy-constructs elements into uninitialized memory
+template <typename T>
+inline void copy_construct_elements(T *p_dst, const T *p_src, size_t p_count, std::true_type) {
+    memcpy(p_dst, p_src, p_count * sizeof(T));
+}
+
+template <typename T>
+inline void copy_construct_elements(T *p_dst, const T *p_src, size_t p_count, std::false_type) {
+    for (size_t i = 0; i < p_count; ++i) {
+        new(&p_dst[i]) T(p_src[i]);
+    }
+}
+
+template <typename T>
+inline void copy_construct_elements(T *p_dst, const T *p_src, size_t p_count) {
+    copy_construct_elements(p_dst, p_src, p_count, IsTriviallyCopyable<T>());
+}
+
+// Constructs copies of a value into uninitialized memory
+template <typename T>
+inline void fill_construct_elements(T *p_dst, size_t p_count, const T &p_value, std::true_type) {
+    if (p_count == 0) {
+        return;
+    }
+    // Copy the first value, then duplicate the filled part until the end
+    memcpy(p_dst, &p_value, sizeof(T));
+    size_t filled = 1;
+    while (filled < p_count) {
+        size_t n = filled < p_count - filled ? filled : p_count - filled;
+        memcpy(p_dst + filled, p_dst, n * sizeof(T));
+        filled += n;
+    }
+}
+
+template <typename T>
+inline void fill_construct_elements(T *p_dst, size_t p_count, const T &p_value, std::false_type) {
+    for (size_t i = 0; i < p_count; ++i) {
+        new(&p_dst[i]) T(p_value);
+    }
+}
+
+template <typename T>
+inline void fill_construct_elements(T *p_dst, size_t p_count, const T &p_value) {
+    fill_construct_elements(p_dst, p_count, p_value, IsTriviallyCopyable<T>());
+}
+
 // Dynamic array with optional small-buffer optimization.
-// I didn't bother setting stack storage size in bytes, I find it simpler by element if you know what you are doing
-template <typename T, size_t SBO_SIZE = 16>
+// By default the inline storage holds as many elements as fit in VectorSboBudget<T>::BYTES, possibly none.
+// SBO_SIZE can still be given by element count if you know what you are doing.
+template <typename T, size_t SBO_SIZE = sbo_elements<T>(VectorSboBudget<T>::BYTES)>
 class Vector {
 public:
 
-    Vector(): m_heap_storage(nullptr), m_capacity(0), m_size(0) { }
+    Vector(): m_heap_storage(nullptr), m_capacity(SBO_SIZE), m_size(0) { }
 
-    Vector(const Vector &p_other): m_heap_storage(nullptr), m_capacity(0), m_size(0) {
+    Vector(const Vector &p_other): m_heap_storage(nullptr), m_capacity(SBO_SIZE), m_size(0) {
         copy(p_other);
     }
 
     template <size_t S>
-    Vector(const Vector<T, S> &p_other): m_heap_storage(nullptr), m_capacity(0), m_size(0) {
+    Vector(const Vector<T, S> &p_other): m_heap_storage(nullptr), m_capacity(SBO_SIZE), m_size(0) {
         copy(p_other);
     }
 
+    Vector(Vector &&p_other): m_heap_storage(nullptr), m_capacity(SBO_SIZE), m_size(0) {
+        grab(p_other);
+    }
+
     ~Vector() {
+#ifdef VECTOR_FOOTPRINT_REPORT
+        VectorFootprint<T, SBO_SIZE, SBO_SIZE * sizeof(T), sizeof(Vector)>::report();
+#endif
         hard_clear();
     }
 
@@ -37,7 +140,7 @@ public:
     }
 
     inline size_t capacity() const {
-        return m_capacity;
+        return m_capacity & ~HEAP_FLAG;
     }
 
     bool contains(const T p_value) const {
@@ -51,7 +154,7 @@ public:
 
     bool find(const T p_value, size_t &out_index, size_t p_from = 0) const {
         T *d = data();
-        assert(p_from < size());
+        assert(p_from <= size());
         for (size_t i = p_from; i < m_size; ++i) {
             if (d[i] == p_value) {
                 out_index = i;
@@ -73,14 +176,15 @@ public:
     void unordered_remove_at(size_t i) {
         assert(i < size());
         size_t last = size() - 1;
-        m_data[i] = m_data[last];
+        T *d = data();
+        d[i] = d[last];
         pop_back();
     }
 
     void fill(const T p_value) {
         T *d = data();
         for (size_t i = 0; i < m_size; ++i) {
-            d[i] = value;
+            d[i] = p_value;
         }
     }
 
@@ -103,14 +207,9 @@ public:
         } else {
 
             if (p_size < m_size) {
+                destroy_range(p_size, m_size);
 
-                // If has an important destructor
-                T *d = data();
-                for (size_t i = p_size; i < m_size; ++i) {
-                    d[i].~T();
-                }
-
-            } else if (p_size > m_capacity) {
+            } else if (p_size > capacity()) {
                 resize_capacity(p_size);
             }
 
@@ -127,25 +226,15 @@ public:
 
         } else {
 
-            // TODO Will construction and destruction be optimized out if they do nothing?
-
             if (p_size < m_size) {
-
-                // If has an important destructor
-                T *d = data();
-                for (size_t i = p_size; i < m_size; ++i) {
-                    d[i].~T();
-                }
+                destroy_range(p_size, m_size);
 
             } else if (p_size > m_size) {
 
-                if (p_size > m_capacity)
+                if (p_size > capacity())
                     resize_capacity(p_size);
 
-                T *d = data();
-                for (size_t i = m_size; i < p_size; ++i) {
-                    new(&d[i]) T(p_fill_value);
-                }
+                fill_construct_elements(data() + m_size, p_size - m_size, p_fill_value);
             }
 
             m_size = p_size;
@@ -153,13 +242,7 @@ public:
     }
 
     void clear() {
-
-        // If has an important destructor
-        T *d = data();
-        for (size_t i = 0; i < m_size; ++i) {
-            d[i].~T();
-        }
-
+        destroy_range(0, m_size);
         m_size = 0;
     }
 
@@ -170,11 +253,11 @@ public:
             memfree(m_heap_storage);
             m_heap_storage = nullptr;
         }
-        m_capacity = 0;
+        m_capacity = SBO_SIZE;
     }
 
     void reserve(size_t p_capacity) {
-        if (p_capacity > m_capacity) {
+        if (p_capacity > capacity()) {
             resize_capacity(p_capacity);
         }
     }
@@ -184,38 +267,45 @@ public:
     }
 
     inline bool is_using_heap() const {
-        return m_capacity >= SBO_SIZE;
+        return (m_capacity & HEAP_FLAG) != 0;
     }
 
-    void push_back(const T p_value) {
-        // Note: we take by value to prevent the case where we resize the capacity,
-        // because the reference could be coming from the same storage
+    void push_back(const T &p_value) {
+        emplace_back(p_value);
+    }
 
-        if (m_size == m_capacity) {
-            increment_capacity();
-        }
+    void push_back(T &&p_value) {
+        emplace_back(std::move(p_value));
+    }
 
-        T *d = data();
+    // Constructs the element in place
+    template <typename... Args>
+    T &emplace_back(Args&&... p_args) {
+
+        if (m_size == capacity()) {
+            // Arguments could be referencing our own storage, which is about to move,
+            // so the value is constructed before that
+            T value(std::forward<Args>(p_args)...);
+            increment_capacity();
+            new(&data()[m_size]) T(std::move(value));
 
-        new(&d[m_size]) T(p_value);
+        } else {
+            new(&data()[m_size]) T(std::forward<Args>(p_args)...);
+        }
 
         ++m_size;
+        return back();
     }
 
-    void push_front(const T p_value) {
+    void push_front(T p_value) {
+        // Note: we take by value to prevent the case where we resize the capacity,
+        // because the reference could be coming from the same storage
 
-        if (m_size == m_capacity) {
+        if (m_size == capacity()) {
             increment_capacity();
         }
 
-        T *d = data();
-
-        for (size_t i = size(); i > 0; --i) {
-            d[i] = d[i - 1];
-        }
-
-        new(&d[0]) T(p_value);
-
+        insert_front(p_value, IsTriviallyCopyable<T>());
         ++m_size;
     }
 
@@ -227,7 +317,7 @@ public:
     }
 
     void shrink() {
-        if(m_capacity != m_size) {
+        if(capacity() != m_size) {
             resize_capacity(m_size);
         }
     }
@@ -251,28 +341,23 @@ public:
 
         resize_no_init(p_other.size());
 
-        T *src = p_other.data();
-        T *dst = data();
-
-        for(size_t i = 0; i < p_other.size(); ++i) {
-            new(&dst[i]) T(src[i]);
-        }
+        copy_construct_elements(data(), p_other.data(), p_other.size());
     }
 
-    // TODO Move semantics?
+    // Takes the contents of another vector, leaving it empty
     void grab(Vector &p_other) {
         hard_clear();
 
-        // TODO Don't bother copying the stack storage when not needed
-
-        // Shallow-copy all members by value
-        m_heap_storage = p_other.m_heap_storage;
-        memcpy(m_stack_storage, p_other.m_stack_storage, SBO_SIZE * sizeof(T));
+        if (p_other.is_using_heap()) {
+            m_heap_storage = p_other.m_heap_storage;
+        } else {
+            relocate_elements((T*)m_stack_storage, (T*)p_other.m_stack_storage, p_other.m_size);
+        }
         m_capacity = p_other.m_capacity;
         m_size = p_other.m_size;
 
         // Leave the other vector as empty
-        p_other.m_capacity = 0;
+        p_other.m_capacity = SBO_SIZE;
         p_other.m_size = 0;
         p_other.m_heap_storage = nullptr;
     }
@@ -303,6 +388,12 @@ public:
         copy(p_other);
     }
 
+    void operator=(Vector &&p_other) {
+        if (&p_other != this) {
+            grab(p_other);
+        }
+    }
+
     // Copy vector with different SBO
     template <size_t S>
     void operator=(const Vector<T, S> &p_other) {
@@ -310,57 +401,108 @@ public:
     }
 
 private:
+    // Set in m_capacity when elements are stored on the heap
+    static const size_t HEAP_FLAG = ~(~size_t(0) >> 1);
+
+    // Such elements can be copied with memcpy and don't need their destructor to be called
+    static const bool IS_TRIVIAL = std::is_trivially_copyable<T>::value;
+
+    void destroy_range(size_t p_begin, size_t p_end) {
+        if (!IS_TRIVIAL) {
+            T *d = data();
+            for (size_t i = p_begin; i < p_end; ++i) {
+                d[i].~T();
+            }
+        }
+    }
+
+    // Shifts elements by one to make room at the front, capacity must allow it
+    void insert_front(T &p_value, std::true_type) {
+        T *d = data();
+        memmove(d + 1, d, m_size * sizeof(T));
+        memcpy(d, &p_value, sizeof(T));
+    }
+
+    void insert_front(T &p_value, std::false_type) {
+        T *d = data();
+        if (m_size == 0) {
+            new(&d[0]) T(std::move(p_value));
+            return;
+        }
+        // The last element goes to uninitialized memory, others are assigned
+        new(&d[m_size]) T(std::move(d[m_size - 1]));
+        for (size_t i = m_size - 1; i > 0; --i) {
+            d[i] = std::move(d[i - 1]);
+        }
+        d[0] = std::move(p_value);
+    }
+
+    // Returns heap storage of a new capacity holding the current elements
+    T *reallocate_heap_storage(size_t p_capacity, std::true_type) {
+        return static_cast<T*>(memrealloc(m_heap_storage, p_capacity * sizeof(T)));
+    }
+
+    T *reallocate_heap_storage(size_t p_capacity, std::false_type) {
+        T *d = static_cast<T*>(memalloc(p_capacity * sizeof(T)));
+        relocate_elements(d, m_heap_storage, m_size);
+        memfree(m_heap_storage);
+        return d;
+    }
+
     void increment_capacity() {
-        resize_capacity(m_capacity + (m_capacity / 2) + 1);
+        size_t c = capacity();
+        resize_capacity(c + (c / 2) + 1);
     }
 
     void resize_capacity(size_t p_capacity) {
-        // memcpy is used because we only move data.
+        // Elements are only moved.
         // In the worst case, pointers to elements themselves will be invalid,
         // but you should expect that if you use a vector with items by value
 
-        // TODO Only resize capacity when using heap storage!
-        // Stack storage is cheap and fixed so we dont need to even handle capacity
+        // Stack storage is cheap and fixed, so its capacity is always SBO_SIZE
+
+        assert(p_capacity >= m_size);
 
         if (is_using_heap()) {
 
             if (p_capacity <= SBO_SIZE) {
                 // Move to stack
                 // Be careful about the order since storages are in the same union type
+                // The size is at most SBO_SIZE here, clamping it lets GCC prove the copy fits
                 T *d = m_heap_storage;
-                memcpy(m_stack_storage, d, p_capacity * sizeof(T));
+                relocate_elements((T*)m_stack_storage, d, m_size < SBO_SIZE ? m_size : SBO_SIZE);
                 memfree(d);
+                m_capacity = SBO_SIZE;
 
             } else {
-                m_heap_storage = static_cast<T*>(memrealloc(m_heap_storage, p_capacity * sizeof(T)));
+                m_heap_storage = reallocate_heap_storage(p_capacity, IsTriviallyCopyable<T>());
+                m_capacity = p_capacity | HEAP_FLAG;
             }
 
-        } else {
-
-            if (p_capacity > SBO_SIZE) {
-                // Move to heap
-                T *d = static_cast<T*>(memalloc(p_capacity * sizeof(T)));
-                memcpy(d, m_stack_storage, m_capacity * sizeof(T));
-                m_heap_storage = d;
-            }
-            // Else nothing to do with stack storage
+        } else if (p_capacity > SBO_SIZE) {
+            // Move to heap
+            T *d = static_cast<T*>(memalloc(p_capacity * sizeof(T)));
+            relocate_elements(d, (T*)m_stack_storage, m_size);
+            m_heap_storage = d;
+            m_capacity = p_capacity | HEAP_FLAG;
         }
-
-        m_capacity = p_capacity;
+        // Else nothing to do with stack storage
     }
 
     union {
-        uint8_t m_stack_storage[SBO_SIZE * sizeof(T)];
+        // Can't be empty even when there is no inline storage
+        alignas(T) uint8_t m_stack_storage[SBO_SIZE == 0 ? 1 : SBO_SIZE * sizeof(T)];
         T *m_heap_storage;
     };
 
+    // Capacity, with HEAP_FLAG set when the heap storage is used
     size_t m_capacity;
     size_t m_size;
 
 };
 
-template <typename T>
-inline size_t size_in_bytes(const Vector<T> &v) {
+template <typename T, size_t S>
+inline size_t size_in_bytes(const Vector<T, S> &v) {
     return v.size() * sizeof(T);
 }
 
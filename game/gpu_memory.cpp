@@ -0,0 +1,228 @@
+#include "gpu_memory.h"
+#include "vulkan_allocator.h"
+#include "core/macros.h"
+
+const float GpuMemory::WARNING_THRESHOLD = 0.9f;
+
+static const char *g_category_names[GpuMemory::CATEGORY_COUNT] = {
+    "Vertex",
+    "Index",
+    "Staging",
+    "Uniform",
+    "Image"
+};
+
+GpuMemory::GpuMemory() {
+    _physical_device = VK_NULL_HANDLE;
+    _get_memory_properties_2 = nullptr;
+    _memory_properties = {};
+    for (int i = 0; i < CATEGORY_COUNT; ++i) {
+        _category_usage[i] = 0;
+    }
+}
+
+void GpuMemory::init(VkInstance instance, VkPhysicalDevice physical_device, bool budget_extension_enabled) {
+
+    _physical_device = physical_device;
+
+    if (budget_extension_enabled) {
+        _get_memory_properties_2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)
+            vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+        if (_get_memory_properties_2 == nullptr) {
+            LOG_WARNING("Could not get vkGetPhysicalDeviceMemoryProperties2KHR, memory budget will be estimated");
+        }
+    }
+
+    update_budget();
+}
+
+bool GpuMemory::find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties, uint32_t &out_memory_type) const {
+
+    // Memory types are sorted by the driver in order of preference, so the first match is the best one
+    for (uint32_t i = 0; i < _memory_properties.memoryTypeCount; ++i) {
+        if ((type_filter & (1 << i)) && (_memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+            out_memory_type = i;
+            return true;
+        }
+    }
+
+    LOG_ERROR("Could not find Vulkan memory type");
+    return false;
+}
+
+void GpuMemory::update_budget() {
+
+    assert(_physical_device != VK_NULL_HANDLE);
+
+    if (_get_memory_properties_2) {
+
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_properties = {};
+        budget_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+        VkPhysicalDeviceMemoryProperties2KHR properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        properties.pNext = &budget_properties;
+
+        _get_memory_properties_2(_physical_device, &properties);
+        _memory_properties = properties.memoryProperties;
+
+        for (uint32_t i = 0; i < _memory_properties.memoryHeapCount; ++i) {
+            Heap &heap = _heaps[i];
+            heap.reported_usage = budget_properties.heapUsage[i];
+            heap.budget = budget_properties.heapBudget[i];
+            heap.tracked_usage_at_query = heap.tracked_usage;
+        }
+
+    } else {
+
+        vkGetPhysicalDeviceMemoryProperties(_physical_device, &_memory_properties);
+
+        // Without the extension, assume we can use most of each heap, and only we use it
+        for (uint32_t i = 0; i < _memory_properties.memoryHeapCount; ++i) {
+            Heap &heap = _heaps[i];
+            heap.reported_usage = 0;
+            heap.budget = _memory_properties.memoryHeaps[i].size * 8 / 10;
+            heap.tracked_usage_at_query = 0;
+        }
+    }
+}
+
+bool GpuMemory::allocate(VkDevice device, const VkMemoryAllocateInfo &alloc_info, Category category, VkDeviceMemory &out_memory) {
+
+    assert(category >= 0 && category < CATEGORY_COUNT);
+    assert(alloc_info.memoryTypeIndex < _memory_properties.memoryTypeCount);
+
+    uint32_t heap_index = _memory_properties.memoryTypes[alloc_info.memoryTypeIndex].heapIndex;
+
+    check_budget(heap_index, alloc_info.allocationSize);
+
+    CHECK_RESULT_V(vkAllocateMemory(device, &alloc_info, VULKAN_ALLOCATOR, &out_memory), false);
+
+    Allocation a;
+    a.memory = out_memory;
+    a.size = alloc_info.allocationSize;
+    a.heap_index = heap_index;
+    a.category = category;
+    _allocations.push_back(a);
+
+    _heaps[heap_index].tracked_usage += a.size;
+    _category_usage[category] += a.size;
+
+    return true;
+}
+
+void GpuMemory::free(VkDevice device, VkDeviceMemory memory) {
+
+    if (memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    for (size_t i = 0; i < _allocations.size(); ++i) {
+        const Allocation &a = _allocations[i];
+
+        if (a.memory == memory) {
+            Heap &heap = _heaps[a.heap_index];
+            heap.tracked_usage -= a.size;
+            _category_usage[a.category] -= a.size;
+
+            VkDeviceSize usage = heap.reported_usage + heap.tracked_usage - heap.tracked_usage_at_query;
+            if (heap.warned && usage < heap.budget * WARNING_THRESHOLD) {
+                heap.warned = false;
+            }
+
+            _allocations.unordered_remove_at(i);
+            break;
+        }
+    }
+
+    vkFreeMemory(device, memory, VULKAN_ALLOCATOR);
+}
+
+void GpuMemory::check_budget(uint32_t heap_index, VkDeviceSize requested_bytes) {
+
+    const HeapStats stats = get_heap_stats(heap_index);
+    const VkDeviceSize threshold = static_cast<VkDeviceSize>(stats.budget * WARNING_THRESHOLD);
+
+    if (stats.usage + requested_bytes <= threshold) {
+        return;
+    }
+
+    for (size_t i = 0; i < _eviction_listeners.size(); ++i) {
+        const EvictionListener &listener = _eviction_listeners[i];
+        listener.callback(heap_index, requested_bytes, listener.userdata);
+    }
+
+    Heap &heap = _heaps[heap_index];
+    if (!heap.warned) {
+        // Only warn once until usage gets back under the threshold
+        heap.warned = true;
+        LOG_WARNING("GPU memory heap ", heap_index, " is approaching its budget: ",
+            (stats.usage + requested_bytes) / 1024, " KB used out of ", stats.budget / 1024, " KB");
+    }
+}
+
+void GpuMemory::add_eviction_callback(EvictionCallback callback, void *userdata) {
+    assert(callback != nullptr);
+    EvictionListener listener = { callback, userdata };
+    _eviction_listeners.push_back(listener);
+}
+
+void GpuMemory::remove_eviction_callback(EvictionCallback callback, void *userdata) {
+    EvictionListener listener = { callback, userdata };
+    _eviction_listeners.unordered_remove(listener);
+}
+
+uint32_t GpuMemory::get_heap_count() const {
+    return _memory_properties.memoryHeapCount;
+}
+
+GpuMemory::HeapStats GpuMemory::get_heap_stats(uint32_t heap_index) const {
+
+    assert(heap_index < _memory_properties.memoryHeapCount);
+    const Heap &heap = _heaps[heap_index];
+    const VkMemoryHeap &vk_heap = _memory_properties.memoryHeaps[heap_index];
+
+    HeapStats stats;
+    stats.size = vk_heap.size;
+    stats.usage = heap.reported_usage + heap.tracked_usage - heap.tracked_usage_at_query;
+    stats.budget = heap.budget;
+    stats.tracked_usage = heap.tracked_usage;
+    stats.device_local = (vk_heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    return stats;
+}
+
+VkDeviceSize GpuMemory::get_category_usage(Category category) const {
+    assert(category >= 0 && category < CATEGORY_COUNT);
+    return _category_usage[category];
+}
+
+uint32_t GpuMemory::get_allocation_count() const {
+    return static_cast<uint32_t>(_allocations.size());
+}
+
+bool GpuMemory::is_budget_extension_enabled() const {
+    return _get_memory_properties_2 != nullptr;
+}
+
+void GpuMemory::print_report() const {
+
+    Log::info("GPU memory (", is_budget_extension_enabled() ? "driver budget" : "estimated budget", "), ",
+        _allocations.size(), " allocations:");
+
+    for (uint32_t i = 0; i < _memory_properties.memoryHeapCount; ++i) {
+        HeapStats stats = get_heap_stats(i);
+        Console::print_line("\tHeap ", (int64_t)i, stats.device_local ? " (device local)" : "",
+            ": ", (int64_t)(stats.usage / 1024), " KB used / ", (int64_t)(stats.budget / 1024), " KB budget / ",
+            (int64_t)(stats.size / 1024), " KB total, ", (int64_t)(stats.tracked_usage / 1024), " KB tracked");
+    }
+
+    for (int i = 0; i < CATEGORY_COUNT; ++i) {
+        Console::print_line("\t", g_category_names[i], ": ", (int64_t)(_category_usage[i] / 1024), " KB");
+    }
+}
+
+// static
+const char *GpuMemory::get_category_name(Category category) {
+    assert(category >= 0 && category < CATEGORY_COUNT);
+    return g_category_names[category];
+}
@@ -0,0 +1,103 @@
+#ifndef HEADER_GPU_MEMORY_H
+#define HEADER_GPU_MEMORY_H
+
+#include <vulkan/vulkan.h>
+#include "core/vector.h"
+
+// Keeps track of device memory allocations per heap and per category,
+// and compares them with the budget the driver gives us.
+// Budgets come from VK_EXT_memory_budget when available, otherwise they are estimated from heap sizes.
+class GpuMemory {
+public:
+    enum Category {
+        VERTEX,
+        INDEX,
+        STAGING,
+        UNIFORM,
+        IMAGE,
+        CATEGORY_COUNT
+    };
+
+    // Called when an allocation is about to make a heap go over the warning threshold.
+    // Listeners may free memory they can recreate later.
+    typedef void (*EvictionCallback)(uint32_t heap_index, VkDeviceSize requested_bytes, void *userdata);
+
+    struct HeapStats {
+        VkDeviceSize size = 0;
+        // Memory used by the process, as last reported by the driver plus what we allocated since
+        VkDeviceSize usage = 0;
+        VkDeviceSize budget = 0;
+        // Memory allocated through this tracker only
+        VkDeviceSize tracked_usage = 0;
+        bool device_local = false;
+    };
+
+    // Fraction of the budget above which warnings and evictions happen
+    static const float WARNING_THRESHOLD;
+
+    GpuMemory();
+
+    void init(VkInstance instance, VkPhysicalDevice physical_device, bool budget_extension_enabled);
+
+    bool find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties, uint32_t &out_memory_type) const;
+
+    bool allocate(VkDevice device, const VkMemoryAllocateInfo &alloc_info, Category category, VkDeviceMemory &out_memory);
+    void free(VkDevice device, VkDeviceMemory memory);
+
+    // Queries the driver budget again. Cheap, but not something to do for every allocation.
+    void update_budget();
+
+    void add_eviction_callback(EvictionCallback callback, void *userdata);
+    void remove_eviction_callback(EvictionCallback callback, void *userdata);
+
+    uint32_t get_heap_count() const;
+    HeapStats get_heap_stats(uint32_t heap_index) const;
+    VkDeviceSize get_category_usage(Category category) const;
+    uint32_t get_allocation_count() const;
+    bool is_budget_extension_enabled() const;
+
+    void print_report() const;
+
+    static const char *get_category_name(Category category);
+
+private:
+    void check_budget(uint32_t heap_index, VkDeviceSize requested_bytes);
+
+    struct Allocation {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        uint32_t heap_index;
+        Category category;
+    };
+
+    struct Heap {
+        VkDeviceSize reported_usage = 0;
+        VkDeviceSize budget = 0;
+        VkDeviceSize tracked_usage = 0;
+        // Value of tracked_usage when the budget was last queried
+        VkDeviceSize tracked_usage_at_query = 0;
+        bool warned = false;
+    };
+
+    struct EvictionListener {
+        EvictionCallback callback;
+        void *userdata;
+
+        bool operator==(const EvictionListener &other) const {
+            return callback == other.callback && userdata == other.userdata;
+        }
+    };
+
+    VkPhysicalDevice _physical_device;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR _get_memory_properties_2;
+    VkPhysicalDeviceMemoryProperties _memory_properties;
+
+    Heap _heaps[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize _category_usage[CATEGORY_COUNT];
+
+    // There can only be a few thousands of device allocations, so a linear search is fine
+    Vector<Allocation> _allocations;
+    Vector<EvictionListener> _eviction_listeners;
+};
+
+#endif // HEADER_GPU_MEMORY_H
@@ -3,21 +3,58 @@
 #include "vulkan_driver.h"
 #include "core/math/vector3.h"
 #include "mesh.h"
+#include "vulkan_allocator.h"
+#include "core/string_name.h"
+#include "core/trace.h"
+#include <utility> // std::move
+
+int main_loop(int check_frame_count, const char *mesh_path);
+
+// Frames run before checking allocations, while resources are still being created
+static const int FRAME_CHECK_WARMUP = 10;
+static const int DEFAULT_FRAME_CHECK_COUNT = 300;
+
+int main(int argc, char **argv) {
+
+    Console::print_line("Hello World");
+
+    // With `--check-frame-allocations [count]`, runs that many frames after a warm-up,
+    // and fails if any of them allocated from the heap.
+    // With `--trace <file>`, records draws, uploads and allocations in a binary trace, see `trace_convert`.
+    // With `--mesh <file>`, streams a mesh from a file instead of drawing a triangle, see `Mesh::load`.
+    int check_frame_count = 0;
+    const char *trace_path = nullptr;
+    const char *mesh_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--check-frame-allocations") == 0) {
+            check_frame_count = DEFAULT_FRAME_CHECK_COUNT;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+                check_frame_count = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) {
+            mesh_path = argv[++i];
+        }
+    }
 
-int main_loop();
+    if (trace_path != nullptr) {
+        Trace::start(trace_path);
+    }
 
-int main() {
+    int ret = main_loop(check_frame_count, mesh_path);
 
-    Console::print_line(L"Hello World");
+    Trace::stop();
 
-    int ret = main_loop();
+    StringName::cleanup();
 
-    Log::info(L"Alloc count on exit: ", (int64_t)Memory::get_alloc_count());
+    Memory::print_report();
+    VulkanAllocator::print_report();
 
     return ret;
 }
 
-int main_loop() {
+int main_loop(int check_frame_count, const char *mesh_path) {
 
     const char *app_name = "Vulkan test";
     Window window(Vector2i(800, 600), app_name);
@@ -27,18 +64,28 @@ int main_loop() {
     Vector<const char*> required_layers;
 
     VulkanDriver driver;
-    ERR_FAIL_COND_V(!driver.create(app_name, required_extensions, required_layers, window), EXIT_FAILURE);
-
-    Mesh *mesh = new Mesh();
-    mesh->make_triangle();
-    mesh->upload(driver);
-
-    driver.scene.push_back(mesh);
+    ERR_FAIL_COND_V(!driver.create(app_name, std::move(required_extensions), std::move(required_layers), window), EXIT_FAILURE);
+
+    Mesh *mesh = driver.create_mesh();
+    if (mesh_path != nullptr) {
+        // Appears once loaded, frames don't wait for it
+        ERR_FAIL_COND_V(!mesh->load(driver, mesh_path), EXIT_FAILURE);
+    } else {
+        mesh->make_triangle();
+        mesh->upload(driver);
+    }
 
-    driver.create_command_buffers();
+    int frame_index = 0;
+    int allocating_frame_count = 0;
+    bool draw_failed = false;
 
     while (!window.should_close()) {
 
+        const bool check_frame = check_frame_count > 0 && frame_index >= FRAME_CHECK_WARMUP;
+        if (check_frame) {
+            Memory::begin_frame();
+        }
+
         Window::poll_events();
 
         InputEvent event;
@@ -56,17 +103,44 @@ int main_loop() {
         // Don't draw in minimized state, framebuffer size is zero
         if (window.get_framebuffer_size() != Vector2i()) {
 
-            if (!driver.draw(window)) {
-                // If something wrong happens in rendering, don't bail-loop forever
-                break;
+            // If something wrong happens in rendering, don't bail-loop forever
+            draw_failed = !driver.draw(window);
+        }
+
+        if (check_frame) {
+            if (Memory::end_frame() != 0) {
+                ++allocating_frame_count;
             }
         }
 
+        if (draw_failed) {
+            break;
+        }
+
+        ++frame_index;
+        if (check_frame_count > 0 && frame_index == FRAME_CHECK_WARMUP + check_frame_count) {
+            break;
+        }
+
         // TODO Limit framerate, maybeee
     }
 
     driver.wait();
 
+    driver.get_gpu_memory().print_report();
+
+    if (check_frame_count > 0) {
+        if (allocating_frame_count != 0) {
+            LOG_ERROR(allocating_frame_count, " of ", check_frame_count, " checked frames allocated from the heap");
+            return EXIT_FAILURE;
+        }
+        if (frame_index < FRAME_CHECK_WARMUP + check_frame_count) {
+            LOG_ERROR("Stopped after ", frame_index, " frames, before all frames were checked");
+            return EXIT_FAILURE;
+        }
+        LOG_INFO("No heap allocations in ", check_frame_count, " checked frames");
+    }
+
     return EXIT_SUCCESS;
 }
 
@@ -1,5 +1,8 @@
 #include "mesh.h"
 #include "vulkan_driver.h"
+#include "render_chunk.h"
+#include "vulkan_allocator.h"
+#include "core/file.h"
 #include "core/macros.h"
 
 Mesh::Mesh() {
@@ -10,7 +13,11 @@ Mesh::Mesh() {
     _positions_buffer_memory = VK_NULL_HANDLE;
     _colors_buffer_memory = VK_NULL_HANDLE;
 
+    _vertex_count = 0;
+
     _driver = nullptr;
+    _chunk = nullptr;
+    _visible = true;
 }
 
 void Mesh::make_triangle() {
@@ -22,32 +29,86 @@ void Mesh::make_triangle() {
     _colors.push_back(Vector3(1, 0, 0));
     _colors.push_back(Vector3(0, 1, 0));
     _colors.push_back(Vector3(0, 0, 1));
+
+    _vertex_count = _positions.size();
+}
+
+bool Mesh::load(VulkanDriver &driver, const char *fpath) {
+
+    assert(_positions_buffer == VK_NULL_HANDLE);
+
+    uint64_t file_size;
+    if (!File::get_size(fpath, file_size)) {
+        LOG_ERROR("Failed to open mesh ", fpath);
+        return false;
+    }
+    const uint64_t vertex_size = sizeof(Vector2) + sizeof(Vector3);
+    if (file_size == 0 || file_size % vertex_size != 0 || file_size / vertex_size > UINT32_MAX) {
+        LOG_ERROR("Mesh file has an invalid size: ", fpath);
+        return false;
+    }
+
+    _driver = &driver;
+    _vertex_count = static_cast<uint32_t>(file_size / vertex_size);
+
+    const VkDeviceSize positions_size = _vertex_count * sizeof(Vector2);
+    const VkDeviceSize colors_size = _vertex_count * sizeof(Vector3);
+    ERR_FAIL_COND_V(!driver.load_buffer(fpath, 0, positions_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, GpuMemory::VERTEX,
+        on_positions_loaded, this), false);
+    ERR_FAIL_COND_V(!driver.load_buffer(fpath, positions_size, colors_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, GpuMemory::VERTEX,
+        on_colors_loaded, this), false);
+
+    return true;
+}
+
+// Static
+void Mesh::on_positions_loaded(VkBuffer buffer, VkDeviceMemory buffer_memory, void *userdata) {
+    Mesh *mesh = static_cast<Mesh*>(userdata);
+    mesh->_positions_buffer = buffer;
+    mesh->_positions_buffer_memory = buffer_memory;
+    if (mesh->is_uploaded()) {
+        mesh->mark_dirty();
+    }
+}
+
+// Static
+void Mesh::on_colors_loaded(VkBuffer buffer, VkDeviceMemory buffer_memory, void *userdata) {
+    Mesh *mesh = static_cast<Mesh*>(userdata);
+    mesh->_colors_buffer = buffer;
+    mesh->_colors_buffer_memory = buffer_memory;
+    if (mesh->is_uploaded()) {
+        mesh->mark_dirty();
+    }
 }
 
 Mesh::~Mesh() {
 
+    if (_chunk) {
+        _chunk->remove_mesh(this);
+    }
+
     if(_driver) {
 
         VkDevice device = _driver->get_device();
 
         if (_positions_buffer) {
-            vkDestroyBuffer(device, _positions_buffer, nullptr);
+            vkDestroyBuffer(device, _positions_buffer, VULKAN_ALLOCATOR);
         }
         if (_colors_buffer) {
-            vkDestroyBuffer(device, _colors_buffer, nullptr);
+            vkDestroyBuffer(device, _colors_buffer, VULKAN_ALLOCATOR);
         }
 
         if (_positions_buffer_memory) {
-            vkFreeMemory(device, _positions_buffer_memory, nullptr);
+            _driver->free_memory(_positions_buffer_memory);
         }
         if (_colors_buffer_memory) {
-            vkFreeMemory(device, _colors_buffer_memory, nullptr);
+            _driver->free_memory(_colors_buffer_memory);
         }
     }
 }
 
 int Mesh::get_vertex_count() {
-    return _positions.size();
+    return _vertex_count;
 }
 
 void Mesh::get_description(Vector<VkVertexInputBindingDescription> & out_bindings, Vector<VkVertexInputAttributeDescription> &out_attributes) {
@@ -81,6 +142,23 @@ void Mesh::get_description(Vector<VkVertexInputBindingDescription> & out_binding
     out_attributes.push_back(attribute_descriptions[1]);
 }
 
+void Mesh::get_position_description(Vector<VkVertexInputBindingDescription> & out_bindings, Vector<VkVertexInputAttributeDescription> &out_attributes) {
+
+    VkVertexInputBindingDescription position_binding_description = {};
+    position_binding_description.binding = 0;
+    position_binding_description.stride = sizeof(Vector2);
+    position_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    VkVertexInputAttributeDescription position_attribute_description = {};
+    position_attribute_description.binding = 0;
+    position_attribute_description.location = 0;
+    position_attribute_description.format = VK_FORMAT_R32G32_SFLOAT;
+    position_attribute_description.offset = 0;
+
+    out_bindings.push_back(position_binding_description);
+    out_attributes.push_back(position_attribute_description);
+}
+
 template <typename T>
 static bool copy_to(VkDevice device, const Vector<T> &src, VkDeviceMemory memory) {
     void *dst;
@@ -99,17 +177,17 @@ static bool upload_buffer(VulkanDriver &driver, const Vector<T> &data, VkBuffer
     VkDeviceMemory staging_buffer_memory;
     VkDeviceSize buffer_size = size_in_bytes(data);
     VkMemoryPropertyFlags staging_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    ERR_FAIL_COND_V(!driver.create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_flags, staging_buffer, staging_buffer_memory), false);
+    ERR_FAIL_COND_V(!driver.create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_flags, GpuMemory::STAGING, staging_buffer, staging_buffer_memory), false);
 
     ERR_FAIL_COND_V(!copy_to(device, data, staging_buffer_memory), false);
 
     VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    ERR_FAIL_COND_V(!driver.create_buffer(buffer_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, buffer_memory), false);
+    ERR_FAIL_COND_V(!driver.create_buffer(buffer_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, GpuMemory::VERTEX, buffer, buffer_memory), false);
 
     driver.copy_buffer(staging_buffer, buffer, buffer_size);
 
-    vkDestroyBuffer(device, staging_buffer, nullptr);
-    vkFreeMemory(device, staging_buffer_memory, nullptr);
+    vkDestroyBuffer(device, staging_buffer, VULKAN_ALLOCATOR);
+    driver.free_memory(staging_buffer_memory);
 
     return true;
 }
@@ -124,6 +202,8 @@ bool Mesh::upload(VulkanDriver &driver) {
     ERR_FAIL_COND_V(!upload_buffer(driver, _positions, _positions_buffer, _positions_buffer_memory), false);
     ERR_FAIL_COND_V(!upload_buffer(driver, _colors, _colors_buffer, _colors_buffer_memory), false);
 
+    mark_dirty();
+
     return true;
 }
 
@@ -136,4 +216,41 @@ void Mesh::draw(VkCommandBuffer command_buffer) {
     vkCmdDraw(command_buffer, static_cast<uint32_t>(get_vertex_count()), 1, 0, 0);
 }
 
+void Mesh::draw_depth(VkCommandBuffer command_buffer) {
+
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &_positions_buffer, &offset);
+
+    vkCmdDraw(command_buffer, static_cast<uint32_t>(get_vertex_count()), 1, 0, 0);
+}
+
+
+
+bool Mesh::is_uploaded() const {
+    return _positions_buffer != VK_NULL_HANDLE && _colors_buffer != VK_NULL_HANDLE;
+}
+
+void Mesh::set_visible(bool visible) {
+    if (visible != _visible) {
+        _visible = visible;
+        mark_dirty();
+    }
+}
+
+bool Mesh::is_visible() const {
+    return _visible;
+}
 
+void Mesh::mark_dirty() {
+    if (_chunk) {
+        _chunk->mark_dirty();
+    }
+}
+
+RenderChunk *Mesh::get_chunk() const {
+    return _chunk;
+}
+
+void Mesh::set_chunk(RenderChunk *chunk) {
+    _chunk = chunk;
+}
@@ -7,6 +7,7 @@
 #include <vulkan/vulkan.h>
 
 class VulkanDriver;
+class RenderChunk;
 
 class Mesh {
 public:
@@ -15,14 +16,38 @@ public:
 
     void make_triangle();
 
+    // Loads vertices from a file holding the positions of all vertices, followed by their colors.
+    // Buffers are read in the background, the mesh is drawn once both are uploaded.
+    bool load(VulkanDriver &driver, const char *fpath);
+
     int get_vertex_count();
 
     static void get_description(Vector<VkVertexInputBindingDescription> & out_bindings, Vector<VkVertexInputAttributeDescription> &out_attributes);
+    // Only positions, for depth-only passes
+    static void get_position_description(Vector<VkVertexInputBindingDescription> & out_bindings, Vector<VkVertexInputAttributeDescription> &out_attributes);
 
     bool upload(VulkanDriver &driver);
     void draw(VkCommandBuffer command_buffer);
+    void draw_depth(VkCommandBuffer command_buffer);
+
+    // False until vertex buffers are on the GPU
+    bool is_uploaded() const;
+
+    // Invisible meshes are skipped when their chunk records draw commands
+    void set_visible(bool visible);
+    bool is_visible() const;
+
+    // Must be called after any change affecting draw commands, so that they get recorded again
+    void mark_dirty();
+
+    RenderChunk *get_chunk() const;
+    // Only used by RenderChunk
+    void set_chunk(RenderChunk *chunk);
 
 private:
+    static void on_positions_loaded(VkBuffer buffer, VkDeviceMemory buffer_memory, void *userdata);
+    static void on_colors_loaded(VkBuffer buffer, VkDeviceMemory buffer_memory, void *userdata);
+
     Vector<Vector2> _positions;
     Vector<Vector3> _colors;
 
@@ -32,7 +57,11 @@ private:
     VkDeviceMemory _positions_buffer_memory;
     VkDeviceMemory _colors_buffer_memory;
 
+    uint32_t _vertex_count;
+
     VulkanDriver *_driver;
+    RenderChunk *_chunk;
+    bool _visible;
 };
 
 #endif // HEADER_MESH_H
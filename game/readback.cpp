@@ -0,0 +1,317 @@
+#include "readback.h"
+#include "vulkan_driver.h"
+#include "vulkan_allocator.h"
+#include "core/macros.h"
+#include "core/png.h"
+
+Readback::Readback() {
+    _driver = nullptr;
+    _command_pool = VK_NULL_HANDLE;
+    _next_slot = 0;
+    _recorded_slot = -1;
+    _stop_worker = false;
+}
+
+Readback::~Readback() {
+    clear();
+}
+
+bool Readback::init(VulkanDriver &driver, uint32_t queue_family_index) {
+
+    assert(_driver == nullptr);
+    _driver = &driver;
+    VkDevice device = driver.get_device();
+
+    {
+        VkCommandPoolCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        create_info.queueFamilyIndex = queue_family_index;
+        // Each slot re-records its command buffer
+        create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+        CHECK_RESULT_V(vkCreateCommandPool(device, &create_info, VULKAN_ALLOCATOR, &_command_pool), false);
+    }
+
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        Slot &slot = _slots[i];
+
+        VkCommandBufferAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = _command_pool;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+        CHECK_RESULT_V(vkAllocateCommandBuffers(device, &alloc_info, &slot.command_buffer), false);
+
+        VkFenceCreateInfo fence_info = {};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        CHECK_RESULT_V(vkCreateFence(device, &fence_info, VULKAN_ALLOCATOR, &slot.fence), false);
+    }
+
+    _stop_worker = false;
+    _worker = std::thread(&Readback::worker_loop, this);
+
+    return true;
+}
+
+void Readback::clear() {
+
+    if (_driver == nullptr) {
+        return;
+    }
+
+    VkDevice device = _driver->get_device();
+
+    // Copies already submitted are still worth saving
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        Slot &slot = _slots[i];
+        if (slot.state == SUBMITTED) {
+            vkWaitForFences(device, 1, &slot.fence, VK_TRUE, 0xffffffffffffffff);
+        }
+    }
+    poll();
+
+    if (_worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop_worker = true;
+        }
+        _condition.notify_one();
+        _worker.join();
+    }
+
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        Slot &slot = _slots[i];
+        if (slot.fence) {
+            vkDestroyFence(device, slot.fence, VULKAN_ALLOCATOR);
+            slot.fence = VK_NULL_HANDLE;
+        }
+        if (slot.buffer) {
+            vkDestroyBuffer(device, slot.buffer, VULKAN_ALLOCATOR);
+            slot.buffer = VK_NULL_HANDLE;
+        }
+        if (slot.memory) {
+            vkUnmapMemory(device, slot.memory);
+            _driver->free_memory(slot.memory);
+            slot.memory = VK_NULL_HANDLE;
+            slot.mapped = nullptr;
+        }
+        slot.capacity = 0;
+        slot.command_buffer = VK_NULL_HANDLE;
+        slot.state = FREE;
+    }
+
+    if (_command_pool) {
+        // Also frees command buffers
+        vkDestroyCommandPool(device, _command_pool, VULKAN_ALLOCATOR);
+        _command_pool = VK_NULL_HANDLE;
+    }
+
+    _driver = nullptr;
+}
+
+// static
+bool Readback::is_format_supported(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Readback::ensure_capacity(Slot &slot, VkDeviceSize size) {
+
+    if (slot.capacity >= size) {
+        return true;
+    }
+
+    VkDevice device = _driver->get_device();
+
+    if (slot.buffer) {
+        vkDestroyBuffer(device, slot.buffer, VULKAN_ALLOCATOR);
+        slot.buffer = VK_NULL_HANDLE;
+    }
+    if (slot.memory) {
+        vkUnmapMemory(device, slot.memory);
+        _driver->free_memory(slot.memory);
+        slot.memory = VK_NULL_HANDLE;
+        slot.mapped = nullptr;
+    }
+    slot.capacity = 0;
+
+    VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    ERR_FAIL_COND_V(!_driver->create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, flags, GpuMemory::STAGING, slot.buffer, slot.memory), false);
+
+    void *mapped = nullptr;
+    CHECK_RESULT_V(vkMapMemory(device, slot.memory, 0, size, 0, &mapped), false);
+    slot.mapped = static_cast<uint8_t*>(mapped);
+    slot.capacity = size;
+
+    return true;
+}
+
+VkCommandBuffer Readback::record(VkImage image, VkImageLayout layout, VkFormat format, VkExtent2D extent, const char *fpath) {
+
+    assert(_driver != nullptr);
+    assert(_recorded_slot == -1);
+    assert(fpath != nullptr);
+
+    if (!is_format_supported(format)) {
+        LOG_ERROR("Readback of image format ", (int)format, " is not supported");
+        return VK_NULL_HANDLE;
+    }
+
+    Slot &slot = _slots[_next_slot];
+    if (slot.state != FREE) {
+        // Worker or GPU is lagging behind, rather skip than stall
+        LOG_WARNING("No free readback slot, skipping capture of ", fpath);
+        return VK_NULL_HANDLE;
+    }
+
+    const VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+    ERR_FAIL_COND_V(!ensure_capacity(slot, size), VK_NULL_HANDLE);
+
+    slot.extent = extent;
+    slot.bgra = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+    strncpy(slot.fpath, fpath, MAX_PATH_LENGTH - 1);
+    slot.fpath[MAX_PATH_LENGTH - 1] = 0;
+
+    VkCommandBuffer command_buffer = slot.command_buffer;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_RESULT_V(vkBeginCommandBuffer(command_buffer, &begin_info), VK_NULL_HANDLE);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    // The commands rendering the image made it visible to transfers, this only has to run after them
+    barrier.oldLayout = layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    // Tightly packed
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+    // Give the image back in the layout it was
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = layout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // Make the copy visible to the host once the fence is signaled
+    VkBufferMemoryBarrier buffer_barrier = {};
+    buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    buffer_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.buffer = slot.buffer;
+    buffer_barrier.offset = 0;
+    buffer_barrier.size = size;
+    vkCmdPipelineBarrier(command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 0, nullptr, 1, &buffer_barrier, 0, nullptr);
+
+    CHECK_RESULT_V(vkEndCommandBuffer(command_buffer), VK_NULL_HANDLE);
+
+    slot.state = RECORDED;
+    _recorded_slot = _next_slot;
+    _next_slot = (_next_slot + 1) % SLOT_COUNT;
+
+    return command_buffer;
+}
+
+bool Readback::submit_fence(VkQueue queue) {
+
+    assert(_recorded_slot != -1);
+    Slot &slot = _slots[_recorded_slot];
+    _recorded_slot = -1;
+
+    // An empty submission signals its fence once all previously submitted work has completed,
+    // so we don't need to share the frame fences
+    CHECK_RESULT_V(vkQueueSubmit(queue, 0, nullptr, slot.fence), false);
+    slot.state = SUBMITTED;
+
+    return true;
+}
+
+void Readback::poll() {
+
+    assert(_driver != nullptr);
+    VkDevice device = _driver->get_device();
+
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        Slot &slot = _slots[i];
+
+        if (slot.state == SUBMITTED && vkGetFenceStatus(device, slot.fence) == VK_SUCCESS) {
+
+            vkResetFences(device, 1, &slot.fence);
+            slot.state = SAVING;
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _save_queue.push_back(i);
+            }
+            _condition.notify_one();
+        }
+    }
+}
+
+void Readback::worker_loop() {
+
+    while (true) {
+
+        int slot_index = -1;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_save_queue.is_empty() && !_stop_worker) {
+                _condition.wait(lock);
+            }
+            if (_save_queue.is_empty()) {
+                // Stopping, and nothing left to save
+                break;
+            }
+            slot_index = _save_queue.back();
+            _save_queue.pop_back();
+        }
+
+        Slot &slot = _slots[slot_index];
+        assert(slot.state == SAVING);
+
+        if (PNG::save_rgba8(slot.fpath, slot.mapped, slot.extent.width, slot.extent.height, slot.extent.width * 4, slot.bgra)) {
+            LOG_INFO("Saved capture ", slot.fpath);
+        }
+
+        slot.state = FREE;
+    }
+}
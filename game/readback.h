@@ -0,0 +1,83 @@
+#ifndef HEADER_READBACK_H
+#define HEADER_READBACK_H
+
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "core/vector.h"
+
+class VulkanDriver;
+
+// Copies images back to the host without stalling the render loop.
+// Copies are recorded into a ring of slots, each with its own host-visible buffer and fence.
+// Fences are polled on following frames, and finished slots are handed to a worker thread which saves them as PNG.
+class Readback {
+public:
+    static const int SLOT_COUNT = 3;
+    static const int MAX_PATH_LENGTH = 256;
+
+    Readback();
+    ~Readback();
+
+    bool init(VulkanDriver &driver, uint32_t queue_family_index);
+    // Waits for pending captures to be saved, then destroys everything
+    void clear();
+
+    // Records a copy of `image` in a free slot and returns the command buffer to submit right after the commands rendering it.
+    // The image must be in `layout` and will be left in that layout. Writes to it must be made available
+    // to the transfer stage, for example by a render pass dependency to VK_SUBPASS_EXTERNAL.
+    // Returns VK_NULL_HANDLE if all slots are busy or the format is not supported, in which case the capture is skipped.
+    VkCommandBuffer record(VkImage image, VkImageLayout layout, VkFormat format, VkExtent2D extent, const char *fpath);
+
+    // Must be called after the command buffer returned by `record` was submitted to `queue`
+    bool submit_fence(VkQueue queue);
+
+    // Hands finished copies to the worker thread. Call once per frame.
+    void poll();
+
+    static bool is_format_supported(VkFormat format);
+
+private:
+    enum SlotState {
+        FREE,
+        RECORDED,
+        SUBMITTED,
+        SAVING
+    };
+
+    struct Slot {
+        std::atomic<int> state;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize capacity = 0;
+        // Persistently mapped
+        uint8_t *mapped = nullptr;
+        VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkExtent2D extent = {};
+        bool bgra = false;
+        char fpath[MAX_PATH_LENGTH];
+
+        Slot(): state(FREE) { fpath[0] = 0; }
+    };
+
+    bool ensure_capacity(Slot &slot, VkDeviceSize size);
+    void worker_loop();
+
+    VulkanDriver *_driver;
+    VkCommandPool _command_pool;
+    Slot _slots[SLOT_COUNT];
+    int _next_slot;
+    int _recorded_slot;
+
+    std::thread _worker;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    // Slots waiting to be saved, protected by the mutex
+    Vector<int> _save_queue;
+    bool _stop_worker;
+};
+
+#endif // HEADER_READBACK_H
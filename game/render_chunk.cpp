@@ -0,0 +1,148 @@
+#include "render_chunk.h"
+#include "mesh.h"
+#include "core/macros.h"
+
+RenderChunk::RenderChunk() {
+}
+
+RenderChunk::~RenderChunk() {
+    // Command buffers must have been freed by the driver
+    assert(_color_command_buffers.size() == 0);
+
+    for (int i = 0; i < _meshes.size(); ++i) {
+        _meshes[i]->set_chunk(nullptr);
+    }
+}
+
+void RenderChunk::add_mesh(Mesh *mesh) {
+    assert(mesh != nullptr);
+    assert(mesh->get_chunk() == nullptr);
+    _meshes.push_back(mesh);
+    mesh->set_chunk(this);
+    mark_dirty();
+}
+
+bool RenderChunk::remove_mesh(Mesh *mesh) {
+    if (_meshes.unordered_remove(mesh)) {
+        mesh->set_chunk(nullptr);
+        mark_dirty();
+        return true;
+    }
+    return false;
+}
+
+const Vector<Mesh*> &RenderChunk::get_meshes() const {
+    return _meshes;
+}
+
+void RenderChunk::mark_dirty() {
+    for (int i = 0; i < _dirty.size(); ++i) {
+        _dirty[i] = true;
+    }
+}
+
+bool RenderChunk::is_dirty(uint32_t image_index) const {
+    return _dirty[image_index];
+}
+
+bool RenderChunk::allocate_command_buffers(VkDevice device, VkCommandPool pool, uint32_t image_count, bool depth_prepass) {
+
+    assert(_color_command_buffers.size() == 0);
+
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    alloc_info.commandBufferCount = image_count;
+
+    _color_command_buffers.resize(image_count, VK_NULL_HANDLE);
+    CHECK_RESULT_V(vkAllocateCommandBuffers(device, &alloc_info, _color_command_buffers.data()), false);
+
+    if (depth_prepass) {
+        _depth_command_buffers.resize(image_count, VK_NULL_HANDLE);
+        CHECK_RESULT_V(vkAllocateCommandBuffers(device, &alloc_info, _depth_command_buffers.data()), false);
+    }
+
+    // Nothing recorded yet
+    _dirty.resize(image_count, true);
+
+    return true;
+}
+
+void RenderChunk::free_command_buffers(VkDevice device, VkCommandPool pool) {
+
+    if (_color_command_buffers.size() != 0) {
+        vkFreeCommandBuffers(device, pool, static_cast<uint32_t>(_color_command_buffers.size()), _color_command_buffers.data());
+        _color_command_buffers.clear();
+    }
+    if (_depth_command_buffers.size() != 0) {
+        vkFreeCommandBuffers(device, pool, static_cast<uint32_t>(_depth_command_buffers.size()), _depth_command_buffers.data());
+        _depth_command_buffers.clear();
+    }
+    _dirty.clear();
+}
+
+static bool begin_secondary(VkCommandBuffer command_buffer, const VkCommandBufferInheritanceInfo &inheritance) {
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    // Entirely inside a render pass
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance;
+
+    CHECK_RESULT_V(vkBeginCommandBuffer(command_buffer, &begin_info), false);
+    return true;
+}
+
+bool RenderChunk::record(uint32_t image_index,
+    const VkCommandBufferInheritanceInfo &color_inheritance, VkPipeline color_pipeline,
+    const VkCommandBufferInheritanceInfo &depth_inheritance, VkPipeline depth_pipeline) {
+
+    assert(image_index < _color_command_buffers.size());
+
+    if (_depth_command_buffers.size() != 0) {
+
+        VkCommandBuffer command_buffer = _depth_command_buffers[image_index];
+        ERR_FAIL_COND_V(!begin_secondary(command_buffer, depth_inheritance), false);
+
+        // Pipeline state is not inherited from the primary command buffer
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_pipeline);
+
+        for (int i = 0; i < _meshes.size(); ++i) {
+            Mesh *mesh = _meshes[i];
+            if (mesh->is_visible() && mesh->is_uploaded()) {
+                mesh->draw_depth(command_buffer);
+            }
+        }
+
+        CHECK_RESULT_V(vkEndCommandBuffer(command_buffer), false);
+    }
+
+    {
+        VkCommandBuffer command_buffer = _color_command_buffers[image_index];
+        ERR_FAIL_COND_V(!begin_secondary(command_buffer, color_inheritance), false);
+
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, color_pipeline);
+
+        for (int i = 0; i < _meshes.size(); ++i) {
+            Mesh *mesh = _meshes[i];
+            if (mesh->is_visible() && mesh->is_uploaded()) {
+                mesh->draw(command_buffer);
+            }
+        }
+
+        CHECK_RESULT_V(vkEndCommandBuffer(command_buffer), false);
+    }
+
+    _dirty[image_index] = false;
+
+    return true;
+}
+
+VkCommandBuffer RenderChunk::get_color_command_buffer(uint32_t image_index) const {
+    return _color_command_buffers[image_index];
+}
+
+VkCommandBuffer RenderChunk::get_depth_command_buffer(uint32_t image_index) const {
+    return _depth_command_buffers.size() == 0 ? VK_NULL_HANDLE : _depth_command_buffers[image_index];
+}
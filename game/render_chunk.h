@@ -0,0 +1,47 @@
+#ifndef HEADER_RENDER_CHUNK_H
+#define HEADER_RENDER_CHUNK_H
+
+#include <vulkan/vulkan.h>
+#include "core/vector.h"
+
+class Mesh;
+
+// Group of meshes whose draw commands are recorded together into secondary command buffers.
+// Recordings are cached, and only redone for chunks that were marked dirty,
+// so static parts of the scene cost nothing to record each frame.
+class RenderChunk {
+public:
+    RenderChunk();
+    ~RenderChunk();
+
+    // Meshes are not owned by the chunk
+    void add_mesh(Mesh *mesh);
+    bool remove_mesh(Mesh *mesh);
+    const Vector<Mesh*> &get_meshes() const;
+
+    // Schedules recording again for every swap chain image
+    void mark_dirty();
+    bool is_dirty(uint32_t image_index) const;
+
+    bool allocate_command_buffers(VkDevice device, VkCommandPool pool, uint32_t image_count, bool depth_prepass);
+    void free_command_buffers(VkDevice device, VkCommandPool pool);
+
+    // `depth_inheritance` is only used when the depth pre-pass is enabled
+    bool record(uint32_t image_index,
+        const VkCommandBufferInheritanceInfo &color_inheritance, VkPipeline color_pipeline,
+        const VkCommandBufferInheritanceInfo &depth_inheritance, VkPipeline depth_pipeline);
+
+    VkCommandBuffer get_color_command_buffer(uint32_t image_index) const;
+    // Null if the depth pre-pass is not enabled
+    VkCommandBuffer get_depth_command_buffer(uint32_t image_index) const;
+
+private:
+    Vector<Mesh*> _meshes;
+
+    // One per swap chain image
+    Vector<VkCommandBuffer> _color_command_buffers;
+    Vector<VkCommandBuffer> _depth_command_buffers;
+    Vector<bool> _dirty;
+};
+
+#endif // HEADER_RENDER_CHUNK_H
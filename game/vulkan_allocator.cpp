@@ -0,0 +1,214 @@
+#include "vulkan_allocator.h"
+#include "core/memory.h"
+#include "core/arena.h"
+#include "core/log.h"
+
+namespace VulkanAllocator {
+
+// Stored right before each block returned to Vulkan
+struct Header {
+    CallSite *call_site;
+    void *base;
+    size_t size;
+    uint32_t scope;
+};
+
+static const char *g_scope_names[SCOPE_COUNT] = {
+    "Command",
+    "Object",
+    "Cache",
+    "Device",
+    "Instance"
+};
+
+static Counters g_scope_counters[SCOPE_COUNT];
+static Counters g_internal_scope_counters[SCOPE_COUNT];
+// Singly-linked list of all call sites, so they can be reported without allocating
+static std::atomic<CallSite*> g_call_sites(nullptr);
+static uint64_t g_alloc_count_at_frame = 0;
+static uint64_t g_last_frame_alloc_count = 0;
+static uint64_t g_max_frame_alloc_count = 0;
+
+void Counters::add(size_t size) {
+    ++alloc_count;
+    uint64_t live = live_bytes += size;
+    uint64_t peak = peak_bytes;
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {
+    }
+}
+
+void Counters::remove(size_t size) {
+    live_bytes -= size;
+}
+
+static inline Header *get_header(void *ptr) {
+    return reinterpret_cast<Header*>(ptr) - 1;
+}
+
+static void *allocate(CallSite *call_site, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+
+    if (size == 0) {
+        return nullptr;
+    }
+
+    // Alignment is always a power of two. We need room for the header before the aligned pointer.
+    if (alignment < alignof(Header)) {
+        alignment = alignof(Header);
+    }
+    size_t total_size = sizeof(Header) + size + alignment - 1;
+
+    uint8_t *base;
+    {
+        // Vulkan objects can outlive any arena in use when they get created or recorded
+        ArenaScope heap_scope(nullptr);
+        base = static_cast<uint8_t*>(Memory::alloc(total_size, call_site->file, call_site->line));
+    }
+    if (base == nullptr) {
+        return nullptr;
+    }
+
+    uintptr_t p = reinterpret_cast<uintptr_t>(base + sizeof(Header));
+    p = (p + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    void *ptr = reinterpret_cast<void*>(p);
+
+    Header *header = get_header(ptr);
+    header->call_site = call_site;
+    header->base = base;
+    header->size = size;
+    header->scope = scope;
+
+    call_site->counters.add(size);
+    g_scope_counters[scope].add(size);
+
+    return ptr;
+}
+
+static void deallocate(void *ptr) {
+
+    if (ptr == nullptr) {
+        return;
+    }
+
+    Header *header = get_header(ptr);
+    // Attributed to where it was allocated, which is not necessarily where it gets freed
+    header->call_site->counters.remove(header->size);
+    g_scope_counters[header->scope].remove(header->size);
+
+    Memory::free(header->base);
+}
+
+static void *VKAPI_PTR cb_allocation(void *user_data, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    return allocate(static_cast<CallSite*>(user_data), size, alignment, scope);
+}
+
+static void *VKAPI_PTR cb_reallocation(void *user_data, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+
+    if (original == nullptr) {
+        return allocate(static_cast<CallSite*>(user_data), size, alignment, scope);
+    }
+    if (size == 0) {
+        deallocate(original);
+        return nullptr;
+    }
+
+    // Can't use realloc, because alignment of the new block relative to its base could differ
+    void *ptr = allocate(static_cast<CallSite*>(user_data), size, alignment, scope);
+    if (ptr == nullptr) {
+        // Original must be left untouched in that case
+        return nullptr;
+    }
+
+    size_t original_size = get_header(original)->size;
+    memcpy(ptr, original, original_size < size ? original_size : size);
+    deallocate(original);
+
+    return ptr;
+}
+
+static void VKAPI_PTR cb_free(void *user_data, void *memory) {
+    deallocate(memory);
+}
+
+static void VKAPI_PTR cb_internal_allocation(void *user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope) {
+    g_internal_scope_counters[scope].add(size);
+}
+
+static void VKAPI_PTR cb_internal_free(void *user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope) {
+    g_internal_scope_counters[scope].remove(size);
+}
+
+CallSite::CallSite(const char *p_file, int p_line): file(p_file), line(p_line), next(nullptr) {
+
+    _callbacks.pUserData = this;
+    _callbacks.pfnAllocation = cb_allocation;
+    _callbacks.pfnReallocation = cb_reallocation;
+    _callbacks.pfnFree = cb_free;
+    _callbacks.pfnInternalAllocation = cb_internal_allocation;
+    _callbacks.pfnInternalFree = cb_internal_free;
+
+    next = g_call_sites.load();
+    while (!g_call_sites.compare_exchange_weak(next, this)) {
+    }
+}
+
+uint64_t get_alloc_count() {
+    uint64_t count = 0;
+    for (int i = 0; i < SCOPE_COUNT; ++i) {
+        count += g_scope_counters[i].alloc_count;
+    }
+    return count;
+}
+
+void mark_frame() {
+    uint64_t count = get_alloc_count();
+    g_last_frame_alloc_count = count - g_alloc_count_at_frame;
+    g_alloc_count_at_frame = count;
+    if (g_last_frame_alloc_count > g_max_frame_alloc_count) {
+        g_max_frame_alloc_count = g_last_frame_alloc_count;
+    }
+}
+
+uint64_t get_last_frame_alloc_count() {
+    return g_last_frame_alloc_count;
+}
+
+const Counters &get_scope_counters(VkSystemAllocationScope scope) {
+    assert(scope >= 0 && scope < SCOPE_COUNT);
+    return g_scope_counters[scope];
+}
+
+const Counters &get_internal_scope_counters(VkSystemAllocationScope scope) {
+    assert(scope >= 0 && scope < SCOPE_COUNT);
+    return g_internal_scope_counters[scope];
+}
+
+static void print_counters(const char *name, const Counters &c) {
+    Console::print_line("\t", name, ": ", (int64_t)c.alloc_count, " allocs, ",
+        (int64_t)c.live_bytes, " bytes live, ", (int64_t)c.peak_bytes, " bytes peak");
+}
+
+void print_report() {
+
+    Log::info("Vulkan host allocations: ", get_alloc_count(),
+        ", max per frame: ", g_max_frame_alloc_count);
+
+    Console::print_line("Per scope:");
+    for (int i = 0; i < SCOPE_COUNT; ++i) {
+        print_counters(g_scope_names[i], g_scope_counters[i]);
+    }
+
+    Console::print_line("Per scope, internal:");
+    for (int i = 0; i < SCOPE_COUNT; ++i) {
+        print_counters(g_scope_names[i], g_internal_scope_counters[i]);
+    }
+
+    Console::print_line("Per call site:");
+    for (CallSite *site = g_call_sites; site != nullptr; site = site->next) {
+        if (site->counters.alloc_count != 0) {
+            Console::print_line("\t", site->file, ":", site->line, ": ", (int64_t)site->counters.alloc_count, " allocs, ",
+                (int64_t)site->counters.live_bytes, " bytes live, ", (int64_t)site->counters.peak_bytes, " bytes peak");
+        }
+    }
+}
+
+} // namespace VulkanAllocator
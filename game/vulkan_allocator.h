@@ -0,0 +1,59 @@
+#ifndef HEADER_VULKAN_ALLOCATOR_H
+#define HEADER_VULKAN_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include "core/types.h"
+
+// Host memory allocator given to the Vulkan implementation, routed through core/memory.
+// Allocations are counted per allocation scope and per call site of the `vkCreate*` function that caused them.
+namespace VulkanAllocator {
+
+const int SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+struct Counters {
+    std::atomic<uint64_t> alloc_count;
+    std::atomic<uint64_t> live_bytes;
+    std::atomic<uint64_t> peak_bytes;
+
+    Counters(): alloc_count(0), live_bytes(0), peak_bytes(0) { }
+
+    void add(size_t size);
+    void remove(size_t size);
+};
+
+// Static for each place allocation callbacks are passed from. Use the VULKAN_ALLOCATOR macro.
+class CallSite {
+public:
+    CallSite(const char *file, int line);
+
+    const VkAllocationCallbacks *get_callbacks() const { return &_callbacks; }
+
+    const char *file;
+    int line;
+    Counters counters;
+    CallSite *next;
+
+private:
+    VkAllocationCallbacks _callbacks;
+};
+
+// Call once per frame to know how many allocations the driver did during the last one
+void mark_frame();
+
+uint64_t get_alloc_count();
+uint64_t get_last_frame_alloc_count();
+const Counters &get_scope_counters(VkSystemAllocationScope scope);
+// Allocations the implementation did on its own and only notified us about
+const Counters &get_internal_scope_counters(VkSystemAllocationScope scope);
+
+void print_report();
+
+} // namespace VulkanAllocator
+
+#define VULKAN_ALLOCATOR ([]() -> const VkAllocationCallbacks * { \
+    static VulkanAllocator::CallSite s_call_site(__FILE__, __LINE__); \
+    return s_call_site.get_callbacks(); \
+}())
+
+#endif // HEADER_VULKAN_ALLOCATOR_H
@@ -1,68 +1,75 @@
 #include "vulkan_driver.h"
 #include "core/macros.h"
 #include "core/file.h"
+#include "vulkan_allocator.h"
 #include "window.h"
 #include "mesh.h"
+#include "render_chunk.h"
+#include "core/hash_set.h"
+#include "core/string_name.h"
+#include "core/trace.h"
+#include <cstdio> // snprintf
 
 // How many frames can be processed concurrently
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+// The payload of draws is the frame slot, the one of uploads is the size in bytes
+static Trace::Event s_draw_event("draw");
+static Trace::Event s_wait_fence_event("wait_fence");
+static Trace::Event s_upload_event("upload");
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL vulkan_debug_callback(
     VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
     VkDebugUtilsMessageTypeFlagsEXT message_type,
     const VkDebugUtilsMessengerCallbackDataEXT *callback_data,
     void *user_data) {
 
-    String msg = L"Vulkan: ";
-
-    if (message_type & VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT) {
-        msg += L"General: ";
-    }
-    if (message_type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) {
-        msg += L"Performance: ";
-    }
-    if (message_type & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT) {
-        msg += L"Validation: ";
-    }
-
-    msg += callback_data->pMessage;
+    // Passed as separate arguments, so the message is only copied into the log queue
+    const char *general = (message_type & VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT) ? "General: " : "";
+    const char *performance = (message_type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) ? "Performance: " : "";
+    const char *validation = (message_type & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT) ? "Validation: " : "";
+    const char *msg = callback_data->pMessage;
 
     if (message_severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
-        Log::error(msg);
+        LOG_ERROR("Vulkan: ", general, performance, validation, msg);
 
     } else if (message_severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
-        Log::warning(msg);
-
-    } else if (message_severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
-        Log::info(msg);
+        LOG_WARNING("Vulkan: ", general, performance, validation, msg);
 
     } else {
-        Log::info(msg);
+        // Verbose messages are compiled out of release builds
+        LOG_DEBUG("Vulkan: ", general, performance, validation, msg);
     }
 
     return VK_FALSE;
 }
 
-static bool contains_all_extensions(const Vector<VkExtensionProperties> &extensions, const Vector<const char*> &expected_names, bool log_error=false) {
+static void get_extension_names(const Vector<VkExtensionProperties> &extensions, HashSet<StringName> &out_names) {
+    out_names.reserve(extensions.size());
+    for(int i = 0; i < extensions.size(); ++i) {
+        out_names.insert(extensions[i].extensionName);
+    }
+}
+
+static bool contains_all_extensions(const HashSet<StringName> &extension_names, const Vector<const char*> &expected_names, bool log_error=false) {
     for(int j = 0; j < expected_names.size(); ++j) {
-        bool found = false;
-        for(int i = 0; i < extensions.size() && !found; ++i) {
-            found |= strcmp(extensions[i].extensionName, expected_names[j]) == 0;
-        }
-        if(!found) {
+        if(!extension_names.has(StringName::find(expected_names[j]))) {
             if(log_error)
-                Log::error("Required Vulkan extension was not found: ", expected_names[j]);
+                LOG_ERROR("Required Vulkan extension was not found: ", expected_names[j]);
             return false;
         }
     }
     return true;
 }
 
+// How many frames between two memory budget queries
+const int MEMORY_BUDGET_UPDATE_INTERVAL = 60;
+
 static VkSemaphore create_semaphore(VkDevice device) {
     VkSemaphore semaphore = VK_NULL_HANDLE;
     VkSemaphoreCreateInfo create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    CHECK_RESULT_V(vkCreateSemaphore(device, &create_info, nullptr, &semaphore), VK_NULL_HANDLE);
+    CHECK_RESULT_V(vkCreateSemaphore(device, &create_info, VULKAN_ALLOCATOR, &semaphore), VK_NULL_HANDLE);
     return semaphore;
 }
 
@@ -74,10 +81,67 @@ static VkFence create_fence(VkDevice device, bool signaled) {
     if (signaled)
         create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    CHECK_RESULT_V(vkCreateFence(device, &create_info, nullptr, &fence), VK_NULL_HANDLE);
+    CHECK_RESULT_V(vkCreateFence(device, &create_info, VULKAN_ALLOCATOR, &fence), VK_NULL_HANDLE);
     return fence;
 }
 
+static VkFormat find_depth_format(VkPhysicalDevice physical_device) {
+
+    // In order of preference. Reversed-Z works best with floating point depth.
+    const VkFormat candidates[] = {
+        VK_FORMAT_D32_SFLOAT,
+        VK_FORMAT_D32_SFLOAT_S8_UINT,
+        VK_FORMAT_D24_UNORM_S8_UINT,
+        VK_FORMAT_D16_UNORM
+    };
+
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physical_device, candidates[i], &properties);
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            return candidates[i];
+        }
+    }
+
+    LOG_ERROR("Could not find a supported depth format");
+    return VK_FORMAT_UNDEFINED;
+}
+
+static bool load_shader_module(VkDevice device, const char *fpath, VkShaderModule &out_module) {
+
+    // Read by the driver straight from the mapping, which is page-aligned
+    MappedFile file;
+    if (!file.open(fpath, MappedFile::ACCESS_SEQUENTIAL)) {
+        LOG_ERROR("Failed to read shader ", fpath);
+        return false;
+    }
+
+    // SPIR-V is made of 32-bit words
+    Span<const uint8_t> code = file.get_span();
+    if (code.is_empty() || code.size() % sizeof(uint32_t) != 0) {
+        LOG_ERROR("Shader is not valid SPIR-V: ", fpath);
+        return false;
+    }
+
+    VkShaderModuleCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    create_info.codeSize = code.size();
+    create_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+    CHECK_RESULT_V(vkCreateShaderModule(device, &create_info, VULKAN_ALLOCATOR, &out_module), false);
+    return true;
+}
+
+struct AutoDestroyShaderModule {
+
+    VkDevice device;
+    VkShaderModule shader_module;
+
+    ~AutoDestroyShaderModule() {
+        vkDestroyShaderModule(device, shader_module, VULKAN_ALLOCATOR);
+    }
+};
+
 VulkanDriver::VulkanDriver() {
 
     _instance = VK_NULL_HANDLE;
@@ -89,16 +153,35 @@ VulkanDriver::VulkanDriver() {
 
     _swap_chain = VK_NULL_HANDLE;
     _swap_chain_image_format = {};
+    _swap_chain_readback_supported = false;
     _swap_chain_extent = {};
 
+    _depth_format = VK_FORMAT_UNDEFINED;
+    _depth_image = VK_NULL_HANDLE;
+    _depth_image_memory = VK_NULL_HANDLE;
+    _depth_image_view = VK_NULL_HANDLE;
+    _depth_prepass_enabled = false;
+
     _render_pass = VK_NULL_HANDLE;
     _pipeline_layout = VK_NULL_HANDLE;
     _graphics_pipeline = VK_NULL_HANDLE;
+    _depth_pipeline = VK_NULL_HANDLE;
+
+    _memory_budget_supported = false;
+
+    _pipeline_statistics_supported = false;
+    _stats_query_pool = VK_NULL_HANDLE;
 
     _command_pool = VK_NULL_HANDLE;
     _short_lived_command_pool = VK_NULL_HANDLE;
 
     _current_frame = 0;
+    _frame_count = 0;
+
+    _capture_requested = false;
+    _capture_path[0] = 0;
+    _capture_interval = 0;
+    _capture_prefix[0] = 0;
 
     _scheduled_resize = false;
 }
@@ -106,54 +189,61 @@ VulkanDriver::VulkanDriver() {
 VulkanDriver::~VulkanDriver() {
     if(_instance) {
 
+        // Loads still in flight are uploaded and handed to their callbacks, which may refer to meshes
+        _async_io.wait_all();
+
         wait();
 
-        for(int i = 0; i < scene.size(); ++i) {
-            delete scene[i];
-        }
-        scene.clear();
+        _readback.clear();
+
+        _meshes.clear();
 
         clear_swap_chain();
 
+        for(int i = 0; i < _chunks.size(); ++i) {
+            delete _chunks[i];
+        }
+        _chunks.clear();
+
         if(_command_pool) {
-            vkDestroyCommandPool(_device, _command_pool, nullptr);
+            vkDestroyCommandPool(_device, _command_pool, VULKAN_ALLOCATOR);
         }
         if(_short_lived_command_pool) {
-            vkDestroyCommandPool(_device, _short_lived_command_pool, nullptr);
+            vkDestroyCommandPool(_device, _short_lived_command_pool, VULKAN_ALLOCATOR);
         }
 
         for (int i = 0; i < _render_finished_semaphores.size(); ++i) {
             if(_render_finished_semaphores[i]) {
-                vkDestroySemaphore(_device, _render_finished_semaphores[i], nullptr);
+                vkDestroySemaphore(_device, _render_finished_semaphores[i], VULKAN_ALLOCATOR);
             }
         }
         for (int i = 0; i < _image_available_semaphores.size(); ++i) {
             if(_image_available_semaphores[i]) {
-                vkDestroySemaphore(_device, _image_available_semaphores[i], nullptr);
+                vkDestroySemaphore(_device, _image_available_semaphores[i], VULKAN_ALLOCATOR);
             }
         }
         for (int i = 0; i < _in_flight_fences.size(); ++i) {
             if(_in_flight_fences[i]) {
-                vkDestroyFence(_device, _in_flight_fences[i], nullptr);
+                vkDestroyFence(_device, _in_flight_fences[i], VULKAN_ALLOCATOR);
             }
         }
 
         if(_device) {
-            vkDestroyDevice(_device, nullptr);
+            vkDestroyDevice(_device, VULKAN_ALLOCATOR);
         }
 
         if(_surface) {
-            vkDestroySurfaceKHR(_instance, _surface, nullptr);
+            vkDestroySurfaceKHR(_instance, _surface, VULKAN_ALLOCATOR);
         }
 
         if(_debug_messenger) {
             auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(_instance, "vkDestroyDebugUtilsMessengerEXT");
             if (func != nullptr) {
-                func(_instance, _debug_messenger, nullptr);
+                func(_instance, _debug_messenger, VULKAN_ALLOCATOR);
             }
         }
 
-        vkDestroyInstance(_instance, nullptr);
+        vkDestroyInstance(_instance, VULKAN_ALLOCATOR);
     }
 }
 
@@ -217,11 +307,27 @@ bool VulkanDriver::create(const char *app_name,
 
         Console::print_line("Available Vulkan extensions:");
         for (int i = 0; i < extensions.size(); ++i) {
-            Console::print_line(L"\t", extensions[i].extensionName);
+            Console::print_line("\t", extensions[i].extensionName);
         }
         Console::print_line();
 
-        ERR_FAIL_COND_V(!contains_all_extensions(extensions, required_extensions, true), false);
+        HashSet<StringName> extension_names;
+        get_extension_names(extensions, extension_names);
+
+        ERR_FAIL_COND_V(!contains_all_extensions(extension_names, required_extensions, true), false);
+
+        // Optional, needed to query memory budgets
+        StringName properties2_name = StringName::find(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        if (extension_names.has(properties2_name)) {
+            bool already_required = false;
+            for (int i = 0; i < required_extensions.size() && !already_required; ++i) {
+                already_required = StringName::find(required_extensions[i]) == properties2_name;
+            }
+            if (!already_required) {
+                required_extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            }
+            _memory_budget_supported = true;
+        }
     }
 
     // List layers
@@ -233,21 +339,18 @@ bool VulkanDriver::create(const char *app_name,
         available_layers.resize_no_init(layer_count);
         vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
 
+        HashSet<StringName> available_layer_names;
+
         Console::print_line("Available Vulkan layers:");
         for (int i = 0; i < available_layers.size(); ++i) {
-            Console::print_line(L"\t", available_layers[i].layerName);
+            Console::print_line("\t", available_layers[i].layerName);
+            available_layer_names.insert(StringName(available_layers[i].layerName));
         }
         Console::print_line();
 
         for (int i = 0; i < required_layers.size(); ++i) {
-
-            bool found = false;
-            for (int j = 0; j < available_layers.size() && !found; ++j) {
-                found |= strcmp(required_layers[i], available_layers[j].layerName) == 0;
-            }
-
-            if (!found) {
-                Log::error(L"Required Vulkan layer is not available: ", required_layers[i]);
+            if (!available_layer_names.has(StringName::find(required_layers[i]))) {
+                LOG_ERROR("Required Vulkan layer is not available: ", required_layers[i]);
                 return false;
             }
         }
@@ -271,7 +374,7 @@ bool VulkanDriver::create(const char *app_name,
         create_info.enabledLayerCount = required_layers.size();
         create_info.ppEnabledLayerNames = required_layers.is_empty() ? nullptr : required_layers.data();
 
-        CHECK_RESULT_V(vkCreateInstance(&create_info, nullptr, &_instance), false);
+        CHECK_RESULT_V(vkCreateInstance(&create_info, VULKAN_ALLOCATOR, &_instance), false);
     }
 
 #if DEBUG
@@ -293,20 +396,20 @@ bool VulkanDriver::create(const char *app_name,
         VkResult result = VK_ERROR_EXTENSION_NOT_PRESENT;
         auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(_instance, "vkCreateDebugUtilsMessengerEXT");
         if (func != nullptr) {
-            result = func(_instance, &create_info, nullptr, &_debug_messenger);
+            result = func(_instance, &create_info, VULKAN_ALLOCATOR, &_debug_messenger);
         } else {
-            Log::error("Could not get function address");
+            LOG_ERROR("Could not get function address");
         }
 
         if (result != VK_SUCCESS) {
-            Log::error(L"Failed to create Vulkan debug callback: result ", result);
+            LOG_ERROR("Failed to create Vulkan debug callback: result ", result);
             return false;
         }
     }
 #endif
 
     // Create main surface
-    CHECK_RESULT_V(window.create_vulkan_surface(_instance, nullptr, &_surface), false);
+    CHECK_RESULT_V(window.create_vulkan_surface(_instance, VULKAN_ALLOCATOR, &_surface), false);
 
     // Pick physical device
     VkPhysicalDevice physical_device = VK_NULL_HANDLE;
@@ -317,14 +420,14 @@ bool VulkanDriver::create(const char *app_name,
         uint32_t physical_devices_count = 0;
         vkEnumeratePhysicalDevices(_instance, &physical_devices_count, nullptr);
         if (physical_devices_count == 0) {
-            Log::error("No Vulkan physical devices found");
+            LOG_ERROR("No Vulkan physical devices found");
             return false;
         }
         Vector<VkPhysicalDevice> physical_devices;
         physical_devices.resize_no_init(physical_devices_count);
         vkEnumeratePhysicalDevices(_instance, &physical_devices_count, physical_devices.data());
 
-        Log::info(L"Found ", (int64_t)physical_devices_count, L" Vulkan physical devices");
+        LOG_INFO("Found ", physical_devices_count, " Vulkan physical devices");
 
         // Select device
         for (int i = 0; i < physical_devices.size(); ++i) {
@@ -346,6 +449,7 @@ bool VulkanDriver::create(const char *app_name,
             vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families.data());
 
             QueueFamilyIndices indices;
+            bool has_memory_budget = false;
 
             for(int j = 0; j < queue_families.size(); ++j) {
                 const VkQueueFamilyProperties &family = queue_families[j];
@@ -379,10 +483,15 @@ bool VulkanDriver::create(const char *app_name,
                 device_extensions.resize_no_init(device_extensions_count);
                 vkEnumerateDeviceExtensionProperties(device, nullptr, &device_extensions_count, device_extensions.data());
 
-                if (!contains_all_extensions(device_extensions, required_device_extensions)) {
+                HashSet<StringName> device_extension_names;
+                get_extension_names(device_extensions, device_extension_names);
+
+                if (!contains_all_extensions(device_extension_names, required_device_extensions)) {
                     // This device doesn't have all extensions we need
                     continue;
                 }
+
+                has_memory_budget = device_extension_names.has(StringName::find(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME));
             }
 
             // Check swap chain support
@@ -394,15 +503,24 @@ bool VulkanDriver::create(const char *app_name,
 
             // Pick that device
             _queue_family_indices = indices;
-            _swap_chain_support_details = details;
             _physical_device = physical_devices[i];
+            // Optional, used for depth complexity statistics.
+            // The query is active while executing secondary command buffers, so they have to inherit it.
+            _pipeline_statistics_supported = features.pipelineStatisticsQuery == VK_TRUE && features.inheritedQueries == VK_TRUE;
+            _memory_budget_supported = _memory_budget_supported && has_memory_budget;
             break;
         }
 
         if (!_physical_device) {
-            Log::error("No suitable Vulkan physical device");
+            LOG_ERROR("No suitable Vulkan physical device");
             return false;
         }
+
+        if (_memory_budget_supported) {
+            required_device_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        } else {
+            LOG_INFO("VK_EXT_memory_budget is not available, GPU memory budget will be estimated");
+        }
     }
 
     // Create logical device
@@ -427,6 +545,8 @@ bool VulkanDriver::create(const char *app_name,
         }
 
         VkPhysicalDeviceFeatures device_features = {};
+        device_features.pipelineStatisticsQuery = _pipeline_statistics_supported ? VK_TRUE : VK_FALSE;
+        device_features.inheritedQueries = _pipeline_statistics_supported ? VK_TRUE : VK_FALSE;
 
         VkDeviceCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -438,12 +558,17 @@ bool VulkanDriver::create(const char *app_name,
         create_info.enabledExtensionCount = static_cast<uint32_t>(required_device_extensions.size());
         create_info.ppEnabledExtensionNames = required_device_extensions.data();
 
-        CHECK_RESULT_V(vkCreateDevice(_physical_device, &create_info, nullptr, &_device), false);
+        CHECK_RESULT_V(vkCreateDevice(_physical_device, &create_info, VULKAN_ALLOCATOR, &_device), false);
     }
 
     vkGetDeviceQueue(_device, _queue_family_indices.graphics, 0, &_graphics_queue);
     vkGetDeviceQueue(_device, _queue_family_indices.presentation, 0, &_present_queue);
 
+    _gpu_memory.init(_instance, _physical_device, _memory_budget_supported);
+
+    _depth_format = find_depth_format(_physical_device);
+    ERR_FAIL_COND_V(_depth_format == VK_FORMAT_UNDEFINED, false);
+
     ERR_FAIL_COND_V(!create_view(window), false);
 
     // Synchronization
@@ -464,6 +589,10 @@ bool VulkanDriver::create(const char *app_name,
             return false;
     }
 
+    ERR_FAIL_COND_V(!_readback.init(*this, _queue_family_indices.graphics), false);
+
+    ERR_FAIL_COND_V(!create_command_buffers(), false);
+
     return true;
 }
 
@@ -491,7 +620,7 @@ void VulkanDriver::clear_swap_chain() {
     for(int i = 0; i < _swap_chain_framebuffers.size(); ++i) {
         VkFramebuffer fb = _swap_chain_framebuffers[i];
         if(fb) {
-            vkDestroyFramebuffer(_device, fb, nullptr);
+            vkDestroyFramebuffer(_device, fb, VULKAN_ALLOCATOR);
         }
     }
     _swap_chain_framebuffers.clear();
@@ -500,32 +629,62 @@ void VulkanDriver::clear_swap_chain() {
         vkFreeCommandBuffers(_device, _command_pool, static_cast<uint32_t>(_command_buffers.size()), _command_buffers.data());
         _command_buffers.clear();
     }
+    _command_buffers_dirty.clear();
+    _images_in_flight.clear();
+
+    for(int i = 0; i < _chunks.size(); ++i) {
+        _chunks[i]->free_command_buffers(_device, _command_pool);
+    }
+
+    if(_stats_query_pool) {
+        vkDestroyQueryPool(_device, _stats_query_pool, VULKAN_ALLOCATOR);
+        _stats_query_pool = VK_NULL_HANDLE;
+    }
+    _stats_query_submitted.clear();
 
     if(_graphics_pipeline) {
-        vkDestroyPipeline(_device, _graphics_pipeline, nullptr);
+        vkDestroyPipeline(_device, _graphics_pipeline, VULKAN_ALLOCATOR);
         _graphics_pipeline = VK_NULL_HANDLE;
     }
 
+    if(_depth_pipeline) {
+        vkDestroyPipeline(_device, _depth_pipeline, VULKAN_ALLOCATOR);
+        _depth_pipeline = VK_NULL_HANDLE;
+    }
+
     if(_pipeline_layout) {
-        vkDestroyPipelineLayout(_device, _pipeline_layout, nullptr);
+        vkDestroyPipelineLayout(_device, _pipeline_layout, VULKAN_ALLOCATOR);
         _pipeline_layout = VK_NULL_HANDLE;
     }
 
     if (_render_pass) {
-        vkDestroyRenderPass(_device, _render_pass, nullptr);
+        vkDestroyRenderPass(_device, _render_pass, VULKAN_ALLOCATOR);
         _render_pass = VK_NULL_HANDLE;
     }
 
+    if (_depth_image_view) {
+        vkDestroyImageView(_device, _depth_image_view, VULKAN_ALLOCATOR);
+        _depth_image_view = VK_NULL_HANDLE;
+    }
+    if (_depth_image) {
+        vkDestroyImage(_device, _depth_image, VULKAN_ALLOCATOR);
+        _depth_image = VK_NULL_HANDLE;
+    }
+    if (_depth_image_memory) {
+        free_memory(_depth_image_memory);
+        _depth_image_memory = VK_NULL_HANDLE;
+    }
+
     for (int i = 0; i < _swap_chain_image_views.size(); ++i) {
         VkImageView view = _swap_chain_image_views[i];
         if(view) {
-            vkDestroyImageView(_device, view, nullptr);
+            vkDestroyImageView(_device, view, VULKAN_ALLOCATOR);
         }
     }
     _swap_chain_image_views.clear();
 
     if(_swap_chain) {
-        vkDestroySwapchainKHR(_device, _swap_chain, nullptr);
+        vkDestroySwapchainKHR(_device, _swap_chain, VULKAN_ALLOCATOR);
         _swap_chain = VK_NULL_HANDLE;
     }
 }
@@ -535,9 +694,13 @@ bool VulkanDriver::create_swap_chain(const Window &window) {
 
     assert(_swap_chain == VK_NULL_HANDLE);
 
-    // TODO Do we really need to query this again?
-    query_swap_chain_details(_physical_device, _surface, _swap_chain_support_details);
-    const SwapChainSupportDetails &support_details = _swap_chain_support_details;
+    // Surface capabilities can change, for example on resize
+    SwapChainSupportDetails support_details;
+    {
+        // Only needed while creating the swap chain
+        ArenaScope arena_scope(&_frame_arena);
+        query_swap_chain_details(_physical_device, _surface, support_details);
+    }
 
     // Format
     VkSurfaceFormatKHR surface_format = {};
@@ -554,7 +717,7 @@ bool VulkanDriver::create_swap_chain(const Window &window) {
         }
     }
     if(surface_format.format == VK_FORMAT_UNDEFINED) {
-        Log::warning("Falling back on first found surface format");
+        LOG_WARNING("Falling back on first found surface format");
         surface_format = support_details.formats[0];
     }
 
@@ -599,6 +762,12 @@ bool VulkanDriver::create_swap_chain(const Window &window) {
         create_info.imageArrayLayers = 1;
         create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // Note: use TRANSFERT_DST if we do post-processing
 
+        // Needed to capture frames
+        _swap_chain_readback_supported = (support_details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+        if (_swap_chain_readback_supported) {
+            create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
+
         uint32_t indices[] = {(uint32_t) _queue_family_indices.graphics, (uint32_t) _queue_family_indices.presentation};
         if (_queue_family_indices.graphics != _queue_family_indices.presentation) {
             create_info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
@@ -617,7 +786,7 @@ bool VulkanDriver::create_swap_chain(const Window &window) {
         create_info.clipped = VK_TRUE; // Don't care about pixels behind other windows
         create_info.oldSwapchain = VK_NULL_HANDLE;
 
-        CHECK_RESULT_V(vkCreateSwapchainKHR(_device, &create_info, nullptr, &_swap_chain), false);
+        CHECK_RESULT_V(vkCreateSwapchainKHR(_device, &create_info, VULKAN_ALLOCATOR, &_swap_chain), false);
     }
 
     vkGetSwapchainImagesKHR(_device, _swap_chain, &image_count, nullptr);
@@ -646,12 +815,39 @@ bool VulkanDriver::create_swap_chain(const Window &window) {
         create_info.subresourceRange.baseArrayLayer = 0;
         create_info.subresourceRange.layerCount = 1;
 
-        CHECK_RESULT_V(vkCreateImageView(_device, &create_info, nullptr, &_swap_chain_image_views[i]), false);
+        CHECK_RESULT_V(vkCreateImageView(_device, &create_info, VULKAN_ALLOCATOR, &_swap_chain_image_views[i]), false);
     }
 
     return true;
 }
 
+bool VulkanDriver::create_depth_resources() {
+
+    assert(_depth_image == VK_NULL_HANDLE);
+    assert(_depth_format != VK_FORMAT_UNDEFINED);
+
+    // Only one depth image is needed even with multiple frames in flight,
+    // because the render pass dependencies prevent two frames from writing to it at the same time
+    ERR_FAIL_COND_V(!create_image(_swap_chain_extent.width, _swap_chain_extent.height, _depth_format,
+        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _depth_image, _depth_image_memory), false);
+
+    VkImageViewCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    create_info.image = _depth_image;
+    create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    create_info.format = _depth_format;
+    create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    create_info.subresourceRange.baseMipLevel = 0;
+    create_info.subresourceRange.levelCount = 1;
+    create_info.subresourceRange.baseArrayLayer = 0;
+    create_info.subresourceRange.layerCount = 1;
+
+    CHECK_RESULT_V(vkCreateImageView(_device, &create_info, VULKAN_ALLOCATOR, &_depth_image_view), false);
+
+    return true;
+}
+
 bool VulkanDriver::create_render_pass() {
 
     assert(_render_pass == VK_NULL_HANDLE);
@@ -669,37 +865,106 @@ bool VulkanDriver::create_render_pass() {
     color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
+    VkAttachmentDescription depth_attachment = {};
+    depth_attachment.format = _depth_format;
+    depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    // Depth is not needed after drawing
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription attachments[] = { color_attachment, depth_attachment };
+
     VkAttachmentReference color_attachment_ref = {};
     color_attachment_ref.attachment = 0;
     color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-    VkSubpassDescription subpass = {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
+    VkAttachmentReference depth_attachment_ref = {};
+    depth_attachment_ref.attachment = 1;
+    depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    // Optional depth-only subpass, filling the depth buffer before any shading happens
+    VkSubpassDescription depth_subpass = {};
+    depth_subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    depth_subpass.colorAttachmentCount = 0;
+    depth_subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+    VkSubpassDescription color_subpass = {};
+    color_subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    color_subpass.colorAttachmentCount = 1;
     // The index of the attachment in this array is directly referenced from
     // the fragment shader with the layout(location = 0) out vec4 outColor directive!
-    subpass.pColorAttachments = &color_attachment_ref;
+    color_subpass.pColorAttachments = &color_attachment_ref;
+    color_subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+    VkSubpassDescription subpasses[] = { depth_subpass, color_subpass };
+    uint32_t subpass_count = 2;
+    VkSubpassDescription *first_subpass = subpasses;
+    if (!_depth_prepass_enabled) {
+        first_subpass = subpasses + 1;
+        subpass_count = 1;
+    }
+
+    VkSubpassDependency dependencies[4] = {};
+    uint32_t dependency_count = 0;
 
     // We need to wait for the swap chain to finish reading from the image before we can access it.
     // This can be accomplished by waiting on the color attachment output stage itself.
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    // The depth buffer is shared between frames in flight, so we also wait for the previous frame to be done with it.
+    VkSubpassDependency &external_dependency = dependencies[dependency_count++];
+    external_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    external_dependency.dstSubpass = 0;
+    external_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    external_dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    external_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    external_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    if (_depth_prepass_enabled) {
+        // The color pass must see all depth written by the pre-pass
+        VkSubpassDependency &prepass_dependency = dependencies[dependency_count++];
+        prepass_dependency.srcSubpass = 0;
+        prepass_dependency.dstSubpass = 1;
+        prepass_dependency.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        prepass_dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        prepass_dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        prepass_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+        prepass_dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        // With the pre-pass, the color attachment is first used by the second subpass, where its layout transition
+        // and clear happen. They must also wait for the swap chain to release the image.
+        VkSubpassDependency &color_external_dependency = dependencies[dependency_count++];
+        color_external_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        color_external_dependency.dstSubpass = 1;
+        color_external_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        color_external_dependency.srcAccessMask = 0;
+        color_external_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        color_external_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    }
+
+    // Captures copy the image right after the pass. The implicit dependency to outside the pass only goes to
+    // BOTTOM_OF_PIPE, which later commands can't wait on, so the transfer stage is named explicitly.
+    VkSubpassDependency &capture_dependency = dependencies[dependency_count++];
+    capture_dependency.srcSubpass = subpass_count - 1;
+    capture_dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    capture_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    capture_dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    capture_dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    capture_dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
     VkRenderPassCreateInfo create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    create_info.attachmentCount = 1;
-    create_info.pAttachments = &color_attachment;
-    create_info.subpassCount = 1;
-    create_info.pSubpasses = &subpass;
-    create_info.dependencyCount = 1;
-    create_info.pDependencies = &dependency;
+    create_info.attachmentCount = 2;
+    create_info.pAttachments = attachments;
+    create_info.subpassCount = subpass_count;
+    create_info.pSubpasses = first_subpass;
+    create_info.dependencyCount = dependency_count;
+    create_info.pDependencies = dependencies;
 
-    CHECK_RESULT_V(vkCreateRenderPass(_device, &create_info, nullptr, &_render_pass), false);
+    CHECK_RESULT_V(vkCreateRenderPass(_device, &create_info, VULKAN_ALLOCATOR, &_render_pass), false);
 
     return true;
 }
@@ -711,51 +976,12 @@ bool VulkanDriver::create_pipeline() {
 
     // Shader stages
 
-    Vector<uint8_t> vert_shader_code;
-    Vector<uint8_t> frag_shader_code;
-
-    if (!File::read_all_bytes("default.vert.spv", vert_shader_code)) {
-        Log::error("Failed to read vertex shader");
-        return false;
-    }
-    if (!File::read_all_bytes("default.frag.spv", frag_shader_code)) {
-        Log::error("Failed to read fragment shader");
-        return false;
-    }
-
-    vert_shader_code.align(sizeof(uint32_t), 0);
-    frag_shader_code.align(sizeof(uint32_t), 0);
-
     VkShaderModule vert_shader_module = VK_NULL_HANDLE;
-    {
-        VkShaderModuleCreateInfo create_info = {};
-        create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        create_info.codeSize = vert_shader_code.size();
-        create_info.pCode = reinterpret_cast<const uint32_t*>(vert_shader_code.data());
+    ERR_FAIL_COND_V(!load_shader_module(_device, "default.vert.spv", vert_shader_module), false);
+    AutoDestroyShaderModule auto_destroy_vert_shader_module = { _device, vert_shader_module };
 
-        CHECK_RESULT_V(vkCreateShaderModule(_device, &create_info, nullptr, &vert_shader_module), false);
-    }
     VkShaderModule frag_shader_module = VK_NULL_HANDLE;
-    {
-        VkShaderModuleCreateInfo create_info = {};
-        create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        create_info.codeSize = frag_shader_code.size();
-        create_info.pCode = reinterpret_cast<const uint32_t*>(frag_shader_code.data());
-
-        CHECK_RESULT_V(vkCreateShaderModule(_device, &create_info, nullptr, &frag_shader_module), false);
-    }
-
-    struct AutoDestroyShaderModule {
-
-        VkDevice device;
-        VkShaderModule shader_module;
-
-        ~AutoDestroyShaderModule() {
-            vkDestroyShaderModule(device, shader_module, nullptr);
-        }
-    };
-
-    AutoDestroyShaderModule auto_destroy_vert_shader_module = { _device, vert_shader_module };
+    ERR_FAIL_COND_V(!load_shader_module(_device, "default.frag.spv", frag_shader_module), false);
     AutoDestroyShaderModule auto_destroy_frag_shader_module = { _device, frag_shader_module };
 
     VkPipelineShaderStageCreateInfo vert_shader_stage_info = {};
@@ -863,6 +1089,21 @@ bool VulkanDriver::create_pipeline() {
     color_blending.blendConstants[2] = 0.0f; // Optional
     color_blending.blendConstants[3] = 0.0f; // Optional
 
+    // Reversed-Z: depth is cleared to 0 and closer fragments have greater depth
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+    depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable = VK_TRUE;
+    if (_depth_prepass_enabled) {
+        // Depth is already final, only shade the fragments that won
+        depth_stencil.depthWriteEnable = VK_FALSE;
+        depth_stencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    } else {
+        depth_stencil.depthWriteEnable = VK_TRUE;
+        depth_stencil.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+    }
+    depth_stencil.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil.stencilTestEnable = VK_FALSE;
+
 //        VkDynamicState dynamic_states[] = {
 //            VK_DYNAMIC_STATE_VIEWPORT
 //        };
@@ -881,7 +1122,7 @@ bool VulkanDriver::create_pipeline() {
         create_info.pushConstantRangeCount = 0; // Optional
         create_info.pPushConstantRanges = nullptr; // Optional
 
-        CHECK_RESULT_V(vkCreatePipelineLayout(_device, &create_info, nullptr, &_pipeline_layout), false);
+        CHECK_RESULT_V(vkCreatePipelineLayout(_device, &create_info, VULKAN_ALLOCATOR, &_pipeline_layout), false);
     }
 
     {
@@ -894,16 +1135,16 @@ bool VulkanDriver::create_pipeline() {
         create_info.pViewportState = &viewport_state;
         create_info.pRasterizationState = &rasterizer;
         create_info.pMultisampleState = &multisampling;
-        create_info.pDepthStencilState = nullptr; // Optional
+        create_info.pDepthStencilState = &depth_stencil;
         create_info.pColorBlendState = &color_blending;
         create_info.pDynamicState = nullptr; // Optional
         create_info.layout = _pipeline_layout;
         create_info.renderPass = _render_pass;
-        create_info.subpass = 0;
+        create_info.subpass = _depth_prepass_enabled ? 1 : 0;
         create_info.basePipelineHandle = VK_NULL_HANDLE; // Optional
         create_info.basePipelineIndex = -1; // Optional
 
-        CHECK_RESULT_V(vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &create_info, nullptr, &_graphics_pipeline), false);
+        CHECK_RESULT_V(vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &create_info, VULKAN_ALLOCATOR, &_graphics_pipeline), false);
     }
 
     //...
@@ -913,6 +1154,108 @@ bool VulkanDriver::create_pipeline() {
     return true;
 }
 
+bool VulkanDriver::create_depth_pipeline() {
+
+    assert(_depth_pipeline == VK_NULL_HANDLE);
+    assert(_render_pass != VK_NULL_HANDLE);
+    // Shares the layout of the main pipeline
+    assert(_pipeline_layout != VK_NULL_HANDLE);
+
+    // Vertex stage only, no fragment shader is needed to write depth
+    VkShaderModule vert_shader_module = VK_NULL_HANDLE;
+    ERR_FAIL_COND_V(!load_shader_module(_device, "depth.vert.spv", vert_shader_module), false);
+    AutoDestroyShaderModule auto_destroy_vert_shader_module = { _device, vert_shader_module };
+
+    VkPipelineShaderStageCreateInfo vert_shader_stage_info = {};
+    vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vert_shader_stage_info.module = vert_shader_module;
+    vert_shader_stage_info.pName = "main";
+
+    // Positions only, so the pre-pass fetches as little vertex data as possible
+    VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+    Vector<VkVertexInputBindingDescription> vertex_bindings;
+    Vector<VkVertexInputAttributeDescription> vertex_attributes;
+    Mesh::get_position_description(vertex_bindings, vertex_attributes);
+
+    vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input_info.vertexBindingDescriptionCount = vertex_bindings.size();
+    vertex_input_info.pVertexBindingDescriptions = vertex_bindings.data();
+    vertex_input_info.vertexAttributeDescriptionCount = vertex_attributes.size();
+    vertex_input_info.pVertexAttributeDescriptions = vertex_attributes.data();
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+    input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    input_assembly.primitiveRestartEnable = VK_FALSE;
+
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float) _swap_chain_extent.width;
+    viewport.height = (float) _swap_chain_extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor = {};
+    scissor.offset = {0, 0};
+    scissor.extent = _swap_chain_extent;
+
+    VkPipelineViewportStateCreateInfo viewport_state = {};
+    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.viewportCount = 1;
+    viewport_state.pViewports = &viewport;
+    viewport_state.scissorCount = 1;
+    viewport_state.pScissors = &scissor;
+
+    // Must match the color pipeline, otherwise EQUAL tests will fail
+    VkPipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.minSampleShading = 1.0f;
+
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+    depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable = VK_TRUE;
+    depth_stencil.depthWriteEnable = VK_TRUE;
+    depth_stencil.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+    depth_stencil.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil.stencilTestEnable = VK_FALSE;
+
+    VkGraphicsPipelineCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    create_info.stageCount = 1;
+    create_info.pStages = &vert_shader_stage_info;
+    create_info.pVertexInputState = &vertex_input_info;
+    create_info.pInputAssemblyState = &input_assembly;
+    create_info.pViewportState = &viewport_state;
+    create_info.pRasterizationState = &rasterizer;
+    create_info.pMultisampleState = &multisampling;
+    create_info.pDepthStencilState = &depth_stencil;
+    create_info.pColorBlendState = nullptr; // No color attachments in that subpass
+    create_info.pDynamicState = nullptr;
+    create_info.layout = _pipeline_layout;
+    create_info.renderPass = _render_pass;
+    create_info.subpass = 0;
+    create_info.basePipelineHandle = VK_NULL_HANDLE;
+    create_info.basePipelineIndex = -1;
+
+    CHECK_RESULT_V(vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &create_info, VULKAN_ALLOCATOR, &_depth_pipeline), false);
+
+    return true;
+}
+
 bool VulkanDriver::create_framebuffers() {
 
     assert(_swap_chain_framebuffers.size() == 0);
@@ -923,27 +1266,65 @@ bool VulkanDriver::create_framebuffers() {
     for (size_t i = 0; i < _swap_chain_images.size(); ++i) {
 
         VkImageView attachments[] = {
-            _swap_chain_image_views[i]
+            _swap_chain_image_views[i],
+            _depth_image_view
         };
 
         VkFramebufferCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         create_info.renderPass = _render_pass;
-        create_info.attachmentCount = 1;
+        create_info.attachmentCount = 2;
         create_info.pAttachments = attachments;
         create_info.width = _swap_chain_extent.width;
         create_info.height = _swap_chain_extent.height;
         create_info.layers = 1;
 
-        CHECK_RESULT_V(vkCreateFramebuffer(_device, &create_info, nullptr, &_swap_chain_framebuffers[i]), false);
+        CHECK_RESULT_V(vkCreateFramebuffer(_device, &create_info, VULKAN_ALLOCATOR, &_swap_chain_framebuffers[i]), false);
     }
 
     return true;
 }
 
-bool VulkanDriver::create_command_buffers() {
+bool VulkanDriver::create_query_pool() {
+
+    assert(_stats_query_pool == VK_NULL_HANDLE);
+
+    if (!_pipeline_statistics_supported) {
+        return true;
+    }
+
+    VkQueryPoolCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    create_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    create_info.queryCount = static_cast<uint32_t>(_swap_chain_images.size());
+    create_info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    CHECK_RESULT_V(vkCreateQueryPool(_device, &create_info, VULKAN_ALLOCATOR, &_stats_query_pool), false);
+
+    // Queries can't be read before their first reset, which happens in command buffers
+    _stats_query_submitted.resize(_swap_chain_images.size(), false);
+
+    return true;
+}
+
+void VulkanDriver::read_depth_stats(uint32_t image_index) {
+
+    if (_stats_query_pool == VK_NULL_HANDLE || !_stats_query_submitted[image_index]) {
+        return;
+    }
 
-    // TODO Support updating command buffers
+    // Don't wait, if the results aren't there yet we'll get them another time
+    uint64_t fragment_invocations = 0;
+    VkResult result = vkGetQueryPoolResults(_device, _stats_query_pool, image_index, 1,
+        sizeof(fragment_invocations), &fragment_invocations, sizeof(fragment_invocations), VK_QUERY_RESULT_64_BIT);
+
+    if (result == VK_SUCCESS) {
+        _depth_stats.fragment_invocations = fragment_invocations;
+        _depth_stats.pixel_count = static_cast<uint64_t>(_swap_chain_extent.width) * _swap_chain_extent.height;
+    }
+}
+
+bool VulkanDriver::create_command_buffers() {
 
     assert(_command_buffers.size() == 0);
     assert(_swap_chain_framebuffers.size() != 0);
@@ -953,9 +1334,10 @@ bool VulkanDriver::create_command_buffers() {
         VkCommandPoolCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         create_info.queueFamilyIndex = _queue_family_indices.graphics;
-        create_info.flags = 0; // Optional
+        // Command buffers are recorded again individually when their content changes
+        create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-        CHECK_RESULT_V(vkCreateCommandPool(_device, &create_info, nullptr, &_command_pool), false);
+        CHECK_RESULT_V(vkCreateCommandPool(_device, &create_info, VULKAN_ALLOCATOR, &_command_pool), false);
     }
 
     {
@@ -970,57 +1352,173 @@ bool VulkanDriver::create_command_buffers() {
         CHECK_RESULT_V(vkAllocateCommandBuffers(_device, &alloc_info, _command_buffers.data()), false);
     }
 
-    for (size_t i = 0; i < _command_buffers.size(); ++i) {
+    // Recording is deferred to the frames using them
+    _command_buffers_dirty.resize(_command_buffers.size(), true);
+    _images_in_flight.resize(_command_buffers.size(), VK_NULL_HANDLE);
 
-        VkCommandBuffer command_buffer = _command_buffers[i];
+    for (int i = 0; i < _chunks.size(); ++i) {
+        RenderChunk *chunk = _chunks[i];
+        ERR_FAIL_COND_V(!chunk->allocate_command_buffers(_device, _command_pool, _command_buffers.size(), _depth_prepass_enabled), false);
+    }
+
+    return true;
+}
+
+bool VulkanDriver::record_command_buffer(uint32_t image_index) {
+
+    bool primary_dirty = _command_buffers_dirty[image_index];
+
+    VkCommandBufferInheritanceInfo depth_inheritance = {};
+    depth_inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    depth_inheritance.renderPass = _render_pass;
+    depth_inheritance.subpass = 0;
+    depth_inheritance.framebuffer = _swap_chain_framebuffers[image_index];
+    if (_stats_query_pool) {
+        depth_inheritance.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    }
+
+    VkCommandBufferInheritanceInfo color_inheritance = depth_inheritance;
+    color_inheritance.subpass = _depth_prepass_enabled ? 1 : 0;
+
+    for (int i = 0; i < _chunks.size(); ++i) {
+        RenderChunk *chunk = _chunks[i];
+        if (chunk->is_dirty(image_index)) {
+            ERR_FAIL_COND_V(!chunk->record(image_index, color_inheritance, _graphics_pipeline, depth_inheritance, _depth_pipeline), false);
+            // Recording a secondary command buffer invalidates primaries executing it
+            primary_dirty = true;
+        }
+    }
 
-        VkCommandBufferBeginInfo begin_info = {};
-        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-        begin_info.pInheritanceInfo = nullptr; // Optional
+    if (!primary_dirty) {
+        return true;
+    }
 
-        CHECK_RESULT_V(vkBeginCommandBuffer(command_buffer, &begin_info), false);
+    VkCommandBuffer command_buffer = _command_buffers[image_index];
 
-        VkRenderPassBeginInfo pass_info = {};
-        pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        pass_info.renderPass = _render_pass;
-        pass_info.framebuffer = _swap_chain_framebuffers[i];
-        pass_info.renderArea.offset = {0, 0};
-        pass_info.renderArea.extent = _swap_chain_extent;
-        VkClearValue clear_color = {0.0f, 0.0f, 0.0f, 1.0f};
-        pass_info.clearValueCount = 1;
-        pass_info.pClearValues = &clear_color;
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = 0;
+    begin_info.pInheritanceInfo = nullptr; // Optional
 
-        vkCmdBeginRenderPass(command_buffer, &pass_info, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphics_pipeline);
+    CHECK_RESULT_V(vkBeginCommandBuffer(command_buffer, &begin_info), false);
 
-        for(int i = 0; i < scene.size(); ++i)
-            scene[i]->draw(command_buffer);
+    if (_stats_query_pool) {
+        // Must be outside of the render pass.
+        // The query covers the whole pass, which is fine because the depth pipeline has no fragment shader.
+        vkCmdResetQueryPool(command_buffer, _stats_query_pool, image_index, 1);
+        vkCmdBeginQuery(command_buffer, _stats_query_pool, image_index, 0);
+    }
 
-        vkCmdEndRenderPass(command_buffer);
+    VkRenderPassBeginInfo pass_info = {};
+    pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    pass_info.renderPass = _render_pass;
+    pass_info.framebuffer = _swap_chain_framebuffers[image_index];
+    pass_info.renderArea.offset = {0, 0};
+    pass_info.renderArea.extent = _swap_chain_extent;
+    VkClearValue clear_values[2] = {};
+    clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    // Reversed-Z, far is 0
+    clear_values[1].depthStencil = {0.0f, 0};
+    pass_info.clearValueCount = 2;
+    pass_info.pClearValues = clear_values;
+
+    // Transient, so taken from the frame arena
+    ArenaScope arena_scope(&_frame_arena);
+    Vector<VkCommandBuffer> secondaries;
+
+    vkCmdBeginRenderPass(command_buffer, &pass_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    if (_depth_prepass_enabled) {
+        for (int i = 0; i < _chunks.size(); ++i) {
+            secondaries.push_back(_chunks[i]->get_depth_command_buffer(image_index));
+        }
+        if (secondaries.size() != 0) {
+            vkCmdExecuteCommands(command_buffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+        }
 
-        CHECK_RESULT_V(vkEndCommandBuffer(command_buffer), false);
+        vkCmdNextSubpass(command_buffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
     }
 
+    secondaries.clear();
+    for (int i = 0; i < _chunks.size(); ++i) {
+        secondaries.push_back(_chunks[i]->get_color_command_buffer(image_index));
+    }
+    if (secondaries.size() != 0) {
+        vkCmdExecuteCommands(command_buffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+    }
+
+    vkCmdEndRenderPass(command_buffer);
+
+    if (_stats_query_pool) {
+        vkCmdEndQuery(command_buffer, _stats_query_pool, image_index);
+    }
+
+    CHECK_RESULT_V(vkEndCommandBuffer(command_buffer), false);
+
+    _command_buffers_dirty[image_index] = false;
+
     return true;
 }
 
+RenderChunk *VulkanDriver::create_chunk() {
+
+    RenderChunk *chunk = new RenderChunk();
+    _chunks.push_back(chunk);
+
+    if (_command_buffers.size() != 0) {
+        if (!chunk->allocate_command_buffers(_device, _command_pool, _command_buffers.size(), _depth_prepass_enabled)) {
+            LOG_ERROR("Failed to allocate command buffers of render chunk");
+        }
+        // Primaries have to execute the new chunk
+        for (int i = 0; i < _command_buffers_dirty.size(); ++i) {
+            _command_buffers_dirty[i] = true;
+        }
+    }
+
+    return chunk;
+}
+
+Mesh *VulkanDriver::create_mesh(RenderChunk *chunk) {
+
+    if (chunk == nullptr) {
+        if (_chunks.size() == 0) {
+            create_chunk();
+        }
+        chunk = _chunks[0];
+    }
+
+    Mesh *mesh = _meshes.get(_meshes.create());
+    chunk->add_mesh(mesh);
+    return mesh;
+}
+
 bool VulkanDriver::create_view(const Window &window) {
 
     ERR_FAIL_COND_V(!create_swap_chain(window), false);
+    ERR_FAIL_COND_V(!create_depth_resources(), false);
     ERR_FAIL_COND_V(!create_render_pass(), false);
     ERR_FAIL_COND_V(!create_pipeline(), false);
+    if (_depth_prepass_enabled) {
+        ERR_FAIL_COND_V(!create_depth_pipeline(), false);
+    }
     ERR_FAIL_COND_V(!create_framebuffers(), false);
+    ERR_FAIL_COND_V(!create_query_pool(), false);
 
     return true;
 }
 
 bool VulkanDriver::draw(const Window &window) {
+    TRACE_SCOPE(s_draw_event, _current_frame);
+
+    // Uploads buffers whose file was read since the last frame
+    _async_io.update();
 
     const uint64_t max_uint64 = 0xffffffffffffffff;
 
     // Wait in case the current frame is still rendering
+    Trace::begin(s_wait_fence_event);
     vkWaitForFences(_device, 1, &_in_flight_fences[_current_frame], VK_TRUE, max_uint64);
+    Trace::end(s_wait_fence_event);
 
     // Acquire image
 
@@ -1033,11 +1531,30 @@ bool VulkanDriver::draw(const Window &window) {
             return true;
 
         } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-            Log::error("Failed to acquire next swap chain image, result: ", result);
+            LOG_ERROR("Failed to acquire next swap chain image, result: ", result);
             return false;
         }
     }
 
+    // The image may still be used by a previous frame if the swap chain gives them out of order
+    if (_images_in_flight[image_index] != VK_NULL_HANDLE) {
+        vkWaitForFences(_device, 1, &_images_in_flight[image_index], VK_TRUE, max_uint64);
+    }
+    _images_in_flight[image_index] = _in_flight_fences[_current_frame];
+
+    read_depth_stats(image_index);
+
+    // Only parts of the scene that changed are recorded again
+    ERR_FAIL_COND_V(!record_command_buffer(image_index), false);
+
+    // Optional copy of the image for captures, executed right after rendering and before presentation
+    VkCommandBuffer command_buffers[2] = { _command_buffers[image_index], VK_NULL_HANDLE };
+    uint32_t command_buffer_count = 1;
+    VkCommandBuffer capture_command_buffer = record_capture(image_index);
+    if (capture_command_buffer != VK_NULL_HANDLE) {
+        command_buffers[command_buffer_count++] = capture_command_buffer;
+    }
+
     // Submit commands
 
     VkSubmitInfo submit_info = {};
@@ -1050,8 +1567,8 @@ bool VulkanDriver::draw(const Window &window) {
     submit_info.waitSemaphoreCount = 1;
     submit_info.pWaitSemaphores = submit_wait_semaphores;
     submit_info.pWaitDstStageMask = wait_stages;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &_command_buffers[image_index];
+    submit_info.commandBufferCount = command_buffer_count;
+    submit_info.pCommandBuffers = command_buffers;
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores = submit_signal_semaphores;
 
@@ -1060,6 +1577,15 @@ bool VulkanDriver::draw(const Window &window) {
     // Note: we use a fence which will be signaled when the command buffers finish to execute
     CHECK_RESULT_V(vkQueueSubmit(_graphics_queue, 1, &submit_info, _in_flight_fences[_current_frame]), false);
 
+    if (_stats_query_pool) {
+        _stats_query_submitted[image_index] = true;
+    }
+
+    if (capture_command_buffer != VK_NULL_HANDLE) {
+        CHECK_RESULT_V(_readback.submit_fence(_graphics_queue), false);
+    }
+    _readback.poll();
+
     // Present
 
     VkPresentInfoKHR present_info = {};
@@ -1079,13 +1605,21 @@ bool VulkanDriver::draw(const Window &window) {
             resize(window);
 
         } else if (result != VK_SUCCESS) {
-            Log::error("Vulkan present failed with result ", result);
+            LOG_ERROR("Vulkan present failed with result ", result);
             return false;
         }
     }
 
     _current_frame = (_current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
 
+    ++_frame_count;
+    VulkanAllocator::mark_frame();
+    _frame_arena.reset();
+    if (_frame_count % MEMORY_BUDGET_UPDATE_INTERVAL == 0) {
+        // Usage by other applications can change at any time
+        _gpu_memory.update_budget();
+    }
+
     return true;
 }
 
@@ -1101,23 +1635,71 @@ VkPhysicalDevice VulkanDriver::get_physical_device() const {
     return _physical_device;
 }
 
-static bool find_memory_type(VkPhysicalDevice physical_device, uint32_t type_filter, VkMemoryPropertyFlags properties, uint32_t &out_memory_type) {
+void VulkanDriver::set_depth_prepass_enabled(bool enabled) {
+    if (enabled != _depth_prepass_enabled) {
+        _depth_prepass_enabled = enabled;
+        if (_device) {
+            // Render pass and pipelines need to be rebuilt, which resizing already does
+            schedule_resize();
+        }
+    }
+}
 
-    VkPhysicalDeviceMemoryProperties memory_properties;
-    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+bool VulkanDriver::is_depth_prepass_enabled() const {
+    return _depth_prepass_enabled;
+}
 
-    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i) {
-        if ((type_filter & (1 << i)) && (memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
-            out_memory_type = i;
-            return true;
-        }
+const VulkanDriver::DepthStats &VulkanDriver::get_depth_stats() const {
+    return _depth_stats;
+}
+
+void VulkanDriver::capture_next_frame(const char *fpath) {
+    assert(fpath != nullptr);
+    strncpy(_capture_path, fpath, Readback::MAX_PATH_LENGTH - 1);
+    _capture_path[Readback::MAX_PATH_LENGTH - 1] = 0;
+    _capture_requested = true;
+}
+
+void VulkanDriver::set_capture_interval(uint32_t frame_interval, const char *path_prefix) {
+    _capture_interval = frame_interval;
+    if (path_prefix != nullptr) {
+        strncpy(_capture_prefix, path_prefix, Readback::MAX_PATH_LENGTH - 1);
+        _capture_prefix[Readback::MAX_PATH_LENGTH - 1] = 0;
+    } else {
+        _capture_prefix[0] = 0;
+    }
+}
+
+VkCommandBuffer VulkanDriver::record_capture(uint32_t image_index) {
+
+    const char *fpath = nullptr;
+    char numbered_path[Readback::MAX_PATH_LENGTH];
+
+    if (_capture_requested) {
+        _capture_requested = false;
+        fpath = _capture_path;
+
+    } else if (_capture_interval != 0 && _frame_count % _capture_interval == 0) {
+        snprintf(numbered_path, sizeof(numbered_path), "%s%06llu.png", _capture_prefix, (unsigned long long)_frame_count);
+        fpath = numbered_path;
+    }
+
+    if (fpath == nullptr) {
+        return VK_NULL_HANDLE;
+    }
+
+    if (!_swap_chain_readback_supported) {
+        LOG_ERROR("Swap chain images can't be read back on this device, can't capture ", fpath);
+        return VK_NULL_HANDLE;
     }
 
-    Log::error("Could not find Vulkan memory type");
-    return false;
+    // The render pass leaves the image ready for presentation
+    return _readback.record(_swap_chain_images[image_index], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        _swap_chain_image_format, _swap_chain_extent, fpath);
 }
 
-bool VulkanDriver::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& buffer_memory) {
+bool VulkanDriver::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, GpuMemory::Category category,
+    VkBuffer& buffer, VkDeviceMemory& buffer_memory) {
 
     VkBufferCreateInfo create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1125,7 +1707,7 @@ bool VulkanDriver::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, Vk
     create_info.usage = usage;
     create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    CHECK_RESULT_V(vkCreateBuffer(_device, &create_info, nullptr, &buffer), false);
+    CHECK_RESULT_V(vkCreateBuffer(_device, &create_info, VULKAN_ALLOCATOR, &buffer), false);
 
     VkMemoryRequirements memory_requirements;
     vkGetBufferMemoryRequirements(_device, buffer, &memory_requirements);
@@ -1133,8 +1715,8 @@ bool VulkanDriver::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, Vk
     VkMemoryAllocateInfo alloc_info = {};
     alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     alloc_info.allocationSize = memory_requirements.size;
-    ERR_FAIL_COND_V(!find_memory_type(_physical_device, memory_requirements.memoryTypeBits, properties, alloc_info.memoryTypeIndex), false);
-    CHECK_RESULT_V(vkAllocateMemory(_device, &alloc_info, nullptr, &buffer_memory), false);
+    ERR_FAIL_COND_V(!_gpu_memory.find_memory_type(memory_requirements.memoryTypeBits, properties, alloc_info.memoryTypeIndex), false);
+    ERR_FAIL_COND_V(!_gpu_memory.allocate(_device, alloc_info, category, buffer_memory), false);
 
     // Note: if the offset is non-zero, then it is required to be divisible by memRequirements.alignment.
     // Also we are limited to a few thousand buffers.
@@ -1145,7 +1727,54 @@ bool VulkanDriver::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, Vk
     return true;
 }
 
+bool VulkanDriver::create_image(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+    VkMemoryPropertyFlags properties, VkImage &image, VkDeviceMemory &image_memory) {
+
+    VkImageCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    create_info.imageType = VK_IMAGE_TYPE_2D;
+    create_info.extent.width = width;
+    create_info.extent.height = height;
+    create_info.extent.depth = 1;
+    create_info.mipLevels = 1;
+    create_info.arrayLayers = 1;
+    create_info.format = format;
+    create_info.tiling = tiling;
+    create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    create_info.usage = usage;
+    create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    CHECK_RESULT_V(vkCreateImage(_device, &create_info, VULKAN_ALLOCATOR, &image), false);
+
+    VkMemoryRequirements memory_requirements;
+    vkGetImageMemoryRequirements(_device, image, &memory_requirements);
+
+    VkMemoryAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = memory_requirements.size;
+    ERR_FAIL_COND_V(!_gpu_memory.find_memory_type(memory_requirements.memoryTypeBits, properties, alloc_info.memoryTypeIndex), false);
+    ERR_FAIL_COND_V(!_gpu_memory.allocate(_device, alloc_info, GpuMemory::IMAGE, image_memory), false);
+
+    CHECK_RESULT_V(vkBindImageMemory(_device, image, image_memory, 0), false);
+
+    return true;
+}
+
+void VulkanDriver::free_memory(VkDeviceMemory memory) {
+    _gpu_memory.free(_device, memory);
+}
+
+GpuMemory &VulkanDriver::get_gpu_memory() {
+    return _gpu_memory;
+}
+
+Arena &VulkanDriver::get_frame_arena() {
+    return _frame_arena;
+}
+
 bool VulkanDriver::copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size) {
+    TRACE_SCOPE(s_upload_event, size);
 
     if (_short_lived_command_pool == VK_NULL_HANDLE) {
 
@@ -1156,7 +1785,7 @@ bool VulkanDriver::copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDevic
         create_info.queueFamilyIndex = _queue_family_indices.graphics;
         create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-        CHECK_RESULT_V(vkCreateCommandPool(_device, &create_info, nullptr, &_short_lived_command_pool), false);
+        CHECK_RESULT_V(vkCreateCommandPool(_device, &create_info, VULKAN_ALLOCATOR, &_short_lived_command_pool), false);
     }
 
     VkCommandBufferAllocateInfo alloc_info = {};
@@ -1195,6 +1824,98 @@ bool VulkanDriver::copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDevic
     return true;
 }
 
+bool VulkanDriver::load_buffer(const char *fpath, uint64_t offset, VkDeviceSize size, VkBufferUsageFlags usage,
+    GpuMemory::Category category, BufferLoadedCallback callback, void *userdata) {
+
+    assert(callback != nullptr);
+    ERR_FAIL_COND_V(size == 0, false);
+    const size_t fpath_length = strlen(fpath);
+    ERR_FAIL_COND_V(fpath_length >= BufferLoad::MAX_PATH_LENGTH, false);
+
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_buffer_memory;
+    VkMemoryPropertyFlags staging_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    ERR_FAIL_COND_V(!create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_flags, GpuMemory::STAGING,
+        staging_buffer, staging_buffer_memory), false);
+
+    // The file is read straight into the mapping, which stays until the load is finished
+    void *mapped;
+    VkResult result = vkMapMemory(_device, staging_buffer_memory, 0, size, 0, &mapped);
+    if (result != VK_SUCCESS) {
+        LOG_ERROR("Failed to map staging buffer to load ", fpath, ", result: ", result);
+        vkDestroyBuffer(_device, staging_buffer, VULKAN_ALLOCATOR);
+        free_memory(staging_buffer_memory);
+        return false;
+    }
+
+    PoolHandle<BufferLoad> handle = _buffer_loads.create();
+    BufferLoad &load = *_buffer_loads.get(handle);
+    load.driver = this;
+    load.handle = handle;
+    load.staging_buffer = staging_buffer;
+    load.staging_buffer_memory = staging_buffer_memory;
+    load.size = size;
+    load.usage = usage;
+    load.category = category;
+    load.callback = callback;
+    load.userdata = userdata;
+    memcpy(load.fpath, fpath, fpath_length + 1);
+
+    AsyncIO::Read read = {};
+    read.path = load.fpath;
+    read.offset = offset;
+    read.size = static_cast<size_t>(size);
+    read.destination = mapped;
+    read.callback = on_buffer_read;
+    read.userdata = &load;
+    _async_io.submit(read);
+
+    return true;
+}
+
+// Static
+void VulkanDriver::on_buffer_read(AsyncIO::Handle handle, AsyncIO::Status status, size_t bytes_read, void *userdata) {
+    (void)handle;
+    BufferLoad *load = static_cast<BufferLoad*>(userdata);
+    load->driver->finish_buffer_load(*load, status, bytes_read);
+}
+
+void VulkanDriver::finish_buffer_load(BufferLoad &load, AsyncIO::Status status, size_t bytes_read) {
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory buffer_memory = VK_NULL_HANDLE;
 
+    if (status != AsyncIO::STATUS_DONE) {
+        LOG_ERROR("Failed to read ", load.fpath);
 
+    } else if (bytes_read != load.size) {
+        // Reads stop at the end of the file
+        LOG_ERROR("Failed to load ", load.fpath, ": ", bytes_read, " bytes read out of ", load.size);
 
+    } else {
+        VkBufferUsageFlags usage = load.usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        if (!create_buffer(load.size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, load.category, buffer, buffer_memory)
+                || !copy_buffer(load.staging_buffer, buffer, load.size)) {
+            LOG_ERROR("Failed to upload ", load.fpath);
+            if (buffer != VK_NULL_HANDLE) {
+                vkDestroyBuffer(_device, buffer, VULKAN_ALLOCATOR);
+            }
+            if (buffer_memory != VK_NULL_HANDLE) {
+                free_memory(buffer_memory);
+            }
+            buffer = VK_NULL_HANDLE;
+            buffer_memory = VK_NULL_HANDLE;
+        }
+    }
+
+    // copy_buffer waited for the copy to finish
+    vkUnmapMemory(_device, load.staging_buffer_memory);
+    vkDestroyBuffer(_device, load.staging_buffer, VULKAN_ALLOCATOR);
+    free_memory(load.staging_buffer_memory);
+
+    BufferLoadedCallback callback = load.callback;
+    void *userdata = load.userdata;
+    _buffer_loads.destroy(load.handle);
+
+    callback(buffer, buffer_memory, userdata);
+}
@@ -3,16 +3,24 @@
 
 #include <vulkan/vulkan.h>
 #include "core/vector.h"
+#include "core/arena.h"
+#include "core/async_io.h"
+#include "core/pool.h"
 #include "core/math/vector2.h"
+#include "gpu_memory.h"
+#include "readback.h"
 
 class Window;
 class Mesh;
+class RenderChunk;
 
 class VulkanDriver {
 public:
     VulkanDriver();
     ~VulkanDriver();
 
+    // Extension and layer lists are taken by value because the driver adds its own,
+    // callers can move them in to avoid copies
     bool create(const char *app_name,
         Vector<const char *> required_extensions,
         Vector<const char *> required_layers,
@@ -23,17 +31,66 @@ public:
 
     void wait();
 
-    // TODO Not sure yet about the architecture
-    Vector<Mesh*> scene;
+    // Creates a group of meshes sharing cached command buffers, owned by the driver.
+    // Meshes that change often should go in a different chunk than static ones.
+    RenderChunk *create_chunk();
 
-    bool create_command_buffers();
+    // Creates a mesh owned by the driver. If no chunk is given, the mesh goes in a default one.
+    Mesh *create_mesh(RenderChunk *chunk = nullptr);
 
     VkDevice get_device() const;
     VkPhysicalDevice get_physical_device() const;
 
-    bool create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& buffer_memory);
+    bool create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, GpuMemory::Category category,
+        VkBuffer& buffer, VkDeviceMemory& buffer_memory);
     bool copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size);
 
+    // Called by draw() once a buffer loaded from a file was uploaded. On failure, the buffer and its memory are null.
+    typedef void (*BufferLoadedCallback)(VkBuffer buffer, VkDeviceMemory buffer_memory, void *userdata);
+
+    // Creates a device-local buffer from a region of a file, without blocking the frame loop.
+    // The file is read in the background straight into a staging buffer, which draw() copies once the read completed.
+    // The buffer given to the callback then belongs to the caller, like one from create_buffer.
+    bool load_buffer(const char *fpath, uint64_t offset, VkDeviceSize size, VkBufferUsageFlags usage, GpuMemory::Category category,
+        BufferLoadedCallback callback, void *userdata);
+
+    bool create_image(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+        VkMemoryPropertyFlags properties, VkImage &image, VkDeviceMemory &image_memory);
+
+    // Memory obtained from create_buffer or create_image must be freed with this so it can be tracked
+    void free_memory(VkDeviceMemory memory);
+
+    GpuMemory &get_gpu_memory();
+
+    // For data only needed until the end of the frame, see ArenaScope
+    Arena &get_frame_arena();
+
+    // When enabled, scene geometry is first rendered into the depth buffer only,
+    // then the color pass shades only the visible fragments using an EQUAL depth test.
+    // Changing this recreates the view on the next frame.
+    void set_depth_prepass_enabled(bool enabled);
+    bool is_depth_prepass_enabled() const;
+
+    struct DepthStats {
+        // Fragment shader invocations of the color pass
+        uint64_t fragment_invocations = 0;
+        uint64_t pixel_count = 0;
+
+        // Average number of shaded fragments per pixel. 1 means no overdraw.
+        float get_depth_complexity() const {
+            return pixel_count == 0 ? 0.f : static_cast<float>(fragment_invocations) / static_cast<float>(pixel_count);
+        }
+    };
+
+    // Last known statistics, lagging a few frames behind.
+    // Stays empty if the device doesn't support pipeline statistics queries.
+    const DepthStats &get_depth_stats() const;
+
+    // Saves the next presented frame as a PNG file. The file is written asynchronously a few frames later.
+    void capture_next_frame(const char *fpath);
+    // Saves one frame every `frame_interval` frames, as `<path_prefix><frame number>.png`. 0 disables it.
+    void set_capture_interval(uint32_t frame_interval, const char *path_prefix);
+
 private:
     bool resize(const Window &window);
     bool create_view(const Window &window);
@@ -49,9 +106,38 @@ private:
     void query_swap_chain_details(VkPhysicalDevice device, VkSurfaceKHR surface, SwapChainSupportDetails & out_details) const;
 
     bool create_swap_chain(const Window &window);
+    bool create_depth_resources();
     bool create_render_pass();
     bool create_pipeline();
+    bool create_depth_pipeline();
     bool create_framebuffers();
+    bool create_query_pool();
+    bool create_command_buffers();
+
+    bool record_command_buffer(uint32_t image_index);
+
+    void read_depth_stats(uint32_t image_index);
+    VkCommandBuffer record_capture(uint32_t image_index);
+
+    struct BufferLoad {
+        // Asset paths can be longer than capture paths
+        static const int MAX_PATH_LENGTH = 1024;
+
+        VulkanDriver *driver;
+        PoolHandle<BufferLoad> handle;
+        VkBuffer staging_buffer;
+        VkDeviceMemory staging_buffer_memory;
+        VkDeviceSize size;
+        VkBufferUsageFlags usage;
+        GpuMemory::Category category;
+        BufferLoadedCallback callback;
+        void *userdata;
+        // Used by the I/O thread until the read completes
+        char fpath[MAX_PATH_LENGTH];
+    };
+
+    static void on_buffer_read(AsyncIO::Handle handle, AsyncIO::Status status, size_t bytes_read, void *userdata);
+    void finish_buffer_load(BufferLoad &load, AsyncIO::Status status, size_t bytes_read);
 
     VkInstance _instance;
     VkDebugUtilsMessengerEXT _debug_messenger;
@@ -71,8 +157,6 @@ private:
 
     QueueFamilyIndices _queue_family_indices;
 
-    SwapChainSupportDetails _swap_chain_support_details;
-
     VkSurfaceKHR _surface;
 
     VkSwapchainKHR _swap_chain;
@@ -80,22 +164,60 @@ private:
     Vector<VkImageView> _swap_chain_image_views;
     Vector<VkFramebuffer> _swap_chain_framebuffers;
     VkFormat _swap_chain_image_format;
+    bool _swap_chain_readback_supported;
     VkExtent2D _swap_chain_extent;
     bool _scheduled_resize;
 
+    VkFormat _depth_format;
+    VkImage _depth_image;
+    VkDeviceMemory _depth_image_memory;
+    VkImageView _depth_image_view;
+    bool _depth_prepass_enabled;
+
     VkRenderPass _render_pass;
     VkPipelineLayout _pipeline_layout;
     VkPipeline _graphics_pipeline;
+    VkPipeline _depth_pipeline;
+
+    GpuMemory _gpu_memory;
+    bool _memory_budget_supported;
+
+    bool _pipeline_statistics_supported;
+    // One query per swap chain image, because command buffers are recorded per image
+    VkQueryPool _stats_query_pool;
+    Vector<bool> _stats_query_submitted;
+    DepthStats _depth_stats;
 
     VkCommandPool _command_pool;
     VkCommandPool _short_lived_command_pool;
+    // Primary command buffers, one per swap chain image.
+    // They only execute the secondary command buffers of chunks, so they are cheap to record again.
     Vector<VkCommandBuffer> _command_buffers;
+    Vector<bool> _command_buffers_dirty;
+
+    Pool<Mesh> _meshes;
+    Vector<RenderChunk*> _chunks;
 
     // One for each in-flight image
     Vector<VkSemaphore> _image_available_semaphores;
     Vector<VkSemaphore> _render_finished_semaphores;
     Vector<VkFence> _in_flight_fences;
+    // Fence of the frame last using each swap chain image, so we know when its command buffers can be recorded again
+    Vector<VkFence> _images_in_flight;
     uint32_t _current_frame;
+    uint64_t _frame_count;
+    // For transient data, reset at the end of each frame
+    Arena _frame_arena;
+
+    // Reads files for load_buffer, completions are handled at the beginning of draw()
+    AsyncIO _async_io;
+    Pool<BufferLoad> _buffer_loads;
+
+    Readback _readback;
+    bool _capture_requested;
+    char _capture_path[Readback::MAX_PATH_LENGTH];
+    uint32_t _capture_interval;
+    char _capture_prefix[Readback::MAX_PATH_LENGTH];
 };
 
 #endif // HEADER_VULKAN_DRIVER_H
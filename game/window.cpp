@@ -53,8 +53,8 @@ void Window::poll_events() {
 
 bool Window::pop_event(InputEvent &out_event) {
     if (_events.size() != 0) {
-        out_event = _events.back();
-        _events.pop_back();
+        out_event = _events.front();
+        _events.pop_front();
         return true;
     } else {
         return false;
@@ -62,7 +62,7 @@ bool Window::pop_event(InputEvent &out_event) {
 }
 
 void Window::push_event(InputEvent event) {
-    _events.push_front(event);
+    _events.push_back(event);
 }
 
 void Window::get_required_vulkan_extensions(Vector<const char*> &out_required_extensions) {
@@ -6,6 +6,7 @@
 //#include <vulkan/vulkan.h>
 #include "core/math/vector2.h"
 #include "core/vector.h"
+#include "core/deque.h"
 
 struct InputEvent {
 
@@ -40,7 +41,8 @@ private:
     GLFWwindow* _window;
     Vector2i _size;
 
-    Vector<InputEvent> _events;
+    // Events are pushed at the back and popped from the front
+    Deque<InputEvent> _events;
 };
 
 #endif // HEADER_WINDOW_H
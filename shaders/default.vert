@@ -10,6 +10,9 @@ out gl_PerVertex {
     vec4 gl_Position;
 };
 
+// Must match the depth pre-pass exactly, because the color pass then tests with EQUAL
+invariant gl_Position;
+
 void main() {
     gl_Position = vec4(inPosition, 0.0, 1.0);
     fragColor = inColor;
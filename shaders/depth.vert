@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Position-only shader used by the depth pre-pass
+
+layout(location = 0) in vec2 inPosition;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = vec4(inPosition, 0.0, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,374 @@
+#include "core/console.h"
+#include "core/hash.h"
+#include "core/hash_map.h"
+#include "core/math/vector2.h"
+#include "core/number_format.h"
+#include "core/string.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+// Compares core containers and formatting with the implementations they replaced.
+//
+//     benchmark [name filter]
+//
+// Runs the benchmarks whose name contains the filter, or all of them.
+// Timings depend on the machine, they are only meaningful relative to each other.
+
+typedef std::chrono::steady_clock Clock;
+
+// Results are accumulated here, so the measured work can't be optimized out
+static volatile uint64_t g_sink;
+// Set when a benchmark finds a wrong result, the program then fails
+static bool g_failed = false;
+
+// Deterministic, so runs are comparable
+struct Random {
+    uint64_t state;
+
+    Random(uint64_t p_seed = 1): state(p_seed) {}
+
+    // SplitMix64
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+static double get_elapsed_ms(Clock::time_point p_start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - p_start).count();
+}
+
+static void print_time(const char *p_name, double p_ms) {
+    String line;
+    line += "    ";
+    line += p_name;
+    line += ": ";
+    append_float_fixed(line, p_ms, 1);
+    line += " ms";
+    Console::print_line(line);
+}
+
+static void print_throughput(const char *p_name, size_t p_bytes, double p_ms) {
+    String line;
+    line += "    ";
+    line += p_name;
+    line += ": ";
+    append_float_fixed(line, p_bytes / (p_ms * 1000000.0), 2);
+    line += " GB/s";
+    Console::print_line(line);
+}
+
+//------------------------------------------------------------------------------
+// Open addressing HashMap against std::unordered_map, with random 64-bit keys
+
+static const size_t HASH_MAP_KEY_COUNT = 1 << 20;
+
+template <typename M>
+static void run_map(const char *p_name, const Vector<uint64_t> &p_keys, const Vector<uint64_t> &p_missing_keys,
+        void (*p_insert)(M &, uint64_t, uint64_t), bool (*p_has)(const M &, uint64_t)) {
+
+    M map;
+    String name;
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < p_keys.size(); ++i) {
+        p_insert(map, p_keys[i], i);
+    }
+    name = p_name;
+    name += " insert";
+    print_time(name.c_str(), get_elapsed_ms(start));
+
+    size_t found = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < p_keys.size(); ++i) {
+        found += p_has(map, p_keys[i]);
+    }
+    name = p_name;
+    name += " lookup";
+    print_time(name.c_str(), get_elapsed_ms(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < p_missing_keys.size(); ++i) {
+        found += p_has(map, p_missing_keys[i]);
+    }
+    name = p_name;
+    name += " lookup missing";
+    print_time(name.c_str(), get_elapsed_ms(start));
+
+    g_sink += found;
+}
+
+typedef HashMap<uint64_t, uint64_t> CoreMap;
+typedef std::unordered_map<uint64_t, uint64_t> StdMap;
+
+static void bench_hash_map() {
+    Vector<uint64_t> keys;
+    Vector<uint64_t> missing_keys;
+    keys.resize_no_init(HASH_MAP_KEY_COUNT);
+    missing_keys.resize_no_init(HASH_MAP_KEY_COUNT);
+    // Odd and even keys, so none of the missing keys are present
+    Random rng;
+    for (size_t i = 0; i < HASH_MAP_KEY_COUNT; ++i) {
+        keys[i] = rng.next() | 1;
+        missing_keys[i] = rng.next() & ~uint64_t(1);
+    }
+
+    run_map<CoreMap>("HashMap", keys, missing_keys,
+        [](CoreMap &m, uint64_t k, uint64_t v) { m.set(k, v); },
+        [](const CoreMap &m, uint64_t k) { return m.has(k); });
+
+    run_map<StdMap>("std::unordered_map", keys, missing_keys,
+        [](StdMap &m, uint64_t k, uint64_t v) { m[k] = v; },
+        [](const StdMap &m, uint64_t k) { return m.find(k) != m.end(); });
+}
+
+//------------------------------------------------------------------------------
+// hash_bytes against FNV-1a, which hashed strings before, on inputs of various sizes
+
+static const size_t HASH_INPUT_SIZES[] = { 8, 56, 1024, 1024 * 1024 };
+// Bytes hashed for each input size
+static const size_t HASH_TOTAL_BYTES = 256 * 1024 * 1024;
+
+static void bench_hash_bytes() {
+    const size_t max_size = HASH_INPUT_SIZES[sizeof(HASH_INPUT_SIZES) / sizeof(HASH_INPUT_SIZES[0]) - 1];
+    Vector<uint8_t> data;
+    data.resize_no_init(max_size);
+    Random rng;
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>(rng.next());
+    }
+
+    String name;
+    for (size_t s = 0; s < sizeof(HASH_INPUT_SIZES) / sizeof(HASH_INPUT_SIZES[0]); ++s) {
+        const size_t size = HASH_INPUT_SIZES[s];
+        const size_t iterations = HASH_TOTAL_BYTES / size;
+        // Smaller inputs start at varying offsets, like keys stored in a table
+        const size_t offset_mask = size + 256 <= max_size ? 255 : 0;
+        uint64_t h = 0;
+
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            h += Hash::hash_bytes(data.data() + ((i * 64) & offset_mask), size);
+        }
+        double ms = get_elapsed_ms(start);
+        name = "hash_bytes ";
+        append_int(name, size);
+        print_throughput(name.c_str(), iterations * size, ms);
+
+        // The previous hash is much slower, so it gets less data
+        const size_t fnv_iterations = iterations / 8;
+        start = Clock::now();
+        for (size_t i = 0; i < fnv_iterations; ++i) {
+            const char *p = reinterpret_cast<const char*>(data.data()) + ((i * 64) & offset_mask);
+            h += Hash::hash_chars(p, size);
+        }
+        ms = get_elapsed_ms(start);
+        name = "FNV-1a ";
+        append_int(name, size);
+        print_throughput(name.c_str(), fnv_iterations * size, ms);
+
+        g_sink += h;
+    }
+}
+
+//------------------------------------------------------------------------------
+// FMT literals against runtime format strings and plain concatenation, with patterns used by logging.
+// Each message is built into a new string, as logging does.
+
+static const size_t FORMAT_ITERATIONS = 2000000;
+
+static void bench_format() {
+    const Vector2i size(1920, 1080);
+    const String mode("FIFO");
+    size_t total = 0;
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < FORMAT_ITERATIONS; ++i) {
+        int n = static_cast<int>(i);
+        total += String::format(FMT("Found % Vulkan physical devices"), n).length();
+        total += String::format(FMT("Created swapchain % with % images, mode %, frame %"), size, 3, mode, n).length();
+        total += String::format(FMT("Loading % failed: % bytes read out of %"), mode, n, n + 1).length();
+    }
+    print_time("FMT", get_elapsed_ms(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < FORMAT_ITERATIONS; ++i) {
+        int n = static_cast<int>(i);
+        total += String::format("Found % Vulkan physical devices", n).length();
+        total += String::format("Created swapchain % with % images, mode %, frame %", size, 3, mode, n).length();
+        total += String::format("Loading % failed: % bytes read out of %", mode, n, n + 1).length();
+    }
+    print_time("runtime format", get_elapsed_ms(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < FORMAT_ITERATIONS; ++i) {
+        int n = static_cast<int>(i);
+        {
+            String s;
+            s += "Found ";
+            to_string(s, n);
+            s += " Vulkan physical devices";
+            total += s.length();
+        }
+        {
+            String s;
+            s += "Created swapchain ";
+            to_string(s, size);
+            s += " with ";
+            to_string(s, 3);
+            s += " images, mode ";
+            s += mode;
+            s += ", frame ";
+            to_string(s, n);
+            total += s.length();
+        }
+        {
+            String s;
+            s += "Loading ";
+            s += mode;
+            s += " failed: ";
+            to_string(s, n);
+            s += " bytes read out of ";
+            to_string(s, n + 1);
+            total += s.length();
+        }
+    }
+    print_time("concatenation", get_elapsed_ms(start));
+
+    g_sink += total;
+}
+
+//------------------------------------------------------------------------------
+// NumberFormat against snprintf, which formatted numbers before
+
+static const size_t NUMBER_COUNT = 4000000;
+
+// Values whose fixed notation doesn't fit in a 64-bit integer once scaled, or that round to zero.
+// None of them are exact ties, which printf rounds to even.
+static const struct {
+    double value;
+    int decimals;
+} FIXED_CASES[] = {
+    { 12345.678, 15 },
+    { 1234567.0, 15 },
+    { 988000.1320308625, 13 },
+    { 1e19, 0 },
+    { -1e19, 3 },
+    { 1.7976931348623157e308, 15 },
+    { 9007199254740993.0, 2 },
+    { 0.9999999999999999, 15 },
+    { 0.999999, 3 },
+    { -0.001, 2 },
+    { -0.0, 3 },
+    { 2.675, 2 }
+};
+
+static void check_fixed_cases() {
+    char ours[NumberFormat::MAX_FIXED_LENGTH + 1];
+    char expected[NumberFormat::MAX_FIXED_LENGTH + 1];
+    for (size_t i = 0; i < sizeof(FIXED_CASES) / sizeof(FIXED_CASES[0]); ++i) {
+        const double value = FIXED_CASES[i].value;
+        const int decimals = FIXED_CASES[i].decimals;
+        ours[NumberFormat::write_fixed(value, decimals, ours)] = 0;
+        snprintf(expected, sizeof(expected), "%.*f", decimals, value);
+        if (strcmp(ours, expected) != 0) {
+            Console::print_line("    write_fixed mismatch: ", ours, " instead of ", expected);
+            g_failed = true;
+        }
+    }
+}
+
+static void bench_number_format() {
+    check_fixed_cases();
+
+    Vector<double> doubles;
+    Vector<int64_t> ints;
+    doubles.resize_no_init(NUMBER_COUNT);
+    ints.resize_no_init(NUMBER_COUNT);
+    // Magnitudes seen in logs and UI
+    const double magnitudes[] = { 1e-3, 1e-2, 1e-1, 1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+    Random rng;
+    for (size_t i = 0; i < NUMBER_COUNT; ++i) {
+        // Uniform in [-1, 1)
+        double unit = static_cast<double>(rng.next() >> 11) / 4503599627370496.0 - 1.0;
+        doubles[i] = unit * magnitudes[rng.next() % (sizeof(magnitudes) / sizeof(magnitudes[0]))];
+        // All digit counts
+        ints[i] = static_cast<int64_t>(rng.next()) >> (rng.next() % 64);
+    }
+
+    char buffer[NumberFormat::MAX_FIXED_LENGTH + 1];
+    size_t total = 0;
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < NUMBER_COUNT; ++i) {
+        total += NumberFormat::write_shortest(doubles[i], buffer);
+    }
+    print_time("write_shortest", get_elapsed_ms(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < NUMBER_COUNT; ++i) {
+        total += snprintf(buffer, sizeof(buffer), "%.17g", doubles[i]);
+    }
+    print_time("snprintf %.17g", get_elapsed_ms(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < NUMBER_COUNT; ++i) {
+        total += NumberFormat::write_fixed(doubles[i], 3, buffer);
+    }
+    print_time("write_fixed 3", get_elapsed_ms(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < NUMBER_COUNT; ++i) {
+        total += snprintf(buffer, sizeof(buffer), "%.3f", doubles[i]);
+    }
+    print_time("snprintf %.3f", get_elapsed_ms(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < NUMBER_COUNT; ++i) {
+        String s;
+        append_int(s, ints[i]);
+        total += s.length();
+    }
+    print_time("append_int", get_elapsed_ms(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < NUMBER_COUNT; ++i) {
+        total += snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(ints[i]));
+    }
+    print_time("snprintf %lld", get_elapsed_ms(start));
+
+    g_sink += total;
+}
+
+//------------------------------------------------------------------------------
+
+struct Benchmark {
+    const char *name;
+    void (*run)();
+};
+
+static const Benchmark BENCHMARKS[] = {
+    { "hash_map", bench_hash_map },
+    { "hash_bytes", bench_hash_bytes },
+    { "format", bench_format },
+    { "number_format", bench_number_format }
+};
+
+int main(int argc, char **argv) {
+    const char *filter = argc > 1 ? argv[1] : "";
+
+    for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); ++i) {
+        const Benchmark &b = BENCHMARKS[i];
+        if (strstr(b.name, filter) == nullptr) {
+            continue;
+        }
+        Console::print_line(b.name);
+        b.run();
+    }
+
+    return g_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
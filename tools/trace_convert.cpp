@@ -0,0 +1,229 @@
+#include "core/trace.h"
+#include "core/console.h"
+#include "core/file.h"
+#include "core/string.h"
+#include <algorithm> // std::stable_sort
+#include <cstring>
+
+// Decodes a file written by Trace into text, one event per line, or into Chrome trace JSON.
+//
+//     trace_convert [--json] <trace file> <output file>
+//
+
+static const char *get_phase_name(uint8_t p_phase) {
+    switch (p_phase) {
+        case Trace::PHASE_BEGIN:
+            return "begin";
+        case Trace::PHASE_END:
+            return "end";
+        case Trace::PHASE_INSTANT:
+            return "instant";
+        case Trace::PHASE_COUNTER:
+            return "counter";
+        default:
+            return "unknown";
+    }
+}
+
+static void append_json_string(String &dst, const String &p_str) {
+    dst += '"';
+    for (size_t i = 0; i < p_str.length(); ++i) {
+        char c = p_str[i];
+        if (c == '"' || c == '\\') {
+            dst += '\\';
+        }
+        dst += c;
+    }
+    dst += '"';
+}
+
+struct Decoder {
+    const Trace::FileHeader *header;
+    const Trace::Record *records;
+    size_t record_count;
+    Vector<String> event_names;
+    // Indices of event records, sorted by time
+    Vector<uint32_t> order;
+
+    inline double get_time_us(uint64_t p_ticks) const {
+        uint64_t tick_span = header->end_ticks > header->start_ticks ? header->end_ticks - header->start_ticks : 1;
+        return static_cast<double>(p_ticks - header->start_ticks) * header->elapsed_ns / tick_span / 1000.0;
+    }
+
+    inline const String &get_event_name(uint16_t p_event) const {
+        static const String s_unknown("?");
+        return p_event < event_names.size() && event_names[p_event].length() != 0 ? event_names[p_event] : s_unknown;
+    }
+};
+
+static bool decode(Span<const uint8_t> p_bytes, Decoder &decoder) {
+    if (p_bytes.size() < sizeof(Trace::FileHeader)) {
+        Console::print_line("The file is too small to be a trace");
+        return false;
+    }
+
+    decoder.header = reinterpret_cast<const Trace::FileHeader*>(p_bytes.data());
+    const Trace::FileHeader &header = *decoder.header;
+
+    if (memcmp(header.magic, Trace::FILE_MAGIC, sizeof(header.magic)) != 0) {
+        Console::print_line("The file is not a trace");
+        return false;
+    }
+    if (header.version != Trace::FILE_VERSION || header.record_size != sizeof(Trace::Record)) {
+        Console::print_line("Unsupported trace version ", (int64_t)header.version);
+        return false;
+    }
+
+    // Less records than the header says if the program was stopped while copying them
+    size_t available_count = (p_bytes.size() - sizeof(Trace::FileHeader)) / sizeof(Trace::Record);
+    decoder.record_count = header.record_count < available_count ? header.record_count : available_count;
+    decoder.records = reinterpret_cast<const Trace::Record*>(p_bytes.data() + sizeof(Trace::FileHeader));
+
+    // Names can be declared anywhere, events constructed after the start are named when constructed
+    for (size_t i = 0; i < decoder.record_count; ++i) {
+        const Trace::Record &r = decoder.records[i];
+        if (r.phase != Trace::PHASE_NAME) {
+            decoder.order.push_back(static_cast<uint32_t>(i));
+            continue;
+        }
+        if (r.event >= decoder.event_names.size()) {
+            decoder.event_names.resize(r.event + 1, String());
+        }
+        if (r.name_chunk == 0) {
+            decoder.event_names[r.event] = String();
+        }
+        const char *chunk = reinterpret_cast<const char*>(r.payload);
+        size_t len = 0;
+        while (len < sizeof(r.payload) && chunk[len] != '\0') {
+            ++len;
+        }
+        decoder.event_names[r.event].append_region(chunk, 0, len);
+    }
+
+    const Trace::Record *records = decoder.records;
+    std::stable_sort(decoder.order.data(), decoder.order.data() + decoder.order.size(), [records](uint32_t a, uint32_t b) {
+        return records[a].timestamp < records[b].timestamp;
+    });
+
+    return true;
+}
+
+// Output is written by batches of this size
+static const size_t BATCH_SIZE = 64 * 1024;
+
+static bool write_batch(File &f, String &batch, bool p_force) {
+    if (batch.length() < BATCH_SIZE && !p_force) {
+        return true;
+    }
+    bool ok = f.write_bytes(reinterpret_cast<const uint8_t*>(batch.c_str()), batch.length());
+    batch.clear();
+    return ok;
+}
+
+static bool write_text(const Decoder &decoder, File &f, String &dst) {
+    for (size_t i = 0; i < decoder.order.size(); ++i) {
+        const Trace::Record &r = decoder.records[decoder.order[i]];
+        append_float_fixed(dst, decoder.get_time_us(r.timestamp), 3);
+        dst.append_format(FMT(" us thread % % % "), (int64_t)r.thread, decoder.get_event_name(r.event), get_phase_name(r.phase));
+        if (r.phase == Trace::PHASE_COUNTER) {
+            to_string(dst, static_cast<int64_t>(r.payload[0]));
+        } else {
+            dst.append_format(FMT("% %"), (int64_t)r.payload[0], (int64_t)r.payload[1]);
+        }
+        dst += '\n';
+        if (!write_batch(f, dst, false)) {
+            return false;
+        }
+    }
+    return write_batch(f, dst, true);
+}
+
+static bool write_json(const Decoder &decoder, File &f, String &dst) {
+    dst += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+    for (size_t i = 0; i < decoder.order.size(); ++i) {
+        const Trace::Record &r = decoder.records[decoder.order[i]];
+
+        dst += "{\"name\":";
+        append_json_string(dst, decoder.get_event_name(r.event));
+        dst += ",\"ph\":\"";
+        switch (r.phase) {
+            case Trace::PHASE_BEGIN:
+                dst += 'B';
+                break;
+            case Trace::PHASE_END:
+                dst += 'E';
+                break;
+            case Trace::PHASE_COUNTER:
+                dst += 'C';
+                break;
+            default:
+                // Scoped to the thread
+                dst += "i\",\"s\":\"t";
+                break;
+        }
+        dst += "\",\"ts\":";
+        append_float_fixed(dst, decoder.get_time_us(r.timestamp), 3);
+        dst.append_format(FMT(",\"pid\":0,\"tid\":%,\"args\":{"), (int64_t)r.thread);
+        if (r.phase == Trace::PHASE_COUNTER) {
+            dst.append_format(FMT("\"value\":%}}"), static_cast<int64_t>(r.payload[0]));
+        } else {
+            dst.append_format(FMT("\"a\":%,\"b\":%}}"), (int64_t)r.payload[0], (int64_t)r.payload[1]);
+        }
+        dst += i + 1 < decoder.order.size() ? ",\n" : "\n";
+        if (!write_batch(f, dst, false)) {
+            return false;
+        }
+    }
+
+    dst += "]}\n";
+    return write_batch(f, dst, true);
+}
+
+int main(int argc, char **argv) {
+    bool json = false;
+    const char *paths[2] = { nullptr, nullptr };
+    int path_count = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        }
+    }
+
+    if (path_count != 2) {
+        Console::print_line("Usage: trace_convert [--json] <trace file> <output file>");
+        return EXIT_FAILURE;
+    }
+
+    // Traces can be large, they are read in place rather than copied
+    MappedFile trace_file;
+    if (!trace_file.open(paths[0], MappedFile::ACCESS_SEQUENTIAL)) {
+        Console::print_line("Could not read ", paths[0]);
+        return EXIT_FAILURE;
+    }
+
+    Decoder decoder;
+    if (!decode(trace_file.get_span(), decoder)) {
+        return EXIT_FAILURE;
+    }
+
+    File f;
+    // Strings grow to the exact size they need, so the batch is reserved once and reused
+    String batch;
+    batch.reserve(BATCH_SIZE + 1024);
+    if (!f.open(paths[1], File::WRITE, File::BINARY)
+            || !(json ? write_json(decoder, f, batch) : write_text(decoder, f, batch))) {
+        Console::print_line("Could not write ", paths[1]);
+        return EXIT_FAILURE;
+    }
+
+    Console::print_line((int64_t)decoder.order.size(), " events converted");
+    if (decoder.header->dropped_count != 0) {
+        Console::print_line((int64_t)decoder.header->dropped_count, " events were dropped because the trace was full");
+    }
+
+    return EXIT_SUCCESS;
+}